@@ -3,10 +3,24 @@
 #include <string>
 #include <vector>
 #include <regex>
+#include <list>
+#include <charconv>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <zlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "../server.hpp"
 
 #define DEFALT_TIMEOUT 10
+#define COMPRESS_DEFAULT_LEVEL 6    //zlib压缩级别1~9，越大压缩率越高越慢
+#define SPLICE_PIPE_SIZE (1024 * 1024)      //splice上传使用的管道容量
+#define SPLICE_READ_BUDGET (4 * 1024 * 1024) //splice上传每次可读事件最多接收的数据量
+#define COMPRESS_MIN_SIZE 1024      //小于这个大小的正文不压缩
+#define RESPONSE_SLICE_MIN_SIZE (16 * 1024) //响应正文达到这个大小时转为共享片段发送，不拷贝到发送缓冲区
+#define RESPONSE_HEADERS_RESERVE 8          //响应头部数组第一次插入时预留的个数
+typedef enum { ENCODING_IDENTITY, ENCODING_GZIP, ENCODING_DEFLATE, ENCODING_COUNT }HttpEncoding;
 
 std::unordered_map<int, std::string> _statu_msg = {
     {100,  "Continue"},
@@ -269,6 +283,21 @@ class Util {
             }
             return "Unknow";
         }
+        //状态行中协议版本之后的部分 " 200 OK\r\n"，所有三位数的状态码预先组织好，发送响应时不需要查找和拼接
+        //不合法的状态码按500发送
+        static const std::string &StatuLine(int statu) {
+            static const std::vector<std::string> lines = []() {
+                std::vector<std::string> lines(1000);
+                for (int i = 100; i < 1000; i++) {
+                    lines[i] = " " + std::to_string(i) + " " + StatuDesc(i) + "\r\n";
+                }
+                return lines;
+            }();
+            if (statu < 100 || statu >= 1000) {
+                return lines[500];
+            }
+            return lines[statu];
+        }
         //根据文件后缀名获取文件mime
         static std::string ExtMime(const std::string &filename) {
             
@@ -303,6 +332,177 @@ class Util {
             }
             return S_ISREG(st.st_mode);
         }
+        //根据Accept-Encoding选择压缩格式，都接受时优先gzip，q=0表示不接受
+        static HttpEncoding AcceptEncoding(const std::string &accept) {
+            int gzip = -1, deflate = -1, any = -1;//-1表示没有提到
+            size_t pos = 0;
+            while (pos < accept.size()) {
+                size_t end = accept.find(',', pos);
+                if (end == std::string::npos) end = accept.size();
+                std::string_view item(accept.data() + pos, end - pos);
+                pos = end + 1;
+                size_t semi = item.find(';');
+                std::string_view name = item.substr(0, semi);
+                while (name.empty() == false && (name.front() == ' ' || name.front() == '\t')) name.remove_prefix(1);
+                while (name.empty() == false && (name.back() == ' ' || name.back() == '\t')) name.remove_suffix(1);
+                int accepted = 1;
+                if (semi != std::string_view::npos) {
+                    size_t q = item.find("q=", semi);
+                    if (q != std::string_view::npos) {
+                        accepted = strtod(std::string(item.substr(q + 2)).c_str(), NULL) > 0;
+                    }
+                }
+                if (strncasecmp(name.data(), "gzip", 4) == 0 && name.size() == 4) gzip = accepted;
+                else if (strncasecmp(name.data(), "x-gzip", 6) == 0 && name.size() == 6) gzip = accepted;
+                else if (strncasecmp(name.data(), "deflate", 7) == 0 && name.size() == 7) deflate = accepted;
+                else if (name == "*") any = accepted;
+            }
+            if (gzip == 1 || (gzip == -1 && any == 1)) return ENCODING_GZIP;
+            if (deflate == 1 || (deflate == -1 && any == 1)) return ENCODING_DEFLATE;
+            return ENCODING_IDENTITY;
+        }
+        static const char *EncodingName(HttpEncoding encoding) {
+            return encoding == ENCODING_GZIP ? "gzip" : (encoding == ENCODING_DEFLATE ? "deflate" : "identity");
+        }
+        //文本类的mime值得压缩，图片、音视频、压缩包等本身已经压缩过了
+        static bool Compressible(const std::string &mime) {
+            std::string_view type(mime);
+            type = type.substr(0, type.find(';'));
+            if (type.compare(0, 5, "text/") == 0) return true;
+            auto ends_with = [&type](std::string_view suffix) {
+                return type.size() >= suffix.size() && type.compare(type.size() - suffix.size(), suffix.size(), suffix) == 0;
+            };
+            if (ends_with("+xml") || ends_with("/xml") || ends_with("/json") || ends_with("+json")) return true;
+            return type == "application/rtf" || type == "application/x-sh" || type == "application/x-csh" ||
+                   type == "application/vnd.ms-fontobject" || type == "font/otf" || type == "font/ttf" ||
+                   type == "image/bmp" || type == "image/vnd.microsoft.icon";
+        }
+        //压缩数据，gzip带gzip头尾，deflate是zlib格式；每个线程复用自己的压缩流，不用每次都分配zlib的内部状态
+        static bool Compress(const char *data, size_t len, HttpEncoding encoding, int level, std::string *out) {
+            struct Stream {
+                z_stream _zs;
+                bool _init = false;
+                int _level = 0;
+                ~Stream() { if (_init) deflateEnd(&_zs); }
+            };
+            static thread_local Stream streams[ENCODING_COUNT];
+            if (encoding == ENCODING_IDENTITY || len > UINT32_MAX) return false;
+            Stream &stream = streams[encoding];
+            if (stream._init && stream._level != level) {
+                deflateEnd(&stream._zs);
+                stream._init = false;
+            }
+            if (stream._init) {
+                deflateReset(&stream._zs);
+            }else {
+                memset(&stream._zs, 0, sizeof(stream._zs));
+                int bits = (encoding == ENCODING_GZIP) ? 15 + 16 : 15;
+                if (deflateInit2(&stream._zs, level, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+                stream._init = true;
+                stream._level = level;
+            }
+            out->resize(deflateBound(&stream._zs, len));
+            stream._zs.next_in = (Bytef *)data;
+            stream._zs.avail_in = len;
+            stream._zs.next_out = (Bytef *)&(*out)[0];
+            stream._zs.avail_out = out->size();
+            if (deflate(&stream._zs, Z_FINISH) != Z_STREAM_END) {
+                out->clear();
+                return false;
+            }
+            out->resize(stream._zs.total_out);
+            return true;
+        }
+        //同目录下有不比原文件旧的.gz文件，说明有预先压缩好的版本
+        static bool GzipSibling(const std::string &filename, const struct timespec &mtime) {
+            struct stat st;
+            if (stat((filename + ".gz").c_str(), &st) != 0 || S_ISREG(st.st_mode) == false) return false;
+            return st.st_mtime >= mtime.tv_sec;
+        }
+        //压缩后的内容是不同的表示，强验证器加上压缩格式后缀    "abc" -> "abc-gzip"
+        static std::string EncodedETag(const std::string &etag, HttpEncoding encoding) {
+            if (etag.empty() || encoding == ENCODING_IDENTITY) return etag;
+            return etag.substr(0, etag.size() - 1) + "-" + EncodingName(encoding) + "\"";
+        }
+        //HTTP日期格式  Sun, 06 Nov 1994 08:49:37 GMT
+        static std::string HttpDate(time_t t) {
+            struct tm tm;
+            gmtime_r(&t, &tm);
+            char buf[64];
+            strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            return buf;
+        }
+        //组织好的Date头部 "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+        //每个EventLoop线程缓存一份，秒数变化时才重新格式化，同一秒内的响应直接使用
+        static const std::string &DateHeader() {
+            static thread_local time_t last = -1;
+            static thread_local std::string header;
+            time_t now = time(NULL);
+            if (now != last) {
+                struct tm tm;
+                gmtime_r(&now, &tm);
+                char buf[64];
+                size_t len = strftime(buf, sizeof(buf), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+                header.assign(buf, len);
+                last = now;
+            }
+            return header;
+        }
+        //解析HTTP日期，格式不对返回-1
+        static time_t ParseHttpDate(const std::string &date) {
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            const char *end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            if (end == NULL || *end != '\0') {
+                return -1;
+            }
+            return timegm(&tm);
+        }
+        //根据文件的inode、大小、修改时间生成弱验证器，文件内容不变但被重新写入时也会改变
+        static std::string FileETag(uint64_t ino, uint64_t size, const struct timespec &mtime) {
+            char buf[80];
+            snprintf(buf, sizeof(buf), "%lx-%lx-%lx", (unsigned long)ino, (unsigned long)size,
+                     (unsigned long)(mtime.tv_sec * 1000000000ull + mtime.tv_nsec));
+            return buf;
+        }
+        //根据文件内容生成强验证器（FNV-1a哈希），只有内容变化时才会改变
+        static std::string ContentETag(const char *data, size_t len) {
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < len; i++) {
+                hash ^= (unsigned char)data[i];
+                hash *= 1099511628211ull;
+            }
+            char buf[40];
+            snprintf(buf, sizeof(buf), "%016lx-%lx", (unsigned long)hash, (unsigned long)len);
+            return buf;
+        }
+        //If-None-Match中是否有与etag匹配的值，使用弱比较：忽略W/前缀，只比较引号中的内容
+        //客户端缓存的是压缩版本时，带有压缩格式后缀，也认为匹配
+        static bool ETagMatch(const std::string &list, const std::string &etag) {
+            std::string_view target(etag);
+            if (target.compare(0, 2, "W/") == 0) target.remove_prefix(2);
+            size_t pos = 0;
+            while (pos < list.size()) {
+                size_t end = list.find(',', pos);
+                if (end == std::string::npos) end = list.size();
+                std::string_view item(list.data() + pos, end - pos);
+                while (item.empty() == false && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+                while (item.empty() == false && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+                if (item == "*") return true;
+                if (item.compare(0, 2, "W/") == 0) item.remove_prefix(2);
+                if (item.empty() == false && item == target) return true;
+                for (int encoding = ENCODING_GZIP; encoding < ENCODING_COUNT; encoding++) {
+                    std::string_view suffix = EncodingName((HttpEncoding)encoding);
+                    size_t len = target.size() - 1;//去掉结尾引号
+                    if (item.size() == target.size() + suffix.size() + 1 && item.compare(0, len, target, 0, len) == 0 &&
+                        item[len] == '-' && item.compare(len + 1, suffix.size(), suffix) == 0 && item.back() == '"') {
+                        return true;
+                    }
+                }
+                pos = end + 1;
+            }
+            return false;
+        }
         //http请求的资源路径有效性判断
         // /index.html  --- 前边的/叫做相对根目录  映射的是某个服务器上的子目录
         // 想表达的意思就是，客户端只能请求相对根目录中的资源，其他地方的资源都不予理会
@@ -324,6 +524,282 @@ class Util {
         }
 };
 
+/*静态文件缓存：每个线程一个，只在本线程中访问，不需要加锁
+    缓存文件的元数据、mime、提前组织好的响应头部，以及小文件的内容，按总字节数进行LRU淘汰
+    不存在的文件也会缓存（负缓存），避免每个功能性请求都去stat一次
+    通过inotify监控缓存文件所在的目录（以及从根目录到该目录的每一级），目录中有变化就让对应的缓存失效*/
+#define FILE_CACHE_MAX_BYTES (32 * 1024 * 1024) //每个线程缓存的总字节数
+#define FILE_CACHE_MAX_FILE (256 * 1024)        //超过这个大小的文件只缓存元数据，内容每次读取
+#define FILE_CACHE_ENTRY_OVERHEAD 256           //每个缓存项的节点、索引等额外开销，计入总字节数
+struct CachedFile {
+    std::string _path;      //实际的文件路径，也是缓存的键
+    bool _regular;          //是否是普通文件，不是则只表示这个路径不能作为静态资源
+    uint64_t _size;
+    uint64_t _ino;
+    struct timespec _mtime;
+    std::string _mime;
+    std::string _etag;      //缓存了内容的是内容哈希生成的强验证器，否则是元数据生成的弱验证器
+    std::string _headers;   //Content-Type 和 Content-Length 两个头部，已经按照协议格式组织好
+    std::string _validators;//ETag 和 Last-Modified 两个头部，304响应也要携带
+    Slice _body;            //文件内容，与所有连接的发送缓冲区共享；大文件不缓存内容
+    //gzip版本：同目录下的.gz文件，或者加载时压缩一次，之后不会重新压缩
+    Slice _gzip;
+    bool _gzip_file;        //大文件不缓存内容，只记录是否有.gz文件
+    std::string _gzip_headers;
+    std::string _gzip_validators;
+    bool HasBody() const { return _regular && (_body.Size() == _size); }
+    bool HasGzip() const { return _gzip.Empty() == false || _gzip_file; }
+};
+class FileCache {
+    public:
+        using PtrFile = std::shared_ptr<const CachedFile>;
+    private:
+        int _inotify_fd;
+        std::unique_ptr<Channel> _channel;
+        size_t _max_bytes;
+        size_t _max_file;
+        size_t _bytes;
+        std::list<PtrFile> _lru;                                            //最近使用的在前边
+        std::unordered_map<std::string, std::list<PtrFile>::iterator> _index;
+        std::unordered_map<std::string, int> _watch;                        //目录->监控描述符
+        std::unordered_map<int, std::vector<std::string>> _dirs;            //监控描述符->目录，同一个目录可能有多种写法
+        std::string _key;                                                   //查找时拼接路径用，避免每次分配
+        uint64_t _hits;
+        uint64_t _misses;
+        bool _compress;
+        int _level;
+        size_t _min_size;
+    private:
+        static size_t Charge(const CachedFile &file) {
+            size_t strings = file._path.size() * 2 + file._mime.size() + file._etag.size() + file._headers.size() +
+                             file._validators.size() + file._gzip_headers.size() + file._gzip_validators.size();
+            return strings + file._body.Size() + file._gzip.Size() + FILE_CACHE_ENTRY_OVERHEAD;
+        }
+        //监控一个目录，dir以/结尾
+        bool Watch(const std::string &dir) {
+            if (_watch.find(dir) != _watch.end()) return true;
+            if (_inotify_fd < 0) return false;
+            uint32_t mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+            int wd = inotify_add_watch(_inotify_fd, dir.c_str(), mask);
+            if (wd < 0) return false;
+            _watch[dir] = wd;
+            _dirs[wd].push_back(dir);
+            return true;
+        }
+        //文件所在目录以及从根目录到该目录的每一级都要监控，上级目录被改名或删除时，下边的缓存都要失效
+        bool WatchPath(const std::string &basedir, const std::string &path) {
+            for (size_t pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+                if (Watch(basedir + path.substr(0, pos + 1)) == false) return false;
+            }
+            return true;
+        }
+        void Invalidate(const std::string &path) {
+            auto it = _index.find(path);
+            if (it == _index.end()) return;
+            _bytes -= Charge(**it->second);
+            _lru.erase(it->second);
+            _index.erase(it);
+        }
+        void Insert(const PtrFile &file) {
+            size_t charge = Charge(*file);
+            if (charge > _max_bytes) return;
+            Invalidate(file->_path);
+            while (_bytes + charge > _max_bytes) {
+                Invalidate(_lru.back()->_path);
+            }
+            _lru.push_front(file);
+            _index[file->_path] = _lru.begin();
+            _bytes += charge;
+        }
+        PtrFile Load(const std::string &basedir, const std::string &path) {
+            std::shared_ptr<CachedFile> file = std::make_shared<CachedFile>();
+            file->_path = _key;
+            //先添加监控再读取文件，读取之后的任何修改都会收到通知
+            bool watched = WatchPath(basedir, path);
+            struct stat st;
+            file->_regular = (stat(file->_path.c_str(), &st) == 0 && S_ISREG(st.st_mode));
+            if (file->_regular) {
+                file->_size = st.st_size;
+                file->_ino = st.st_ino;
+                file->_mtime = st.st_mtim;
+                file->_mime = Util::ExtMime(file->_path);
+                file->_headers = "Content-Type: " + file->_mime + "\r\n";
+                file->_headers += "Content-Length: " + std::to_string(file->_size) + "\r\n";
+                file->_etag = "W/\"" + Util::FileETag(file->_ino, file->_size, file->_mtime) + "\"";
+                if (file->_size <= _max_file) {
+                    std::string body;
+                    if (Util::ReadFile(file->_path, &body) == false) return file;
+                    if (body.size() != file->_size) return file;//读取的同时文件被修改了，这次不缓存
+                    file->_etag = "\"" + Util::ContentETag(body.data(), body.size()) + "\"";
+                    file->_body = Slice(std::move(body));
+                }
+                file->_validators = "ETag: " + file->_etag + "\r\n";
+                file->_validators += "Last-Modified: " + Util::HttpDate(file->_mtime.tv_sec) + "\r\n";
+                if (_compress && Util::Compressible(file->_mime)) {
+                    file->_headers += "Vary: Accept-Encoding\r\n";
+                    LoadGzip(file.get());
+                }
+            }
+            if (watched) Insert(file);
+            return file;
+        }
+        //准备gzip版本：优先使用同目录下不比原文件旧的.gz文件，否则压缩一次
+        void LoadGzip(CachedFile *file) {
+            bool sibling = Util::GzipSibling(file->_path, file->_mtime);
+            std::string gzip;
+            if (file->HasBody() == false) {
+                if (sibling == false) return;
+                file->_gzip_file = true;
+            }else if (sibling) {
+                if (Util::ReadFile(file->_path + ".gz", &gzip) == false) return;
+            }else {
+                if (file->_size < _min_size) return;
+                if (Util::Compress(file->_body.Data(), file->_size, ENCODING_GZIP, _level, &gzip) == false) return;
+                if (gzip.size() >= file->_size) return;//压缩后没有变小
+            }
+            if (file->_gzip_file == false) {
+                file->_gzip_headers = "Content-Type: " + file->_mime + "\r\n";
+                file->_gzip_headers += "Content-Encoding: gzip\r\n";
+                file->_gzip_headers += "Content-Length: " + std::to_string(gzip.size()) + "\r\n";
+                file->_gzip_headers += "Vary: Accept-Encoding\r\n";
+                file->_gzip = Slice(std::move(gzip));
+            }
+            file->_gzip_validators = "ETag: " + Util::EncodedETag(file->_etag, ENCODING_GZIP) + "\r\n";
+            file->_gzip_validators += "Last-Modified: " + Util::HttpDate(file->_mtime.tv_sec) + "\r\n";
+        }
+        void HandleEvents() {
+            alignas(struct inotify_event) char buf[4096];
+            while (true) {
+                ssize_t ret = read(_inotify_fd, buf, sizeof(buf));
+                if (ret <= 0) return;
+                for (char *ptr = buf; ptr < buf + ret; ) {
+                    struct inotify_event *ev = (struct inotify_event *)ptr;
+                    ptr += sizeof(struct inotify_event) + ev->len;
+                    if (ev->mask & IN_Q_OVERFLOW) {
+                        Clear();//事件丢失了，不知道哪些文件有变化
+                        continue;
+                    }
+                    if (ev->mask & IN_IGNORED) {
+                        //监控的目录已经不存在了，下次用到时重新添加
+                        auto it = _dirs.find(ev->wd);
+                        if (it == _dirs.end()) continue;
+                        for (auto &dir : it->second) _watch.erase(dir);
+                        _dirs.erase(it);
+                        Clear();
+                        continue;
+                    }
+                    //目录本身或者其中的子目录被改名、删除，下边的缓存都可能失效
+                    if ((ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) ||
+                        ((ev->mask & IN_ISDIR) && (ev->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE)))) {
+                        Clear();
+                        continue;
+                    }
+                    auto it = _dirs.find(ev->wd);
+                    if (it == _dirs.end() || ev->len == 0) continue;
+                    std::string name = ev->name;
+                    for (auto &dir : it->second) {
+                        Invalidate(dir + name);
+                        //.gz文件变化时，原文件的gzip版本也要更新
+                        if (name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0) {
+                            Invalidate(dir + name.substr(0, name.size() - 3));
+                        }
+                    }
+                }
+            }
+        }
+    public:
+        FileCache(EventLoop *loop, size_t max_bytes = FILE_CACHE_MAX_BYTES, size_t max_file = FILE_CACHE_MAX_FILE):
+            _inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), _max_bytes(max_bytes), _max_file(max_file),
+            _bytes(0), _hits(0), _misses(0), _compress(false), _level(COMPRESS_DEFAULT_LEVEL), _min_size(COMPRESS_MIN_SIZE) {
+            if (_inotify_fd < 0) {
+                //没有inotify就无法得知文件的变化，不进行缓存
+                ERR_LOG("INOTIFY INIT FAILED, FILE CACHE DISABLED!");
+                return;
+            }
+            _channel.reset(new Channel(loop, _inotify_fd));
+            _channel->SetReadCallback(std::bind(&FileCache::HandleEvents, this));
+            _channel->EnableRead();
+        }
+        ~FileCache() {
+            //只在线程退出时析构，事件循环已经不再运行，关闭描述符时内核会自动移除epoll监控
+            if (_inotify_fd >= 0) close(_inotify_fd);
+        }
+        //查找 basedir + path 对应的文件，path以/结尾时对应目录中的index.html
+        //不合法的路径返回空；命中时不需要任何系统调用
+        PtrFile Get(const std::string &basedir, const std::string &path) {
+            _key = basedir;
+            _key += path;
+            if (path.back() == '/') _key += "index.html";
+            auto it = _index.find(_key);
+            if (it != _index.end()) {
+                _hits++;
+                _lru.splice(_lru.begin(), _lru, it->second);
+                return *it->second;
+            }
+            _misses++;
+            //只有合法的路径才会放入缓存，因此命中时不需要再检查
+            if (Util::ValidPath(path) == false) return PtrFile();
+            return Load(basedir, path);
+        }
+        void Clear() {
+            _lru.clear();
+            _index.clear();
+            _bytes = 0;
+        }
+        //可压缩的文件同时缓存gzip版本
+        void EnableCompression(bool enable, int level, size_t min_size) {
+            _compress = enable;
+            _level = level;
+            _min_size = min_size;
+            Clear();
+        }
+        size_t Bytes() const { return _bytes; }
+        size_t Count() const { return _index.size(); }
+        uint64_t Hits() const { return _hits; }
+        uint64_t Misses() const { return _misses; }
+};
+
+/*请求正文接收器：路由为请求设置接收器后，正文不再累积到_body中，而是随着数据的到达以片段的形式依次交给Write，
+    全部到达之后调用Finish，然后才调用处理函数；接收器处理不过来时在Write中调用Pause，连接停止读取，
+    数据留在socket接收缓冲区中，由TCP流控限制客户端的发送，调用Resume后继续接收
+    这样上传占用的内存只有socket缓冲区和一次读取的数据量，与正文的大小无关
+    没有调用Finish就被释放，说明正文没有接收完整（出错或者连接关闭）*/
+class HttpBodySink {
+    private:
+        int _statu;                     //出错时回复的状态码
+        bool _paused;                   //只在连接所属线程中修改
+        std::function<void()> _resume;  //由服务器设置：回到连接所属线程取消暂停，继续接收
+    protected:
+        bool Fail(int statu) {
+            _statu = statu;
+            return false;
+        }
+    public:
+        HttpBodySink():_statu(500), _paused(false) {}
+        virtual ~HttpBodySink() {}
+        //正文片段到达，在连接所属线程中调用，返回false表示出错，不再接收后续的正文，回复Statu()并关闭连接
+        virtual bool Write(const char *data, size_t len) = 0;
+        //正文全部到达，返回false表示出错
+        virtual bool Finish() { return true; }
+        //零拷贝接收：返回正文要写入的文件描述符，服务器用splice把socket中剩余的正文经过管道直接移动过去，不经过用户态
+        //返回-1表示通过Write接收；已经在输入缓冲区中的数据和chunked编码的正文总是通过Write
+        virtual int SpliceFd() { return -1; }
+        //通过splice写入了len字节，返回false表示出错
+        virtual bool Spliced(size_t /*len*/) { return true; }
+        int Statu() { return _statu; }
+        //在Write中调用：当前片段处理完后暂停接收
+        void Pause() { _paused = true; }
+        //继续接收，可以在任意线程中调用，包括在Write中调用
+        void Resume() {
+            if (_resume) _resume();
+        }
+        bool Paused() { return _paused; }
+        /*以下接口由服务器使用*/
+        void SetResume(const std::function<void()> &resume) { _resume = resume; }
+        void Unpause() { _paused = false; }
+};
+
 class HttpRequest {
     public:
         std::string _method;      //请求方法
@@ -331,8 +807,11 @@ class HttpRequest {
         std::string _version;     //协议版本
         std::string _body;        //请求正文
         std::smatch _matches;     //资源路径的正则提取数据
+        //路由提取的路径参数 参数名->参数值，值指向_path内部，正则路由的参数名为空
+        std::vector<std::pair<std::string_view, std::string_view>> _captures;
         std::unordered_map<std::string, std::string> _headers;  //头部字段
         std::unordered_map<std::string, std::string> _params;   //查询字符串
+        std::shared_ptr<HttpBodySink> _sink;    //正文接收器，设置之后正文不放到_body中
     public:
         HttpRequest():_version("HTTP/1.1") {}
         void ReSet() {
@@ -342,9 +821,12 @@ class HttpRequest {
             _body.clear();
             std::smatch match;
             _matches.swap(match);
+            _captures.clear();
             _headers.clear();
             _params.clear();
+            _sink.reset();
         }
+        void SetBodySink(const std::shared_ptr<HttpBodySink> &sink) { _sink = sink; }
         //插入头部字段
         void SetHeader(const std::string &key, const std::string &val) {
             _headers.insert(std::make_pair(key, val));
@@ -385,15 +867,61 @@ class HttpRequest {
             }
             return it->second;
         }
-        //获取正文长度
+        //判断是否有某个指定的路径参数
+        bool HasCapture(std::string_view name) const {
+            for (auto &cap : _captures) {
+                if (cap.first == name) return true;
+            }
+            return false;
+        }
+        //获取指定的路径参数
+        std::string_view GetCapture(std::string_view name) const {
+            for (auto &cap : _captures) {
+                if (cap.first == name) return cap.second;
+            }
+            return std::string_view();
+        }
+        //条件请求：客户端缓存的版本与etag/mtime描述的版本相同，可以回复304
+        //有If-None-Match时只比较ETag，忽略If-Modified-Since；只对GET/HEAD请求生效
+        bool NotModified(const std::string &etag, time_t mtime) const {
+            if (_method != "GET" && _method != "HEAD") {
+                return false;
+            }
+            auto it = _headers.find("If-None-Match");
+            if (it != _headers.end()) {
+                return etag.empty() == false && Util::ETagMatch(it->second, etag);
+            }
+            it = _headers.find("If-Modified-Since");
+            if (it != _headers.end() && mtime > 0) {
+                time_t since = Util::ParseHttpDate(it->second);
+                return since >= 0 && mtime <= since;
+            }
+            return false;
+        }
+        //获取正文长度，接收头部时已经检查过是不超过长度限制的十进制数字
         size_t ContentLength() const {
             // Content-Length: 1234\r\n
-            bool ret = HasHeader("Content-Length");
-            if (ret == false) {
+            auto it = _headers.find("Content-Length");
+            if (it == _headers.end()) {
                 return 0;
             }
-            std::string clen = GetHeader("Content-Length");
-            return std::stol(clen);
+            size_t len = 0;
+            std::from_chars(it->second.data(), it->second.data() + it->second.size(), len);
+            return len;
+        }
+        //正文是否使用chunked编码传输：Transfer-Encoding的最后一个编码是chunked
+        bool Chunked() const {
+            auto it = _headers.find("Transfer-Encoding");
+            if (it == _headers.end()) {
+                return false;
+            }
+            std::string coding = it->second;
+            size_t pos = coding.find_last_of(',');
+            coding = coding.substr(pos == std::string::npos ? 0 : pos + 1);
+            coding.erase(0, coding.find_first_not_of(" \t"));
+            coding.erase(coding.find_last_not_of(" \t") + 1);
+            std::transform(coding.begin(), coding.end(), coding.begin(), ::tolower);
+            return coding == "chunked";
         }
         //判断是否是短链接
         bool Close() const {
@@ -405,42 +933,301 @@ class HttpRequest {
         }
 };
 
+//内置的文件接收器：正文写入同目录下的临时文件，接收完整后再改名为目标文件，上传过程中原文件不受影响
+//max_size限制正文的长度（0表示不限制），超过回复413；zero_copy为true时Content-Length的正文通过splice写入
+class FileSink : public HttpBodySink {
+    private:
+        std::string _path;
+        std::string _tmp;
+        int _fd;
+        size_t _size;
+        size_t _max_size;
+        bool _zero_copy;
+    public:
+        FileSink(const std::string &path, size_t max_size = 0, bool zero_copy = false):
+            _path(path), _fd(-1), _size(0), _max_size(max_size), _zero_copy(zero_copy) {
+            std::vector<char> tmpl(path.begin(), path.end());
+            const char suffix[] = ".upload.XXXXXX";
+            tmpl.insert(tmpl.end(), suffix, suffix + sizeof(suffix));
+            _fd = mkstemp(&tmpl[0]);
+            if (_fd < 0) {
+                ERR_LOG("CREATE UPLOAD FILE FOR %s FAILED: %s", path.c_str(), strerror(errno));
+                return;
+            }
+            fchmod(_fd, 0644);
+            _tmp = &tmpl[0];
+        }
+        ~FileSink() {
+            if (_fd < 0) return;
+            close(_fd);
+            unlink(_tmp.c_str());//没有接收完整，丢弃
+        }
+        //作为路由的接收器打开函数使用：根据Content-Length提前拒绝过大的正文，创建不了文件回复500
+        static int Open(HttpRequest &req, const std::string &path, size_t max_size = 0, bool zero_copy = false) {
+            if (max_size > 0 && req.Chunked() == false && req.ContentLength() > max_size) {
+                return 413;
+            }
+            std::shared_ptr<FileSink> sink = std::make_shared<FileSink>(path, max_size, zero_copy);
+            if (sink->_fd < 0) {
+                return 500;
+            }
+            req.SetBodySink(sink);
+            return 0;
+        }
+        bool Write(const char *data, size_t len) override {
+            if (_max_size > 0 && _size + len > _max_size) {
+                return Fail(413);
+            }
+            while (len > 0) {
+                ssize_t ret = write(_fd, data, len);
+                if (ret < 0) {
+                    if (errno == EINTR) continue;
+                    ERR_LOG("WRITE UPLOAD FILE %s FAILED: %s", _tmp.c_str(), strerror(errno));
+                    return Fail(500);
+                }
+                data += ret;
+                len -= ret;
+                _size += ret;
+            }
+            return true;
+        }
+        int SpliceFd() override { return _zero_copy ? _fd : -1; }
+        bool Spliced(size_t len) override {
+            _size += len;
+            if (_max_size > 0 && _size > _max_size) {
+                return Fail(413);
+            }
+            return true;
+        }
+        bool Finish() override {
+            int fd = _fd;
+            _fd = -1;
+            if (close(fd) != 0 || rename(_tmp.c_str(), _path.c_str()) != 0) {
+                ERR_LOG("SAVE UPLOAD FILE %s FAILED: %s", _path.c_str(), strerror(errno));
+                unlink(_tmp.c_str());
+                return Fail(500);
+            }
+            return true;
+        }
+        const std::string &Path() { return _path; }
+        size_t Size() { return _size; }
+};
+
+/*流式响应：处理函数打开流之后，可以在任意线程中分多次写入正文，写完调用Close结束响应
+    每次写入的数据直接放入连接的发送缓冲区，不在内存中拼出完整的正文；HTTP/1.1使用chunked编码，
+    处理函数设置了Content-Length则原样发送，HTTP/1.0客户端原样发送后关闭连接
+    服务器在处理函数返回后才发送状态行和头部，在这之前写入的数据先暂存起来；流结束之前不处理这个连接上的后续请求
+    Write返回false表示待发送数据超过了高水位线（或者连接已经关闭），生产者应当停止写入，
+    通过OnWritable等待发送缓冲区降到低水位线以下再继续，这样无论正文多大，占用的内存都是有限的*/
+class HttpStream {
+    private:
+        PtrConnection _conn;
+        std::mutex _mutex;
+        bool _started;          //状态行和头部是否已经发送
+        bool _closed;           //生产者是否已经调用Close
+        bool _chunked;          //是否使用chunked编码
+        bool _discard;          //HEAD请求只发送头部，丢弃写入的正文
+        std::string _pending;   //头部发送之前写入的数据
+        std::function<void()> _finish;  //流结束后由服务器继续处理连接上的后续请求
+    private:
+        void Frame(std::string *out, const char *data, size_t len) {
+            if (_chunked) {
+                char line[32];
+                int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+                out->append(line, n);
+            }
+            out->append(data, len);
+            if (_chunked) out->append("\r\n", 2);
+        }
+        void Finish() {
+            if (_chunked && _discard == false) _conn->Send("0\r\n\r\n", 5);
+            //总是放到任务中执行：服务器在处理请求的过程中启动流时，不能在这时处理后续的请求
+            _conn->GetLoop()->QueueInLoop(std::move(_finish));
+        }
+    public:
+        HttpStream(const PtrConnection &conn):_conn(conn), _started(false), _closed(false), _chunked(false), _discard(false) {}
+        //生产者没有调用Close就释放了流，响应不完整，只能关闭连接
+        ~HttpStream() {
+            if (_started && _closed == false) _conn->Shutdown();
+        }
+        //写入一段正文，可以在任意线程中调用；返回是否还可以继续写入
+        bool Write(const char *data, size_t len) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_closed) return false;
+                if (len == 0 || _discard) return Writable();//长度为0的块表示结束，不能发送
+                if (_started == false) {
+                    //头部发送之前不知道编码方式，先原样暂存，开始时再组织
+                    _pending.append((char *)&len, sizeof(len));
+                    _pending.append(data, len);
+                    return true;
+                }
+                //持有锁把同一个块一次放入连接：多个线程同时写入时块不会交错，
+                //Close设置_closed之后也不会再有写入中的块，结束块总是在所有已接受的块之后
+                static thread_local std::string frame;
+                frame.clear();
+                Frame(&frame, data, len);
+                _conn->Send(frame.data(), frame.size());
+            }
+            return Writable();
+        }
+        bool Write(const std::string &data) { return Write(data.data(), data.size()); }
+        //待发送数据没有超过高水位线，并且连接还在
+        bool Writable() {
+            return _conn->Connected() && _conn->OutboundBytes() < _conn->HighWaterMark();
+        }
+        //连接是否已经关闭，关闭之后写入的数据都被丢弃，生产者应当结束
+        bool Aborted() { return _conn->Connected() == false; }
+        //发送缓冲区降到低水位线以下时在连接所属线程中调用一次cb，连接关闭时也会调用（可以通过Aborted判断）
+        void OnWritable(const std::function<void()> &cb) { _conn->WhenDrained(cb); }
+        //正文写完，结束响应，可以在任意线程中调用
+        void Close() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_closed) return;
+                _closed = true;
+                if (_started == false) return;//头部发送时再结束
+            }
+            Finish();
+        }
+        //由服务器在连接所属线程中，发送完状态行和头部之后调用
+        void Start(bool chunked, bool discard, const std::function<void()> &finish) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _chunked = chunked;
+            _discard = discard;
+            _finish = finish;
+            std::string out;
+            for (size_t pos = 0; pos < _pending.size();) {
+                size_t len;
+                memcpy(&len, &_pending[pos], sizeof(len));
+                pos += sizeof(len);
+                if (discard == false) Frame(&out, &_pending[pos], len);
+                pos += len;
+            }
+            std::string().swap(_pending);
+            if (out.empty() == false) _conn->Send(out.data(), out.size());
+            _started = true;
+            if (_closed) {
+                lock.unlock();
+                Finish();
+            }
+        }
+};
+
 class HttpResponse {
     public:
         int _statu;
         bool _redirect_flag;
         std::string _body;
         std::string _redirect_url;
-        std::unordered_map<std::string, std::string> _headers;
+        //头部字段按设置的顺序保存和发送；字段很少，顺序查找比哈希表快，也不需要为每个字段单独分配节点
+        std::vector<std::pair<std::string, std::string>> _headers;
+        FileCache::PtrFile _file;   //缓存命中的静态文件，头部和内容都直接使用缓存中的数据
+        std::string _etag;          //验证器，带引号，弱验证器有W/前缀
+        time_t _last_modified;
+        HttpEncoding _encoding;     //正文的压缩格式
+        PtrConnection _conn;        //处理函数打开流式响应时使用
+        std::shared_ptr<HttpStream> _stream;
     public:
-        HttpResponse():_redirect_flag(false), _statu(200) {}
-        HttpResponse(int statu):_redirect_flag(false), _statu(statu) {} 
+        HttpResponse():_redirect_flag(false), _statu(200), _last_modified(0), _encoding(ENCODING_IDENTITY) {}
+        HttpResponse(int statu):_redirect_flag(false), _statu(statu), _last_modified(0), _encoding(ENCODING_IDENTITY) {} 
         void ReSet() {
             _statu = 200;
             _redirect_flag = false;
             _body.clear();
             _redirect_url.clear();
             _headers.clear();
+            _file.reset();
+            _etag.clear();
+            _last_modified = 0;
+            _encoding = ENCODING_IDENTITY;
+            _conn.reset();
+            _stream.reset();
         }
-        //插入头部字段
-        void SetHeader(const std::string &key, const std::string &val) {
-            _headers.insert(std::make_pair(key, val));
+        //打开流式响应，在这之前设置好状态码和头部；返回的流可以保存起来，在其他线程中继续写入
+        std::shared_ptr<HttpStream> OpenStream() {
+            if (_stream == nullptr && _conn != nullptr) {
+                _stream = std::make_shared<HttpStream>(_conn);
+            }
+            return _stream;
         }
-        //判断是否存在指定头部字段
-        bool HasHeader(const std::string &key) {
-            auto it = _headers.find(key);
-            if (it == _headers.end()) {
+        bool Streaming() const { return _stream != nullptr; }
+        //设置验证器，etag不带引号；请求中的条件与之匹配时会回复304，不发送正文
+        void SetETag(const std::string &etag, bool weak = false) {
+            _etag = (weak ? "W/\"" : "\"") + etag + "\"";
+            ReplaceHeader("ETag", _etag);
+        }
+        void SetLastModified(time_t mtime) {
+            _last_modified = mtime;
+            ReplaceHeader("Last-Modified", Util::HttpDate(mtime));
+        }
+        //正文已经是压缩后的数据，设置Content-Encoding，验证器加上压缩格式后缀
+        void SetEncoding(HttpEncoding encoding) {
+            _encoding = encoding;
+            ReplaceHeader("Content-Encoding", Util::EncodingName(encoding));
+            ReplaceHeader("Vary", "Accept-Encoding");
+            std::string *etag = FindHeader("ETag");
+            if (etag != nullptr) *etag = Util::EncodedETag(*etag, encoding);
+        }
+        //先设置验证器，再调用这个接口判断客户端缓存是否还有效，有效则设置为304，处理函数不需要再生成正文
+        //处理函数没有调用时，服务器在处理函数返回后也会进行判断
+        bool NotModified(const HttpRequest &req) {
+            if (_statu != 200 || _stream != nullptr || (_etag.empty() && _last_modified == 0)) {
+                return false;
+            }
+            if (req.NotModified(_etag, _last_modified) == false) {
                 return false;
             }
+            _statu = 304;
+            _body.clear();
+            EraseHeader("Content-Type");
+            EraseHeader("Content-Length");
             return true;
         }
+        //获取指定头部字段的值，不存在返回nullptr
+        std::string *FindHeader(const std::string &key) {
+            for (auto &head : _headers) {
+                if (head.first == key) return &head.second;
+            }
+            return nullptr;
+        }
+        //插入头部字段，已经存在则保持原来的值
+        void SetHeader(const std::string &key, const std::string &val) {
+            if (FindHeader(key) != nullptr) {
+                return;
+            }
+            if (_headers.capacity() == 0) {
+                _headers.reserve(RESPONSE_HEADERS_RESERVE);
+            }
+            _headers.emplace_back(key, val);
+        }
+        //设置头部字段，已经存在则覆盖原来的值
+        void ReplaceHeader(const std::string &key, const std::string &val) {
+            std::string *old = FindHeader(key);
+            if (old == nullptr) {
+                return SetHeader(key, val);
+            }
+            *old = val;
+        }
+        void EraseHeader(const std::string &key) {
+            for (auto it = _headers.begin(); it != _headers.end(); ++it) {
+                if (it->first == key) {
+                    _headers.erase(it);
+                    return;
+                }
+            }
+        }
+        //判断是否存在指定头部字段
+        bool HasHeader(const std::string &key) {
+            return FindHeader(key) != nullptr;
+        }
         //获取指定头部字段的值
         std::string GetHeader(const std::string &key) {
-            auto it = _headers.find(key);
-            if (it == _headers.end()) {
+            std::string *val = FindHeader(key);
+            if (val == nullptr) {
                 return "";
             }
-            return it->second;
+            return *val;
         }
         void SetContent(const std::string &body,  const std::string &type = "text/html") {
             _body = body;
@@ -454,11 +1241,80 @@ class HttpResponse {
         //判断是否是短链接
         bool Close() {
             // 没有Connection字段，或者有Connection但是值是close，则都是短链接，否则就是长连接
-            if (HasHeader("Connection") == true && GetHeader("Connection") == "keep-alive") {
+            std::string *conn = FindHeader("Connection");
+            if (conn != nullptr && *conn == "keep-alive") {
                 return false;
             }
             return true;
         }
+        //按照http协议格式把响应直接组织到发送缓冲区中，不经过stringstream和临时字符串
+        //状态行和Date头部使用预先组织好的数据；Content-Length等补充的头部直接写入，不插入_headers
+        //正文较大时转为共享片段（转移_body，不拷贝），和头部作为两段数据一起发送
+        //缓存命中的静态文件，头部和内容都直接使用缓存中的数据
+        void Serialize(const std::string &version, OutBuffer *out) {
+            const CachedFile *file = _file.get();
+            bool cached = (file != nullptr && file->HasBody() && _statu == 200);
+            bool gzip = (_encoding == ENCODING_GZIP);
+            bool has_body = (cached == false && _body.empty() == false);
+            bool copy_body = (has_body && _body.size() < RESPONSE_SLICE_MIN_SIZE);
+            const std::string &statu_line = Util::StatuLine(_statu);
+            const std::string &date = Util::DateHeader();
+            //1. 预先计算头部的大小，一次准备好空间
+            size_t size = version.size() + statu_line.size() + date.size() + 2;
+            for (auto &head : _headers) {
+                size += head.first.size() + head.second.size() + 4;
+            }
+            if (has_body) size += 64 + 48;//Content-Length和Content-Type
+            if (_redirect_flag) size += _redirect_url.size() + 12;
+            if (file != nullptr) size += (gzip ? file->_gzip_validators : file->_validators).size();
+            if (cached) size += (gzip ? file->_gzip_headers : file->_headers).size();
+            if (copy_body) size += _body.size();
+            out->EnsureWriteSpace(size);
+            //2. 状态行和头部
+            WriteString(out, version);
+            WriteString(out, statu_line);
+            WriteString(out, date);
+            for (auto &head : _headers) {
+                WriteHeader(out, head.first, head.second.data(), head.second.size());
+            }
+            if (has_body && FindHeader("Content-Length") == nullptr) {
+                char num[24];
+                char *end = std::to_chars(num, num + sizeof(num), _body.size()).ptr;
+                WriteHeader(out, "Content-Length", num, end - num);
+            }
+            if (has_body && FindHeader("Content-Type") == nullptr) {
+                WriteHeader(out, "Content-Type", "application/octet-stream", 24);
+            }
+            if (_redirect_flag == true && FindHeader("Location") == nullptr) {
+                WriteHeader(out, "Location", _redirect_url.data(), _redirect_url.size());
+            }
+            if (file != nullptr) {
+                WriteString(out, gzip ? file->_gzip_validators : file->_validators);
+            }
+            if (cached) {
+                WriteString(out, gzip ? file->_gzip_headers : file->_headers);
+            }
+            out->WriteAndPush("\r\n", 2);
+            //3. 正文：小的正文拷贝到头部之后，大的正文和缓存的文件内容以共享片段的方式引用
+            if (copy_body) {
+                WriteString(out, _body);
+            }else if (has_body) {
+                out->WriteSlice(Slice(std::move(_body)));
+                _body.clear();
+            }else if (cached) {
+                out->WriteSlice(gzip ? file->_gzip : file->_body);
+            }
+        }
+    private:
+        static void WriteString(OutBuffer *out, const std::string &str) {
+            out->WriteAndPush(str.data(), str.size());
+        }
+        static void WriteHeader(OutBuffer *out, const std::string &key, const char *val, size_t len) {
+            out->WriteAndPush(key.data(), key.size());
+            out->WriteAndPush(": ", 2);
+            out->WriteAndPush(val, len);
+            out->WriteAndPush("\r\n", 2);
+        }
 };
 
 typedef enum {
@@ -470,184 +1326,779 @@ typedef enum {
 }HttpRecvStatu;
 
 #define MAX_LINE 8192
+#define MAX_CHUNK_SIZE_DIGITS 15    //块大小最多15个十六进制数字，避免溢出
+#define MAX_CONTENT_LENGTH_DIGITS 18 //Content-Length最多18个十进制数字，避免溢出
+typedef enum {
+    CHUNK_SIZE,     //块大小行：十六进制长度[;扩展]\r\n
+    CHUNK_DATA,     //块数据
+    CHUNK_DATA_END, //块数据之后的\r\n
+    CHUNK_TRAILER   //最后一个块之后的尾部字段，直到空行
+}HttpChunkStatu;
+#define MAX_HEAD_SIZE (64 * 1024)   //请求行加上所有头部的最大长度
+#define MAX_HEADERS 100             //头部字段的最大数量
+typedef enum { PARSE_AGAIN, PARSE_DONE, PARSE_ERROR }HttpParseStatu;
+/*请求头部的字符扫描：查找第一个不属于token的字节（方法、头部字段名），或者第一个不允许出现在字段值中的字节*/
+/*x86上运行时根据CPU选择AVX2（每次32字节）或SSE4.2（每次16字节）实现，其他平台以及不足一个向量的尾部使用逐字节实现*/
+class HttpScanner {
+    public:
+        using ScanFunc = size_t (*)(const char *data, size_t len);
+        struct Impl {
+            const char *_name;
+            ScanFunc _token;  //返回第一个非token字节的位置，全部是token字节返回len
+            ScanFunc _value;  //返回第一个控制字符（水平制表符除外，包括\r\n）或DEL的位置，没有返回len
+        };
+    private:
+        //RFC 7230中的token字符：方法和头部字段名只能由这些字符组成
+        struct TokenTable {
+            bool _token[256] = {};
+            unsigned char _low[16] = {};//按低4位索引，第i位表示高4位为i的字节是token字符（只有ASCII可能是token）
+            constexpr TokenTable() {
+                for (int c = '0'; c <= '9'; c++) _token[c] = true;
+                for (int c = 'a'; c <= 'z'; c++) _token[c] = true;
+                for (int c = 'A'; c <= 'Z'; c++) _token[c] = true;
+                for (const char *p = "!#$%&'*+-.^_`|~"; *p; p++) _token[(unsigned char)*p] = true;
+                for (int c = 0; c < 128; c++) {
+                    if (_token[c]) _low[c & 0x0f] |= (unsigned char)(1 << (c >> 4));
+                }
+            }
+        };
+        static const TokenTable &Table() {
+            static constexpr TokenTable table;
+            return table;
+        }
+        static bool InvalidValue(unsigned char c) { return (c < 0x20 && c != '\t') || c == 0x7f; }
+#if defined(__x86_64__) || defined(__i386__)
+        __attribute__((target("sse4.2")))
+        static size_t TokenSse42(const char *data, size_t len) {
+            //低4位查表得到允许的高4位集合，高4位查表得到自己对应的位，两者相与为0就不是token字符
+            const __m128i low_table = _mm_loadu_si128((const __m128i *)Table()._low);
+            const __m128i high_table = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+            const __m128i nibble = _mm_set1_epi8(0x0f);
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+                __m128i low = _mm_shuffle_epi8(low_table, _mm_and_si128(v, nibble));
+                __m128i high = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+                __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128());
+                int mask = _mm_movemask_epi8(bad);
+                if (mask != 0) return i + __builtin_ctz(mask);
+            }
+            return i + TokenScalar(data + i, len - i);
+        }
+        __attribute__((target("sse4.2")))
+        static size_t ValueSse42(const char *data, size_t len) {
+            //字符串比较指令的范围模式：0x00-0x08，0x0a-0x1f，0x7f
+            const __m128i ranges = _mm_setr_epi8(0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+                int idx = _mm_cmpestri(ranges, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+                if (idx != 16) return i + idx;
+            }
+            return i + ValueScalar(data + i, len - i);
+        }
+        __attribute__((target("avx2")))
+        static size_t TokenAvx2(const char *data, size_t len) {
+            //shuffle在每个128位通道内独立查表，两个通道放同样的表
+            const __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)Table()._low));
+            const __m256i high_table = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                        1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+            const __m256i nibble = _mm256_set1_epi8(0x0f);
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+                __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(v, nibble));
+                __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+                __m256i bad = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+                uint32_t mask = _mm256_movemask_epi8(bad);
+                if (mask != 0) return i + __builtin_ctz(mask);
+            }
+            return i + TokenSse42(data + i, len - i);
+        }
+        __attribute__((target("avx2")))
+        static size_t ValueAvx2(const char *data, size_t len) {
+            const __m256i ctl = _mm256_set1_epi8(0x1f);
+            const __m256i tab = _mm256_set1_epi8('\t');
+            const __m256i del = _mm256_set1_epi8(0x7f);
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+                //无符号比较c <= 0x1f：min(c, 0x1f) == c
+                __m256i is_ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+                __m256i bad = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), is_ctl),
+                                              _mm256_cmpeq_epi8(v, del));
+                uint32_t mask = _mm256_movemask_epi8(bad);
+                if (mask != 0) return i + __builtin_ctz(mask);
+            }
+            return i + ValueSse42(data + i, len - i);
+        }
+#endif
+        static Impl Detect() {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return Impl{"avx2", TokenAvx2, ValueAvx2};
+            if (__builtin_cpu_supports("sse4.2")) return Impl{"sse4.2", TokenSse42, ValueSse42};
+#endif
+            return Impl{"scalar", TokenScalar, ValueScalar};
+        }
+        static inline Impl _impl = Detect();//程序启动时检测一次
+    public:
+        static bool IsToken(unsigned char c) { return Table()._token[c]; }
+        static size_t TokenScalar(const char *data, size_t len) {
+            for (size_t i = 0; i < len; i++) {
+                if (IsToken(data[i]) == false) return i;
+            }
+            return len;
+        }
+        static size_t ValueScalar(const char *data, size_t len) {
+            for (size_t i = 0; i < len; i++) {
+                if (InvalidValue(data[i])) return i;
+            }
+            return len;
+        }
+        //当前CPU上可用的所有实现，第一个是逐字节实现，最后一个是实际使用的实现
+        static std::vector<Impl> Impls() {
+            std::vector<Impl> impls;
+            impls.push_back(Impl{"scalar", TokenScalar, ValueScalar});
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse4.2")) impls.push_back(Impl{"sse4.2", TokenSse42, ValueSse42});
+            if (__builtin_cpu_supports("avx2")) impls.push_back(Impl{"avx2", TokenAvx2, ValueAvx2});
+#endif
+            return impls;
+        }
+        static const char *Name() { return _impl._name; }
+        //指定使用的实现，只用于测试和性能对比，必须在开始解析之前调用
+        static void Select(const Impl &impl) { _impl = impl; }
+        static size_t ScanToken(const char *data, size_t len) { return _impl._token(data, len); }
+        static size_t ScanValue(const char *data, size_t len) { return _impl._value(data, len); }
+};
+
+/*增量解析请求行和头部的状态机：直接在缓冲区的字节上解析，不使用正则，不拷贝数据*/
+/*头部没有收全之前不从缓冲区中取走数据，解析结果只记录相对于读位置的偏移，缓冲区搬移数据或扩容后仍然有效*/
+/*新数据到来时从上次停下的位置继续解析，已经扫描过的字节不会重复扫描*/
+class HttpParser {
+    public:
+        struct Field { uint32_t _off; uint32_t _len; };
+        struct Header { Field _name; Field _value; };
+    private:
+        enum State { S_METHOD, S_TARGET, S_VERSION, S_LINE_LF, S_NAME_START, S_NAME, S_VALUE_START, S_VALUE, S_END_LF, S_DONE };
+        State _state;
+        size_t _pos;                    //下一个要扫描的字节的偏移
+        size_t _line;                   //当前行的起始偏移
+        size_t _mark;                   //当前正在解析的元素的起始偏移
+        int _error;                     //出错时对应的响应状态码
+        Field _method;
+        Field _target;                  //请求行中的资源路径，包含查询字符串
+        Field _version;
+        Field _name;                    //正在解析的头部字段名
+        std::vector<Header> _headers;   //请求之间复用，不会反复分配
+    private:
+        HttpParseStatu Fail(int statu) {
+            _error = statu;
+            return PARSE_ERROR;
+        }
+        //数据不足，检查已经扫描的部分是否超过了长度限制
+        HttpParseStatu Again() {
+            if (_pos - _line > MAX_LINE) return Fail(LineDone() ? 431 : 414);
+            if (_pos > MAX_HEAD_SIZE) return Fail(431);
+            return PARSE_AGAIN;
+        }
+        static Field MakeField(size_t begin, size_t end) { return Field{(uint32_t)begin, (uint32_t)(end - begin)}; }
+        bool LineDone() { return _state >= S_NAME_START; }
+        //协议版本只支持HTTP/1.0和HTTP/1.1，不区分大小写
+        static bool ValidVersion(const char *data, Field f) {
+            return f._len == 8 && strncasecmp(data + f._off, "HTTP/1.", 7) == 0 &&
+                   (data[f._off + 7] == '0' || data[f._off + 7] == '1');
+        }
+        HttpParseStatu AddHeader(const char *data, size_t end) {
+            //去掉值末尾的空白
+            while (end > _mark && (data[end - 1] == ' ' || data[end - 1] == '\t')) end--;
+            if (_headers.size() >= MAX_HEADERS) return Fail(431);
+            _headers.push_back(Header{_name, MakeField(_mark, end)});
+            return PARSE_AGAIN;
+        }
+    public:
+        HttpParser() { Reset(); }
+        void Reset() {
+            _state = S_METHOD;
+            _pos = 0;
+            _line = 0;
+            _mark = 0;
+            _error = 0;
+            _method = _target = _version = _name = Field{0, 0};
+            _headers.clear();
+        }
+        //data/len是缓冲区中全部的可读数据，返回PARSE_DONE时，HeadSize()就是请求行加头部的长度
+        //方法、字段名和字段值由HttpScanner成块扫描，只在分隔符处逐字节处理
+        HttpParseStatu Parse(const char *data, size_t len) {
+            while (_pos < len) {
+                //请求行和单个头部行的长度限制，以及头部总长度的限制
+                if (_pos - _line > MAX_LINE) return Fail(LineDone() ? 431 : 414);
+                if (_pos > MAX_HEAD_SIZE) return Fail(431);
+                unsigned char c = data[_pos];
+                switch (_state) {
+                    case S_METHOD:
+                        _pos += HttpScanner::ScanToken(data + _pos, len - _pos);
+                        if (_pos == len) return Again();
+                        if (data[_pos] != ' ' || _pos == _mark) return Fail(400);
+                        _method = MakeField(_mark, _pos);
+                        _mark = _pos + 1;
+                        _state = S_TARGET;
+                        break;
+                    case S_TARGET:
+                        if (c == ' ') {
+                            if (_pos == _mark) return Fail(400);
+                            _target = MakeField(_mark, _pos);
+                            _mark = _pos + 1;
+                            _state = S_VERSION;
+                        }else if (c <= 0x20 || c == 0x7f) {
+                            return Fail(400);
+                        }
+                        break;
+                    case S_VERSION:
+                        if (c == '\r' || c == '\n') {
+                            _version = MakeField(_mark, _pos);
+                            if (ValidVersion(data, _version) == false) return Fail(400);
+                            _state = (c == '\r') ? S_LINE_LF : S_NAME_START;
+                            _line = _pos + 1;
+                        }
+                        break;
+                    case S_LINE_LF:
+                        if (c != '\n') return Fail(400);
+                        _state = S_NAME_START;
+                        _line = _pos + 1;
+                        break;
+                    case S_NAME_START:
+                        if (c == '\r') {
+                            _state = S_END_LF;
+                        }else if (c == '\n') {
+                            _state = S_DONE;
+                            _pos++;
+                            return PARSE_DONE;
+                        }else if (HttpScanner::IsToken(c)) {
+                            _mark = _pos;
+                            _state = S_NAME;
+                            continue;//从当前字节开始扫描字段名
+                        }else {
+                            return Fail(400);//包括以空白开头的折叠行
+                        }
+                        break;
+                    case S_NAME:
+                        _pos += HttpScanner::ScanToken(data + _pos, len - _pos);
+                        if (_pos == len) return Again();
+                        if (data[_pos] != ':') return Fail(400);//字段名和冒号之间不允许有空白
+                        _name = MakeField(_mark, _pos);
+                        _state = S_VALUE_START;
+                        break;
+                    case S_VALUE_START:
+                        //冒号之后的空白可有可无
+                        if (c == ' ' || c == '\t') break;
+                        _mark = _pos;
+                        _state = S_VALUE;
+                        continue;//当前字节属于值，交给S_VALUE处理
+                    case S_VALUE: {
+                        //扫描到第一个控制字符，只能是行尾的\r\n或者\n，其他控制字符都是非法的
+                        _pos += HttpScanner::ScanValue(data + _pos, len - _pos);
+                        if (_pos == len) return Again();
+                        size_t end = _pos;
+                        if (data[_pos] == '\r') {
+                            if (_pos + 1 == len) return Again();//等待\r之后的\n，下次从\r重新判断
+                            if (data[_pos + 1] != '\n') return Fail(400);
+                            _pos++;
+                        }else if (data[_pos] != '\n') {
+                            return Fail(400);
+                        }
+                        if (end - _line > MAX_LINE) return Fail(431);
+                        if (AddHeader(data, end) == PARSE_ERROR) return PARSE_ERROR;
+                        _state = S_NAME_START;
+                        _line = _pos + 1;
+                        break;
+                    }
+                    case S_END_LF:
+                        if (c != '\n') return Fail(400);
+                        _state = S_DONE;
+                        _pos++;
+                        return PARSE_DONE;
+                    case S_DONE:
+                        return PARSE_DONE;
+                }
+                _pos++;
+            }
+            return Again();
+        }
+        int Error() { return _error; }
+        size_t HeadSize() { return _pos; }
+        static std::string_view View(const char *data, Field f) { return std::string_view(data + f._off, f._len); }
+        std::string_view Method(const char *data) { return View(data, _method); }
+        std::string_view Target(const char *data) { return View(data, _target); }
+        std::string_view Version(const char *data) { return View(data, _version); }
+        const std::vector<Header> &Headers() { return _headers; }
+        //请求行是否已经解析完毕
+        bool RequestLineDone() { return LineDone(); }
+};
 class HttpContext {
     private:
         int _resp_statu; //响应状态码
         HttpRecvStatu _recv_statu; //当前接收及解析的阶段状态
         HttpRequest _request;  //已经解析得到的请求信息
+        HttpParser _parser;    //请求行和头部的增量解析器
+        bool _waiting;         //是否在等待上一个请求的响应
+        HttpChunkStatu _chunk_statu; //chunked正文的解码阶段
+        size_t _chunk_left;    //当前块还需要接收的数据长度
+        size_t _trailer_size;  //已经接收的尾部字段长度
+        bool _body_started;    //是否已经开始接收Content-Length的正文
     private:
-        bool ParseHttpLine(const std::string &line) {
-            std::smatch matches;
-            std::regex e("(GET|HEAD|POST|PUT|DELETE) ([^?]*)(?:\\?(.*))? (HTTP/1\\.[01])(?:\n|\r\n)?", std::regex::icase);
-            bool ret = std::regex_match(line, matches, e);
-            if (ret == false) {
-                _recv_statu = RECV_HTTP_ERROR;
-                _resp_statu = 400;//BAD REQUEST
-                return false;
-            }
-            //0 : GET /bitejiuyeke/login?user=xiaoming&pass=123123 HTTP/1.1
-            //1 : GET
-            //2 : /bitejiuyeke/login
-            //3 : user=xiaoming&pass=123123
-            //4 : HTTP/1.1
-            //请求方法的获取
-            _request._method = matches[1];
-            std::transform(_request._method.begin(), _request._method.end(), _request._method.begin(), ::toupper);
-            //资源路径的获取，需要进行URL解码操作，但是不需要+转空格
-            _request._path = Util::UrlDecode(matches[2], false);
-            //协议版本的获取
-            _request._version = matches[4];
-            //查询字符串的获取与处理
-            std::vector<std::string> query_string_arry;
-            std::string query_string = matches[3];
-            //查询字符串的格式 key=val&key=val....., 先以 & 符号进行分割，得到各个字串
-            Util::Split(query_string, "&", &query_string_arry);
-            //针对各个字串，以 = 符号进行分割，得到key 和val， 得到之后也需要进行URL解码
-            for (auto &str : query_string_arry) {
-                size_t pos = str.find("=");
-                if (pos == std::string::npos) {
-                    _recv_statu = RECV_HTTP_ERROR;
-                    _resp_statu = 400;//BAD REQUEST
-                    return false;
-                }
-                std::string key = Util::UrlDecode(str.substr(0, pos), true);  
-                std::string val = Util::UrlDecode(str.substr(pos + 1), true);
+        bool Fail(int statu) {
+            _recv_statu = RECV_HTTP_ERROR;
+            _resp_statu = statu;
+            return false;
+        }
+        //查询字符串的格式 key=val&key=val....., 各个键值对需要进行URL解码
+        bool ParseQuery(std::string_view query) {
+            while (query.empty() == false) {
+                size_t amp = query.find('&');
+                std::string_view item = query.substr(0, amp);
+                query = (amp == std::string_view::npos) ? std::string_view() : query.substr(amp + 1);
+                if (item.empty()) continue;
+                size_t pos = item.find('=');
+                if (pos == std::string_view::npos) return Fail(400);//BAD REQUEST
+                std::string key = Util::UrlDecode(std::string(item.substr(0, pos)), true);
+                std::string val = Util::UrlDecode(std::string(item.substr(pos + 1)), true);
                 _request.SetParam(key, val);
             }
             return true;
         }
-        bool RecvHttpLine(Buffer *buf) {
-            if (_recv_statu != RECV_HTTP_LINE) return false;
-            //1. 获取一行数据，带有末尾的换行 
-            std::string line = buf->GetLineAndPop();
-            //2. 需要考虑的一些要素：缓冲区中的数据不足一行， 获取的一行数据超大
-            if (line.size() == 0) {
-                //缓冲区中的数据不足一行，则需要判断缓冲区的可读数据长度，如果很长了都不足一行，这是有问题的
-                if (buf->ReadAbleSize() > MAX_LINE) {
-                    _recv_statu = RECV_HTTP_ERROR;
-                    _resp_statu = 414;//URI TOO LONG
-                    return false;
-                }
-                //缓冲区中数据不足一行，但是也不多，就等等新数据的到来
-                return true;
-            }
-            if (line.size() > MAX_LINE) {
-                _recv_statu = RECV_HTTP_ERROR;
-                _resp_statu = 414;//URI TOO LONG
-                return false;
+        //把解析器得到的视图转换成HttpRequest中的各个要素
+        bool FillRequest(const char *data) {
+            //请求方法不区分大小写
+            std::string_view method = _parser.Method(data);
+            _request._method.assign(method.data(), method.size());
+            std::transform(_request._method.begin(), _request._method.end(), _request._method.begin(), ::toupper);
+            if (_request._method != "GET" && _request._method != "HEAD" && _request._method != "POST" &&
+                _request._method != "PUT" && _request._method != "DELETE") {
+                return Fail(400);
             }
-            bool ret = ParseHttpLine(line);
-            if (ret == false) {
-                return false;
+            //资源路径需要进行URL解码操作，但是不需要+转空格
+            std::string_view target = _parser.Target(data);
+            size_t pos = target.find('?');
+            _request._path = Util::UrlDecode(std::string(target.substr(0, pos)), false);
+            if (pos != std::string_view::npos && ParseQuery(target.substr(pos + 1)) == false) return false;
+            std::string_view version = _parser.Version(data);
+            _request._version.assign(version.data(), version.size());
+            for (auto &header : _parser.Headers()) {
+                std::string key(HttpParser::View(data, header._name));
+                std::string val(HttpParser::View(data, header._value));
+                _request.SetHeader(key, val);
             }
-            //首行处理完毕，进入头部获取阶段
-            _recv_statu = RECV_HTTP_HEAD;
             return true;
         }
         bool RecvHttpHead(Buffer *buf) {
-            if (_recv_statu != RECV_HTTP_HEAD) return false;
-            //一行一行取出数据，直到遇到空行为止， 头部的格式 key: val\r\nkey: val\r\n....
-            while(1){
-                std::string line = buf->GetLineAndPop();
-                //2. 需要考虑的一些要素：缓冲区中的数据不足一行， 获取的一行数据超大
-                if (line.size() == 0) {
-                    //缓冲区中的数据不足一行，则需要判断缓冲区的可读数据长度，如果很长了都不足一行，这是有问题的
-                    if (buf->ReadAbleSize() > MAX_LINE) {
-                        _recv_statu = RECV_HTTP_ERROR;
-                        _resp_statu = 414;//URI TOO LONG
-                        return false;
-                    }
-                    //缓冲区中数据不足一行，但是也不多，就等等新数据的到来
-                    return true;
-                }
-                if (line.size() > MAX_LINE) {
-                    _recv_statu = RECV_HTTP_ERROR;
-                    _resp_statu = 414;//URI TOO LONG
-                    return false;
-                }
-                if (line == "\n" || line == "\r\n") {
-                    break;
-                }
-                bool ret = ParseHttpHead(line);
-                if (ret == false) {
-                    return false;
+            if (_recv_statu != RECV_HTTP_LINE && _recv_statu != RECV_HTTP_HEAD) return false;
+            //头部没有收全之前数据一直留在缓冲区中，解析器从上次停下的位置继续
+            HttpParseStatu ret = _parser.Parse(buf->ReadPosition(), buf->ReadAbleSize());
+            if (ret == PARSE_ERROR) return Fail(_parser.Error());
+            if (ret == PARSE_AGAIN) {
+                if (_parser.RequestLineDone()) _recv_statu = RECV_HTTP_HEAD;
+                return true;
+            }
+            if (FillRequest(buf->ReadPosition()) == false) return false;
+            //同时有Transfer-Encoding和Content-Length时正文边界有歧义，不支持的传输编码也无法确定正文边界
+            if (_request.HasHeader("Transfer-Encoding")) {
+                if (_request.Chunked() == false || _request.HasHeader("Content-Length")) return Fail(400);
+                if (strcasecmp(_request.GetHeader("Transfer-Encoding").c_str(), "chunked") != 0) return Fail(501);
+            }
+            //Content-Length只能是十进制数字，不能有符号、空白或者其他字符，位数有限制
+            auto clen = _request._headers.find("Content-Length");
+            if (clen != _request._headers.end()) {
+                const std::string &val = clen->second;
+                if (val.empty() || val.size() > MAX_CONTENT_LENGTH_DIGITS ||
+                    val.find_first_not_of("0123456789") != std::string::npos) {
+                    return Fail(400);
                 }
             }
-            //头部处理完毕，进入正文获取阶段
+            //请求行和头部处理完毕，一次性取走，进入正文获取阶段
+            buf->MoveReadOffset(_parser.HeadSize());
+            _parser.Reset();
             _recv_statu = RECV_HTTP_BODY;
             return true;
         }
-        bool ParseHttpHead(std::string &line) {
-            //key: val\r\nkey: val\r\n....
-            if (line.back() == '\n') line.pop_back();//末尾是换行则去掉换行字符
-            if (line.back() == '\r') line.pop_back();//末尾是回车则去掉回车字符
-            size_t pos = line.find(": ");
-            if (pos == std::string::npos) {
-                _recv_statu = RECV_HTTP_ERROR;
-                _resp_statu = 400;//
+        //取出缓冲区中的一行（不含行尾的\r\n），没有完整的一行返回false，超过长度限制设置错误
+        bool GetLine(Buffer *buf, std::string_view *line) {
+            size_t len = std::min<size_t>(buf->ReadAbleSize(), MAX_LINE);
+            const char *end = (const char *)memchr(buf->ReadPosition(), '\n', len);
+            if (end == NULL) {
+                if (len == MAX_LINE) Fail(400);
                 return false;
             }
-            std::string key = line.substr(0, pos);  
-            std::string val = line.substr(pos + 2);
-            _request.SetHeader(key, val);
+            *line = std::string_view(buf->ReadPosition(), end - buf->ReadPosition());
+            if (line->empty() == false && line->back() == '\r') line->remove_suffix(1);
+            buf->MoveReadOffset(end + 1 - buf->ReadPosition());
+            return true;
+        }
+        //块大小行：十六进制长度，后边可以有;分隔的扩展，扩展直接忽略
+        bool ParseChunkSize(std::string_view line) {
+            size_t size = 0, i = 0;
+            for (; i < line.size() && isxdigit((unsigned char)line[i]); i++) {
+                if (i == MAX_CHUNK_SIZE_DIGITS) return Fail(400);
+                size = size * 16 + (isdigit((unsigned char)line[i]) ? line[i] - '0' : (tolower(line[i]) - 'a' + 10));
+            }
+            if (i == 0) return Fail(400);
+            while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) i++;
+            if (i < line.size() && line[i] != ';') return Fail(400);
+            _chunk_left = size;
+            _chunk_statu = (size == 0) ? CHUNK_TRAILER : CHUNK_DATA;
+            return true;
+        }
+        //取出的正文放到body中，设置了接收器则交给接收器
+        bool AppendBody(Buffer *buf, size_t len) {
+            if (_request._sink == nullptr) {
+                _request._body.append(buf->ReadPosition(), len);
+            }else if (_request._sink->Write(buf->ReadPosition(), len) == false) {
+                return Fail(_request._sink->Statu());
+            }
+            buf->MoveReadOffset(len);
+            return true;
+        }
+        bool BodyOver() {
+            if (_request._sink != nullptr && _request._sink->Finish() == false) {
+                return Fail(_request._sink->Statu());
+            }
+            _recv_statu = RECV_HTTP_OVER;
+            return true;
+        }
+        //接收器暂停了接收，剩余的数据留在缓冲区中
+        bool SinkPaused() { return _request._sink != nullptr && _request._sink->Paused(); }
+        //chunked编码的正文：逐块解码放到body中，数据不足时保存解码进度，等新数据到来后继续
+        bool RecvChunkedBody(Buffer *buf) {
+            std::string_view line;
+            while (_recv_statu == RECV_HTTP_BODY && SinkPaused() == false) {
+                switch (_chunk_statu) {
+                    case CHUNK_SIZE:
+                        if (GetLine(buf, &line) == false) return false;
+                        if (ParseChunkSize(line) == false) return false;
+                        break;
+                    case CHUNK_DATA: {
+                        size_t len = std::min<size_t>(_chunk_left, buf->ReadAbleSize());
+                        if (len == 0) return true;
+                        if (AppendBody(buf, len) == false) return false;
+                        _chunk_left -= len;
+                        if (_chunk_left == 0) _chunk_statu = CHUNK_DATA_END;
+                        break;
+                    }
+                    case CHUNK_DATA_END:
+                        if (GetLine(buf, &line) == false) return false;
+                        if (line.empty() == false) return Fail(400);
+                        _chunk_statu = CHUNK_SIZE;
+                        break;
+                    case CHUNK_TRAILER:
+                        //尾部字段不合并到请求头部中，只限制总长度
+                        if (GetLine(buf, &line) == false) return false;
+                        _trailer_size += line.size() + 2;
+                        if (_trailer_size > MAX_HEAD_SIZE) return Fail(400);
+                        if (line.empty()) return BodyOver();
+                        break;
+                }
+            }
             return true;
         }
         bool RecvHttpBody(Buffer *buf) {
             if (_recv_statu != RECV_HTTP_BODY) return false;
+            if (_request.Chunked()) {
+                return RecvChunkedBody(buf);
+            }
             //1. 获取正文长度
             size_t content_length = _request.ContentLength();
             if (content_length == 0) {
                 //没有正文，则请求接收解析完毕
-                _recv_statu = RECV_HTTP_OVER;
-                return true;
+                return BodyOver();
             }
-            //2. 当前已经接收了多少正文,其实就是往  _request._body 中放了多少数据了
-            size_t real_len = content_length - _request._body.size();//实际还需要接收的正文长度
+            if (SinkPaused()) return true;
+            //2. 当前已经接收了多少正文，交给接收器的正文不在_body中，用_chunk_left记录剩余的长度
+            if (_body_started == false) {
+                _body_started = true;
+                _chunk_left = content_length;
+            }
+            size_t real_len = _chunk_left;//实际还需要接收的正文长度
             //3. 接收正文放到body中，但是也要考虑当前缓冲区中的数据，是否是全部的正文
             //  3.1 缓冲区中数据，包含了当前请求的所有正文，则取出所需的数据
             if (buf->ReadAbleSize() >= real_len) {
-                _request._body.append(buf->ReadPosition(), real_len);
-                buf->MoveReadOffset(real_len);
-                _recv_statu = RECV_HTTP_OVER;
-                return true;
+                if (AppendBody(buf, real_len) == false) return false;
+                _chunk_left = 0;
+                return BodyOver();
             }
             //  3.2 缓冲区中数据，无法满足当前正文的需要，数据不足，取出数据，然后等待新数据到来
-            _request._body.append(buf->ReadPosition(), buf->ReadAbleSize());
-            buf->MoveReadOffset(buf->ReadAbleSize());
+            size_t len = buf->ReadAbleSize();
+            if (len > 0 && AppendBody(buf, len) == false) return false;
+            _chunk_left -= len;
             return true;
         }
     public:
-        HttpContext():_resp_statu(200), _recv_statu(RECV_HTTP_LINE) {}
+        HttpContext():_resp_statu(200), _recv_statu(RECV_HTTP_LINE), _waiting(false),
+                      _chunk_statu(CHUNK_SIZE), _chunk_left(0), _trailer_size(0), _body_started(false) {}
         void ReSet() {
             _resp_statu = 200;
             _recv_statu = RECV_HTTP_LINE;
+            _chunk_statu = CHUNK_SIZE;
+            _chunk_left = 0;
+            _trailer_size = 0;
+            _body_started = false;
             _request.ReSet();
+            _parser.Reset();
         }
+        //上一个请求的响应还在工作线程中处理，后续请求要等它发送之后再处理，保证响应的顺序
+        bool Waiting() { return _waiting; }
+        void SetWaiting(bool waiting) { _waiting = waiting; }
         int RespStatu() { return _resp_statu; }
         HttpRecvStatu RecvStatu() { return _recv_statu; }
+        //剩余的Content-Length正文可以由服务器通过splice直接交给接收器的文件：输入缓冲区中的正文已经交给了接收器
+        int SpliceFd() {
+            if (_recv_statu != RECV_HTTP_BODY || _body_started == false || _chunk_left == 0) return -1;
+            if (_request._sink == nullptr || _request._sink->Paused() || _request.Chunked()) return -1;
+            return _request._sink->SpliceFd();
+        }
+        size_t BodyLeft() { return _chunk_left; }
+        //服务器通过splice接收了len字节正文，ok为false表示接收出错
+        void BodySpliced(size_t len, bool ok) {
+            if (ok == false) {
+                Fail(500);
+                return;
+            }
+            _chunk_left -= len;
+            if (_request._sink->Spliced(len) == false) {
+                Fail(_request._sink->Statu());
+                return;
+            }
+            if (_chunk_left == 0) BodyOver();
+        }
         HttpRequest &Request() { return _request; }
         //接收并解析HTTP请求
         void RecvHttpRequest(Buffer *buf) {
-            //不同的状态，做不同的事情，但是这里不要break， 因为处理完请求行后，应该立即处理头部，而不是退出等新数据
+            return RecvHttpRequest(buf, [](HttpRequest &) { return 0; });
+        }
+        //头部接收完成、正文到达之前调用on_head(请求)，可以在这时为请求设置正文接收器，返回错误状态码则拒绝请求
+        template<class F>
+        void RecvHttpRequest(Buffer *buf, F &&on_head) {
+            //不同的状态，做不同的事情，但是这里不要break， 因为处理完头部后，应该立即处理正文，而不是退出等新数据
             switch(_recv_statu) {
-                case RECV_HTTP_LINE: RecvHttpLine(buf);
-                case RECV_HTTP_HEAD: RecvHttpHead(buf);
+                case RECV_HTTP_LINE:
+                case RECV_HTTP_HEAD:
+                    if (RecvHttpHead(buf) == false || _recv_statu != RECV_HTTP_BODY) return;
+                    if (int statu = on_head(_request); statu >= 400) {
+                        Fail(statu);
+                        return;
+                    }
                 case RECV_HTTP_BODY: RecvHttpBody(buf);
             }
             return;
         }
 };
+//请求上下文直接构造在连接的上下文容器中，不需要动态分配
+static_assert(sizeof(HttpContext) <= ANY_INLINE_SIZE, "HttpContext should fit in the inline storage of Any");
+
+/*路由表：注册的资源路径编译成一棵基数树，查找时沿着请求路径走一遍，耗时只与路径长度有关，与路由数量无关
+    /users/{id:int}/files/{name}  --- {name}匹配一整个路径段（不含/），{name:int}只匹配数字
+    同一位置上静态文本优先于int参数，int参数优先于普通参数
+    含有正则元字符的路径（如 /numbers/(\d+) ）放不进树中，仍按注册顺序进行正则匹配，只在树中找不到时才尝试*/
+class HttpRouter {
+    public:
+        using Handler = std::function<void(const HttpRequest &, HttpResponse *)>;
+        //正文接收器打开函数：头部接收完成后调用，可以为请求设置正文接收器，返回错误状态码则拒绝请求，0表示继续
+        using Opener = std::function<int(HttpRequest &)>;
+    private:
+        enum ParamType { PARAM_INT, PARAM_STR, PARAM_TYPES };//下标顺序就是匹配的优先级
+        struct Node {
+            std::string _label;                             //父节点到本节点的静态文本，参数节点为空
+            std::string _index;                             //各静态子节点_label的首字符，与_children一一对应
+            std::vector<std::unique_ptr<Node>> _children;   //静态子节点
+            std::unique_ptr<Node> _params[PARAM_TYPES];     //参数子节点
+            int _route = -1;                                //在本节点结束的路由
+        };
+        struct Route {
+            Handler _handler;
+            Opener _opener;
+            std::vector<std::string> _names;                //路径参数名，按出现的顺序
+        };
+        Node _root;
+        std::vector<Route> _routes;
+        std::vector<std::pair<std::regex, int>> _regex_routes;
+        size_t _openers = 0;                                //设置了接收器打开函数的路由数量
+    private:
+        //含有正则元字符的是正则路由；{3}、{2,5}是正则的重复次数，不是参数
+        //注意 . 不算元字符，/index.html 这样的路径按普通文本匹配
+        static bool IsRegex(const std::string &pattern) {
+            if (pattern.find_first_of("\\()[]*+?^$|") != std::string::npos) return true;
+            for (size_t pos = pattern.find('{'); pos != std::string::npos; pos = pattern.find('{', pos + 1)) {
+                if (pos + 1 >= pattern.size()) return true;
+                if (isalpha((unsigned char)pattern[pos + 1]) == 0 && pattern[pos + 1] != '_') return true;
+            }
+            return false;
+        }
+        static void BadPattern(const std::string &pattern) {
+            ERR_LOG("BAD ROUTE PATTERN: %s", pattern.c_str());
+            abort();
+        }
+        //在节点下插入一段静态文本，与已有子节点只有部分前缀相同时拆分节点，返回文本结束处的节点
+        static Node *InsertStatic(Node *node, std::string_view text) {
+            while (text.empty() == false) {
+                size_t pos = node->_index.find(text[0]);
+                if (pos == std::string::npos) {
+                    node->_index.push_back(text[0]);
+                    node->_children.push_back(std::make_unique<Node>());
+                    node->_children.back()->_label.assign(text.data(), text.size());
+                    return node->_children.back().get();
+                }
+                Node *child = node->_children[pos].get();
+                size_t common = 0;
+                while (common < child->_label.size() && common < text.size() && child->_label[common] == text[common]) {
+                    common++;
+                }
+                if (common < child->_label.size()) {
+                    // 公共前缀 -> 剩余部分
+                    std::unique_ptr<Node> mid = std::make_unique<Node>();
+                    mid->_label = child->_label.substr(0, common);
+                    child->_label.erase(0, common);
+                    mid->_index.push_back(child->_label[0]);
+                    mid->_children.push_back(std::move(node->_children[pos]));
+                    node->_children[pos] = std::move(mid);
+                    child = node->_children[pos].get();
+                }
+                node = child;
+                text.remove_prefix(common);
+            }
+            return node;
+        }
+        //把资源路径编译进基数树，返回路径结束处的节点
+        Node *Compile(const std::string &pattern, std::vector<std::string> *names) {
+            std::string_view view(pattern);
+            Node *node = &_root;
+            size_t start = 0;
+            while (true) {
+                size_t open = pattern.find('{', start);
+                if (open == std::string::npos) {
+                    return InsertStatic(node, view.substr(start));
+                }
+                size_t close = pattern.find('}', open);
+                if (close == std::string::npos) BadPattern(pattern);
+                //参数必须占据一整个路径段
+                if (open == 0 || pattern[open - 1] != '/') BadPattern(pattern);
+                if (close + 1 != pattern.size() && pattern[close + 1] != '/') BadPattern(pattern);
+                node = InsertStatic(node, view.substr(start, open - start));
+                std::string name = pattern.substr(open + 1, close - open - 1);
+                int type = PARAM_STR;
+                size_t colon = name.find(':');
+                if (colon != std::string::npos) {
+                    std::string type_name = name.substr(colon + 1);
+                    name.erase(colon);
+                    if (type_name == "int") type = PARAM_INT;
+                    else if (type_name != "str") BadPattern(pattern);
+                }
+                names->push_back(name);
+                if (node->_params[type] == nullptr) {
+                    node->_params[type] = std::make_unique<Node>();
+                }
+                node = node->_params[type].get();
+                start = close + 1;
+            }
+        }
+        static bool MatchParam(int type, std::string_view seg) {
+            if (seg.empty()) return false;
+            if (type == PARAM_STR) return true;
+            for (char c : seg) {
+                if (c < '0' || c > '9') return false;
+            }
+            return true;
+        }
+        //先走静态子节点，再依次尝试int参数和普通参数，走不通就回退到上一个分叉
+        int Find(const Node *node, std::string_view path, HttpRequest *req) const {
+            if (path.empty()) return node->_route;
+            size_t pos = node->_index.find(path[0]);
+            if (pos != std::string::npos) {
+                const Node *child = node->_children[pos].get();
+                if (path.compare(0, child->_label.size(), child->_label) == 0) {
+                    int route = Find(child, path.substr(child->_label.size()), req);
+                    if (route >= 0) return route;
+                }
+            }
+            std::string_view seg = path.substr(0, path.find('/'));
+            for (int type = 0; type < PARAM_TYPES; type++) {
+                const Node *child = node->_params[type].get();
+                if (child == nullptr || MatchParam(type, seg) == false) continue;
+                req->_captures.emplace_back(std::string_view(), seg);
+                int route = Find(child, path.substr(seg.size()), req);
+                if (route >= 0) return route;
+                req->_captures.pop_back();
+            }
+            return -1;
+        }
+        //查找请求对应的路由，并把路径参数放入req->_captures，没有对应的路由返回-1
+        int MatchRoute(HttpRequest *req) const {
+            const std::string &path = req->_path;
+            req->_captures.clear();
+            int route = Find(&_root, path, req);
+            if (route >= 0) {
+                const std::vector<std::string> &names = _routes[route]._names;
+                for (size_t i = 0; i < req->_captures.size(); i++) {
+                    req->_captures[i].first = names[i];
+                }
+                return route;
+            }
+            for (auto &regex_route : _regex_routes) {
+                if (std::regex_match(path, req->_matches, regex_route.first) == false) continue;
+                for (size_t i = 1; i < req->_matches.size(); i++) {
+                    const std::ssub_match &sub = req->_matches[i];
+                    req->_captures.emplace_back(std::string_view(), std::string_view(path.data() + (sub.first - path.begin()), sub.length()));
+                }
+                return regex_route.second;
+            }
+            return -1;
+        }
+    public:
+        //同一个路径注册多次时，与原来按顺序匹配一样，先注册的优先
+        void Add(const std::string &pattern, const Handler &handler, const Opener &opener = Opener()) {
+            int index = _routes.size();
+            _routes.push_back(Route{handler, opener, {}});
+            if (opener) _openers++;
+            if (IsRegex(pattern)) {
+                _regex_routes.push_back(std::make_pair(std::regex(pattern), index));
+                return;
+            }
+            Node *node = Compile(pattern, &_routes[index]._names);
+            if (node->_route < 0) node->_route = index;
+        }
+        //查找请求对应的处理函数，并把路径参数放入req->_captures，没有对应的处理函数返回nullptr
+        const Handler *Match(HttpRequest *req) const {
+            int route = MatchRoute(req);
+            return route < 0 ? nullptr : &_routes[route]._handler;
+        }
+        //查找请求对应路由的接收器打开函数，没有返回nullptr
+        const Opener *MatchOpener(HttpRequest *req) const {
+            int route = MatchRoute(req);
+            return (route < 0 || !_routes[route]._opener) ? nullptr : &_routes[route]._opener;
+        }
+        bool HasOpener() const { return _openers > 0; }
+        size_t Size() const { return _routes.size(); }
+};
 
 
 class HttpServer {
     private:
-        using Handler = std::function<void(const HttpRequest &, HttpResponse *)>;
-        using Handlers = std::vector<std::pair<std::regex, Handler>>;
-        Handlers _get_route;
-        Handlers _post_route;
-        Handlers _put_route;
-        Handlers _delete_route;
+        using Handler = HttpRouter::Handler;
+        using Opener = HttpRouter::Opener;
+        HttpRouter _get_route;
+        HttpRouter _post_route;
+        HttpRouter _put_route;
+        HttpRouter _delete_route;
         std::string _basedir; //静态资源根目录
+        bool _file_cache;           //是否启用静态文件缓存
+        size_t _file_cache_bytes;   //每个线程缓存的总字节数
+        size_t _file_cache_max_file;//缓存内容的文件大小上限
+        bool _compress;             //是否压缩响应正文
+        int _compress_level;
+        size_t _compress_min_size;
+        std::unique_ptr<LoopThreadPool> _compress_pool;  //压缩工作线程，没有设置时在通信线程中直接压缩
+        std::vector<EventLoop *> _compress_loops;
+        std::atomic<uint64_t> _compress_next;
         TcpServer _server;
     private:
         void ErrorHandler(const HttpRequest &req, HttpResponse *rsp) {
@@ -669,32 +2120,118 @@ class HttpServer {
             rsp->SetContent(body, "text/html");
         }
         //将HttpResponse中的要素按照http协议格式进行组织，发送
-        void WriteReponse(const PtrConnection &conn, const HttpRequest &req, HttpResponse &rsp) {
-            //1. 先完善头部字段
+        //根据请求和响应判断正文是否需要压缩、使用哪种压缩格式
+        //静态文件的压缩版本在处理请求时已经选好了，不再压缩
+        HttpEncoding ChooseEncoding(const HttpRequest &req, HttpResponse &rsp) {
+            if (_compress == false || rsp._statu != 200 || rsp._file != nullptr) {
+                return ENCODING_IDENTITY;
+            }
+            if (rsp._body.size() < _compress_min_size || rsp.HasHeader("Content-Encoding")) {
+                return ENCODING_IDENTITY;
+            }
+            std::string *type = rsp.FindHeader("Content-Type");
+            if (type == nullptr || Util::Compressible(*type) == false) {
+                return ENCODING_IDENTITY;
+            }
+            rsp.ReplaceHeader("Vary", "Accept-Encoding");//是否压缩取决于请求，中间的缓存需要知道
+            auto accept = req._headers.find("Accept-Encoding");
+            if (accept == req._headers.end()) {
+                return ENCODING_IDENTITY;
+            }
+            return Util::AcceptEncoding(accept->second);
+        }
+        //压缩正文，压缩后没有变小就保持原样
+        void CompressBody(HttpResponse *rsp, HttpEncoding encoding) {
+            std::string out;
+            if (Util::Compress(rsp->_body.data(), rsp->_body.size(), encoding, _compress_level, &out) == false) {
+                return;
+            }
+            if (out.size() >= rsp->_body.size()) {
+                return;
+            }
+            rsp->_body.swap(out);
+            rsp->SetEncoding(encoding);
+        }
+        void SetConnectionHeader(const HttpRequest &req, HttpResponse &rsp) {
             if (req.Close() == true) {
                 rsp.SetHeader("Connection", "close");
             }else {
                 rsp.SetHeader("Connection", "keep-alive");
             }
-            if (rsp._body.empty() == false && rsp.HasHeader("Content-Length") == false) {
-                rsp.SetHeader("Content-Length", std::to_string(rsp._body.size()));
+        }
+        void WriteReponse(const PtrConnection &conn, const HttpRequest &req, HttpResponse &rsp) {
+            //1. 先完善头部字段，需要压缩的正文进行压缩
+            SetConnectionHeader(req, rsp);
+            HttpEncoding encoding = ChooseEncoding(req, rsp);
+            if (encoding != ENCODING_IDENTITY) {
+                CompressBody(&rsp, encoding);
+            }
+            SendResponse(conn, req._version, rsp);
+        }
+        //需要压缩的响应放到工作线程中压缩，压缩完成后回到连接所在的线程发送
+        //期间暂停这个连接的读取和后续请求的处理，返回false表示不需要异步处理
+        bool WriteReponseAsync(const PtrConnection &conn, const HttpRequest &req, HttpResponse &rsp) {
+            if (_compress_loops.empty()) {
+                return false;
             }
-            if (rsp._body.empty() == false && rsp.HasHeader("Content-Type") == false) {
-                rsp.SetHeader("Content-Type", "application/octet-stream");
+            HttpEncoding encoding = ChooseEncoding(req, rsp);
+            if (encoding == ENCODING_IDENTITY) {
+                return false;
             }
-            if (rsp._redirect_flag == true) {
-                rsp.SetHeader("Location", rsp._redirect_url);
+            SetConnectionHeader(req, rsp);
+            Defer(conn);
+            EventLoop *worker = _compress_loops[_compress_next++ % _compress_loops.size()];
+            worker->QueueInLoop([this, conn, encoding, version = req._version, rsp = std::move(rsp)]() mutable {
+                CompressBody(&rsp, encoding);
+                conn->GetLoop()->QueueInLoop([this, conn, version = std::move(version), rsp = std::move(rsp)]() mutable {
+                    if (conn->Connected() == false) {
+                        return;
+                    }
+                    SendResponse(conn, version, rsp);
+                    Resume(conn, rsp.Close());
+                });
+            });
+            return true;
+        }
+        //响应不能立即发送完成时，暂停这个连接的读取和后续请求的处理
+        void Defer(const PtrConnection &conn) {
+            conn->GetContext()->get<HttpContext>()->SetWaiting(true);
+            conn->PauseRead();
+        }
+        //推迟的响应发送完成，在连接所属线程中调用：短连接关闭，长连接继续处理后续的请求
+        void Resume(const PtrConnection &conn, bool close) {
+            if (conn->Connected() == false) {
+                return;
+            }
+            if (close == true) {
+                conn->Shutdown();
+                return;
             }
-            //2. 将rsp中的要素，按照http协议格式进行组织
-            std::stringstream rsp_str;
-            rsp_str << req._version << " " << std::to_string(rsp._statu) << " " << Util::StatuDesc(rsp._statu) << "\r\n";
-            for (auto &head : rsp._headers) {
-                rsp_str << head.first << ": " << head.second << "\r\n";
+            conn->GetContext()->get<HttpContext>()->SetWaiting(false);
+            conn->ResumeRead();
+            conn->ResumeInput();
+        }
+        //处理函数打开了流式响应：先发送状态行和头部，正文由处理函数在流中继续写入，流结束后再处理后续的请求
+        void WriteStream(const PtrConnection &conn, const HttpRequest &req, HttpResponse &rsp) {
+            //没有Content-Length时HTTP/1.1使用chunked编码，HTTP/1.0只能以关闭连接表示正文结束
+            bool chunked = false;
+            if (rsp.HasHeader("Content-Length") == false) {
+                if (req._version == "HTTP/1.1") {
+                    chunked = true;
+                    rsp.SetHeader("Transfer-Encoding", "chunked");
+                }else {
+                    rsp.ReplaceHeader("Connection", "close");
+                }
             }
-            rsp_str << "\r\n";
-            rsp_str << rsp._body;
-            //3. 发送数据
-            conn->Send(rsp_str.str().c_str(), rsp_str.str().size());
+            SetConnectionHeader(req, rsp);
+            Defer(conn);
+            SendResponse(conn, req._version, rsp);
+            bool close = rsp.Close();
+            rsp._stream->Start(chunked, req._method == "HEAD", [this, conn, close]() { Resume(conn, close); });
+        }
+        //将HttpResponse中的要素按照http协议格式直接组织到连接的发送缓冲区，总是在连接所属线程中调用
+        void SendResponse(const PtrConnection &conn, const std::string &version, HttpResponse &rsp) {
+            conn->SendWith([&](OutBuffer *out) { rsp.Serialize(version, out); });
         }
         bool IsFileHandler(const HttpRequest &req) {
             // 1. 必须设置了静态资源根目录
@@ -728,40 +2265,108 @@ class HttpServer {
             if (req._path.back() == '/')  {
                 req_path += "index.html";
             }
+            //客户端缓存的版本仍然有效时，不需要读取文件
+            struct stat st;
+            if (stat(req_path.c_str(), &st) != 0) {
+                return;
+            }
+            rsp->SetETag(Util::FileETag(st.st_ino, st.st_size, st.st_mtim), true);
+            rsp->SetLastModified(st.st_mtime);
+            if (rsp->NotModified(req)) return;
+            std::string mime = Util::ExtMime(req_path);
+            //客户端支持gzip时，优先发送同目录下预先压缩好的.gz文件
+            if (AcceptGzip(req, mime) && Util::GzipSibling(req_path, st.st_mtim)) {
+                if (Util::ReadFile(req_path + ".gz", &rsp->_body) == true) {
+                    rsp->SetHeader("Content-Type", mime);
+                    rsp->SetEncoding(ENCODING_GZIP);
+                    return;
+                }
+            }
             bool ret = Util::ReadFile(req_path, &rsp->_body);
             if (ret == false) {
                 return;
             }
-            std::string mime = Util::ExtMime(req_path);
             rsp->SetHeader("Content-Type", mime);
             return;
         }
+        bool AcceptGzip(const HttpRequest &req, const std::string &mime) {
+            if (_compress == false || Util::Compressible(mime) == false) {
+                return false;
+            }
+            auto it = req._headers.find("Accept-Encoding");
+            return it != req._headers.end() && Util::AcceptEncoding(it->second) == ENCODING_GZIP;
+        }
+        //每个线程一个文件缓存，只在本线程中访问，不需要加锁
+        FileCache *LoopFileCache(const PtrConnection &conn) {
+            static thread_local std::unique_ptr<FileCache> cache;
+            if (cache == nullptr) {
+                cache.reset(new FileCache(conn->GetLoop(), _file_cache_bytes, _file_cache_max_file));
+                cache->EnableCompression(_compress, _compress_level, _compress_min_size);
+            }
+            return cache.get();
+        }
+        //通过文件缓存判断并处理静态资源请求，命中时既不需要stat也不需要读取文件
+        bool CachedFileHandler(const PtrConnection &conn, const HttpRequest &req, HttpResponse *rsp) {
+            if (_basedir.empty() || req._path.empty()) {
+                return false;
+            }
+            if (req._method != "GET" && req._method != "HEAD") {
+                return false;
+            }
+            FileCache::PtrFile file = LoopFileCache(conn)->Get(_basedir, req._path);
+            if (file == nullptr || file->_regular == false) {
+                return false;
+            }
+            rsp->_file = file;
+            //有gzip版本并且客户端支持时发送gzip版本，验证器和头部都使用对应版本的
+            if (file->HasGzip() && AcceptGzip(req, file->_mime)) {
+                rsp->_encoding = ENCODING_GZIP;
+            }
+            if (req.NotModified(file->_etag, file->_mtime.tv_sec)) {
+                rsp->_statu = 304;
+                return true;
+            }
+            if (file->HasBody()) {
+                return true;
+            }
+            //大文件只缓存了元数据，内容每次读取
+            bool gzip = (rsp->_encoding == ENCODING_GZIP);
+            if (Util::ReadFile(gzip ? file->_path + ".gz" : file->_path, &rsp->_body) == false) {
+                return true;
+            }
+            rsp->SetHeader("Content-Type", file->_mime);
+            if (gzip) {
+                rsp->SetHeader("Content-Encoding", "gzip");
+                rsp->SetHeader("Vary", "Accept-Encoding");
+            }
+            return true;
+        }
         //功能性请求的分类处理
-        void Dispatcher(HttpRequest &req, HttpResponse *rsp, Handlers &handlers) {
-            //在对应请求方法的路由表中，查找是否含有对应资源请求的处理函数，有则调用，没有则发挥404
-            //思想：路由表存储的时键值对 -- 正则表达式 & 处理函数
-            //使用正则表达式，对请求的资源路径进行正则匹配，匹配成功就使用对应函数进行处理
-            //  /numbers/(\d+)       /numbers/12345
-            for (auto &handler : handlers) {
-                const std::regex &re = handler.first;
-                const Handler &functor = handler.second;
-                bool ret = std::regex_match(req._path, req._matches, re);
-                if (ret == false) {
-                    continue;
-                }
-                return functor(req, rsp);//传入请求信息，和空的rsp，执行处理函数
+        void Dispatcher(HttpRequest &req, HttpResponse *rsp, HttpRouter &router) {
+            //在对应请求方法的路由表中，查找是否含有对应资源请求的处理函数，有则调用，没有则返回404
+            //  /users/{id:int}      /users/12345      id=12345
+            //  /numbers/(\d+)       /numbers/12345    正则路由
+            const Handler *functor = router.Match(&req);
+            if (functor == nullptr) {
+                rsp->_statu = 404;
+                return;
             }
-            rsp->_statu = 404;
+            (*functor)(req, rsp);//传入请求信息，和空的rsp，执行处理函数
+            //处理函数设置了验证器，客户端缓存仍然有效时回复304
+            rsp->NotModified(req);
         }
-        void Route(HttpRequest &req, HttpResponse *rsp) {
+        void Route(const PtrConnection &conn, HttpRequest &req, HttpResponse *rsp) {
             //1. 对请求进行分辨，是一个静态资源请求，还是一个功能性请求
             //   静态资源请求，则进行静态资源的处理
             //   功能性请求，则需要通过几个请求路由表来确定是否有处理函数
             //   既不是静态资源请求，也没有设置对应的功能性请求处理函数，就返回405
-            if (IsFileHandler(req) == true) {
+            if (_file_cache) {
+                if (CachedFileHandler(conn, req, rsp) == true) return;
+            }else if (IsFileHandler(req) == true) {
                 //是一个静态资源请求, 则进行静态资源请求的处理
                 return FileHandler(req, rsp);
             }
+            rsp->_conn = conn;//处理函数有可能打开流式响应
             if (req._method == "GET" || req._method == "HEAD") {
                 return Dispatcher(req, rsp, _get_route);
             }else if (req._method == "POST") {
@@ -774,9 +2379,43 @@ class HttpServer {
             rsp->_statu = 405;// Method Not Allowed
             return ;
         }
+        //头部接收完成后，由路由的接收器打开函数决定正文是否交给接收器，返回错误状态码拒绝请求
+        int OpenBody(const PtrConnection &conn, HttpRequest &req) {
+            HttpRouter *router = nullptr;
+            if (req._method == "POST") {
+                router = &_post_route;
+            }else if (req._method == "PUT") {
+                router = &_put_route;
+            }
+            if (router == nullptr || router->HasOpener() == false) {
+                return 0;
+            }
+            const Opener *opener = router->MatchOpener(&req);
+            if (opener == nullptr) {
+                return 0;
+            }
+            int statu = (*opener)(req);
+            if (statu >= 400 || req._sink == nullptr) {
+                return statu;
+            }
+            //接收器恢复接收：总是放到任务中执行，在Write中调用时不能重入消息处理
+            std::weak_ptr<Connection> weak_conn = conn;
+            std::weak_ptr<HttpBodySink> weak_sink = req._sink;
+            req._sink->SetResume([this, weak_conn, weak_sink]() {
+                PtrConnection conn = weak_conn.lock();
+                if (conn == nullptr) return;
+                conn->GetLoop()->QueueInLoop([this, conn, weak_sink]() {
+                    std::shared_ptr<HttpBodySink> sink = weak_sink.lock();
+                    if (sink == nullptr || sink->Paused() == false) return;
+                    sink->Unpause();
+                    Resume(conn, false);
+                });
+            });
+            return 0;
+        }
         //设置上下文
         void OnConnected(const PtrConnection &conn) {
-            conn->SetContext(HttpContext());
+            conn->EmplaceContext<HttpContext>();
             DBG_LOG("NEW CONNECTION %p", conn.get());
         }
         //缓冲区数据解析+处理
@@ -784,38 +2423,154 @@ class HttpServer {
             while(buffer->ReadAbleSize() > 0){
                 //1. 获取上下文
                 HttpContext *context = conn->GetContext()->get<HttpContext>();
+                if (context->Waiting()) return;//上一个请求的响应还没有发送
                 //2. 通过上下文对缓冲区数据进行解析，得到HttpRequest对象
                 //  1. 如果缓冲区的数据解析出错，就直接回复出错响应
                 //  2. 如果解析正常，且请求已经获取完毕，才开始去进行处理
-                context->RecvHttpRequest(buffer);
-                HttpRequest &req = context->Request();
-                HttpResponse rsp(context->RespStatu());
+                context->RecvHttpRequest(buffer, [&](HttpRequest &req) { return OpenBody(conn, req); });
                 if (context->RespStatu() >= 400) {
-                    //进行错误响应，关闭连接
-                    ErrorHandler(req, &rsp);//填充一个错误显示页面数据到rsp中
-                    WriteReponse(conn, req, rsp);//组织响应发送给客户端
-                    context->ReSet();
                     buffer->MoveReadOffset(buffer->ReadAbleSize());//出错了就把缓冲区数据清空
-                    conn->Shutdown();//关闭连接
-                    return;
+                    return ReplyError(conn, context);
                 }
                 if (context->RecvStatu() != RECV_HTTP_OVER) {
+                    HttpRequest &req = context->Request();
+                    //正文接收器暂停了接收，停止读取，等它恢复后再继续处理缓冲区中剩余的数据
+                    if (req._sink != nullptr && req._sink->Paused()) {
+                        Defer(conn);
+                    }
+                    //剩余的正文可以直接从socket移动到文件
+                    int fd = context->SpliceFd();
+                    if (fd >= 0) {
+                        SpliceBody(conn, context, fd);
+                    }
                     //当前请求还没有接收完整,则退出，等新数据到来再重新继续处理
                     return;
                 }
-                //3. 请求路由 + 业务处理
-                Route(req, &rsp);
-                //4. 对HttpResponse进行组织发送
-                WriteReponse(conn, req, rsp);
-                //5. 重置上下文
-                context->ReSet();
-                //6. 根据长短连接判断是否关闭连接或者继续处理
-                if (rsp.Close() == true) conn->Shutdown();//短链接则直接关闭
+                //3. 请求路由 + 业务处理 + 发送响应
+                if (Respond(conn, context) == false) return;
             }
             return;
         }
+        //进行错误响应，关闭连接
+        void ReplyError(const PtrConnection &conn, HttpContext *context) {
+            HttpRequest &req = context->Request();
+            HttpResponse rsp(context->RespStatu());
+            ErrorHandler(req, &rsp);//填充一个错误显示页面数据到rsp中
+            WriteReponse(conn, req, rsp);//组织响应发送给客户端
+            context->ReSet();
+            conn->Shutdown();//关闭连接
+        }
+        //请求接收完毕：路由处理并发送响应，返回false表示暂时不能继续处理后续的请求
+        bool Respond(const PtrConnection &conn, HttpContext *context) {
+            HttpRequest &req = context->Request();
+            HttpResponse rsp(context->RespStatu());
+            //1. 请求路由 + 业务处理
+            Route(conn, req, &rsp);
+            //流式响应的正文由处理函数继续写入，流结束后再处理后续的请求
+            if (rsp.Streaming()) {
+                WriteStream(conn, req, rsp);
+                context->ReSet();
+                return false;
+            }
+            //2. 对HttpResponse进行组织发送，需要在工作线程中压缩的，压缩完成后再发送并继续处理后续的请求
+            if (WriteReponseAsync(conn, req, rsp) == true) {
+                context->ReSet();
+                return false;
+            }
+            WriteReponse(conn, req, rsp);
+            //3. 重置上下文
+            context->ReSet();
+            //4. 根据长短连接判断是否关闭连接或者继续处理
+            if (rsp.Close() == true) conn->Shutdown();//短链接则直接关闭
+            //5. 本轮处理的请求数达到配额，剩余的请求在下一轮事件循环中继续处理
+            return conn->ConsumeMessageBudget();
+        }
+        //每个线程一个管道，socket中的数据先splice到管道，再从管道splice到文件，数据只在内核的页之间移动
+        struct SplicePipe {
+            int _fds[2];
+            size_t _size;
+            SplicePipe() { Open(); }
+            ~SplicePipe() { Close(); }
+            void Open() {
+                _size = 0;
+                if (pipe2(_fds, O_CLOEXEC) != 0) {
+                    ERR_LOG("CREATE SPLICE PIPE FAILED: %s", strerror(errno));
+                    _fds[0] = _fds[1] = -1;
+                    return;
+                }
+                int size = fcntl(_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+                _size = size > 0 ? size : fcntl(_fds[1], F_GETPIPE_SZ);
+            }
+            void Close() {
+                if (_fds[0] >= 0) close(_fds[0]);
+                if (_fds[1] >= 0) close(_fds[1]);
+            }
+            //出错时管道中可能残留数据，重新创建
+            void Reset() {
+                Close();
+                Open();
+            }
+        };
+        SplicePipe *LoopPipe() {
+            static thread_local SplicePipe pipe;
+            return &pipe;
+        }
+        //接管连接的读取，剩余的正文由SpliceRead直接移动到接收器的文件中
+        void SpliceBody(const PtrConnection &conn, HttpContext *context, int fd) {
+            if (LoopPipe()->_size == 0) {
+                return;//创建不了管道，仍然通过Write接收
+            }
+            //保存原始指针，避免连接和它保存的读取函数互相引用；读取函数只在连接存在时被调用
+            Connection *raw = conn.get();
+            conn->SetRawReader([this, raw, context, fd]() { return SpliceRead(raw, context, fd); });
+        }
+        //描述符可读时调用，返回false表示正文接收完毕或者出错，交还给连接正常接收
+        bool SpliceRead(Connection *raw, HttpContext *context, int fd) {
+            SplicePipe *pipe = LoopPipe();
+            size_t budget = SPLICE_READ_BUDGET;//每次最多接收的数据量，避免一个上传独占线程
+            bool ok = true;
+            while (context->RecvStatu() == RECV_HTTP_BODY && budget > 0) {
+                size_t want = std::min(std::min(context->BodyLeft(), pipe->_size), budget);
+                ssize_t ret = splice(raw->Fd(), NULL, pipe->_fds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (ret < 0 && errno == EINTR) continue;
+                if (ret < 0 && errno == EAGAIN) return true;//socket中暂时没有数据了
+                if (ret <= 0) {
+                    //对端关闭或者出错，正文不完整，接收器随着上下文释放
+                    raw->Shutdown();
+                    return false;
+                }
+                size_t moved = 0;
+                while (moved < (size_t)ret) {
+                    ssize_t n = splice(pipe->_fds[0], NULL, fd, NULL, ret - moved, SPLICE_F_MOVE);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) {
+                        ERR_LOG("SPLICE TO FILE FAILED: %s", strerror(errno));
+                        pipe->Reset();
+                        ok = false;
+                        break;
+                    }
+                    moved += n;
+                }
+                context->BodySpliced(ret, ok);
+                budget -= ret;
+            }
+            if (context->RecvStatu() == RECV_HTTP_BODY) {
+                return true;//配额用完，socket中剩余的数据在下一次可读事件中继续接收
+            }
+            //接收完毕或者出错，放到任务中回复，这时输入缓冲区是空的
+            PtrConnection conn = raw->shared_from_this();
+            conn->GetLoop()->QueueInLoop([this, conn, context]() {
+                if (conn->Connected() == false) return;
+                if (context->RespStatu() >= 400) return ReplyError(conn, context);
+                Respond(conn, context);
+            });
+            return false;
+        }
     public:
-        HttpServer(int port, int timeout = DEFALT_TIMEOUT):_server(port) {
+        HttpServer(int port, int timeout = DEFALT_TIMEOUT):_file_cache(false), _file_cache_bytes(FILE_CACHE_MAX_BYTES),
+                                                           _file_cache_max_file(FILE_CACHE_MAX_FILE), _compress(false),
+                                                           _compress_level(COMPRESS_DEFAULT_LEVEL), _compress_min_size(COMPRESS_MIN_SIZE),
+                                                           _compress_next(0), _server(port) {
             _server.EnableInactiveRelease(timeout);
             _server.SetConnectedCallback(std::bind(&HttpServer::OnConnected, this, std::placeholders::_1));
             _server.SetMessageCallback(std::bind(&HttpServer::OnMessage, this, std::placeholders::_1, std::placeholders::_2));
@@ -824,22 +2579,64 @@ class HttpServer {
             assert(Util::IsDirectory(path) == true);
             _basedir = path;
         }
-        /*设置/添加，请求（请求的正则表达）与处理函数的映射关系*/
+        /*设置/添加，请求的资源路径（/users/{id:int} 形式或正则表达式）与处理函数的映射关系*/
         void Get(const std::string &pattern, const Handler &handler) {
-            _get_route.push_back(std::make_pair(std::regex(pattern), handler));
+            _get_route.Add(pattern, handler);
         }
         void Post(const std::string &pattern, const Handler &handler) {
-            _post_route.push_back(std::make_pair(std::regex(pattern), handler));
+            _post_route.Add(pattern, handler);
         }
         void Put(const std::string &pattern, const Handler &handler) {
-            _put_route.push_back(std::make_pair(std::regex(pattern), handler));
+            _put_route.Add(pattern, handler);
+        }
+        //带正文接收器的路由：头部接收完成后调用opener，它可以为请求设置接收器（比如FileSink::Open），
+        //正文随着到达交给接收器，不在内存中累积，全部接收之后再调用handler，这时req._body为空
+        void Post(const std::string &pattern, const Handler &handler, const Opener &opener) {
+            _post_route.Add(pattern, handler, opener);
+        }
+        void Put(const std::string &pattern, const Handler &handler, const Opener &opener) {
+            _put_route.Add(pattern, handler, opener);
         }
         void Delete(const std::string &pattern, const Handler &handler) {
-            _delete_route.push_back(std::make_pair(std::regex(pattern), handler));
+            _delete_route.Add(pattern, handler);
         }
         void SetThreadCount(int count) {
             _server.SetThreadCount(count);
         }
+        //静态文件缓存：每个线程最多缓存max_bytes字节，不超过max_file字节的文件连同内容一起缓存
+        //文件的变化通过inotify得知，修改、替换、删除文件后缓存会自动失效
+        void EnableFileCache(bool enable, size_t max_bytes = FILE_CACHE_MAX_BYTES, size_t max_file = FILE_CACHE_MAX_FILE) {
+            _file_cache = enable;
+            _file_cache_bytes = max_bytes;
+            _file_cache_max_file = max_file;
+        }
+        //响应压缩：客户端支持时，不小于min_size字节的文本、json、js等可压缩类型的正文使用gzip/deflate压缩
+        //静态文件优先使用同目录下预先压缩好的.gz文件，文件缓存中的文件只在加载时压缩一次
+        void EnableCompression(bool enable, int level = COMPRESS_DEFAULT_LEVEL, size_t min_size = COMPRESS_MIN_SIZE) {
+            _compress = enable;
+            _compress_level = level;
+            _compress_min_size = min_size;
+        }
+        //压缩放到count个工作线程中进行，不阻塞通信线程，在Listen之前设置
+        void SetCompressThreadCount(int count) {
+            if (count <= 0 || _compress_pool != nullptr) return;
+            _compress_pool.reset(new LoopThreadPool(NULL));
+            _compress_pool->SetThreadCount(count);
+            _compress_pool->Create();
+            _compress_loops = _compress_pool->AllLoops();
+        }
+        //每个连接在一轮事件循环中最多读取bytes字节、处理msgs个请求，避免流水线很深的连接独占线程
+        void SetReadBudget(size_t bytes, size_t msgs) {
+            _server.SetReadBudget(bytes, msgs);
+        }
+        //发送缓冲区的高低水位线，流式响应根据它进行背压：超过高水位线时Write返回false，降到低水位线以下时通知继续写入
+        void SetWaterMarks(size_t high, size_t low) {
+            _server.SetWaterMarks(high, low);
+        }
+        //流水线请求的多个响应合并成一次写入
+        void EnableCork(bool enable) {
+            _server.EnableCork(enable);
+        }
         void Listen() {
             _server.Start();
         }
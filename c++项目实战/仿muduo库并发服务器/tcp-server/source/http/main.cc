@@ -23,10 +23,14 @@ void Login(const HttpRequest &req, HttpResponse *rsp)
 {
     rsp->SetContent(RequestStr(req), "text/plain");
 }
+//上传的正文由FileSink边接收边写入文件，处理函数被调用时文件已经保存好了
+int OpenPutFile(HttpRequest &req)
+{
+    return FileSink::Open(req, WWWROOT + req._path);
+}
 void PutFile(const HttpRequest &req, HttpResponse *rsp) 
 {
-    std::string pathname = WWWROOT + req._path;
-    Util::WriteFile(pathname, req._body);
+    rsp->SetContent("saved " + std::to_string(static_cast<FileSink *>(req._sink.get())->Size()) + " bytes\n", "text/plain");
 }
 void DelFile(const HttpRequest &req, HttpResponse *rsp) 
 {
@@ -36,10 +40,13 @@ int main()
 {
     HttpServer server(8085);
     server.SetThreadCount(3);
+    server.EnableCork(true);
+    server.EnableFileCache(true);//静态文件缓存，文件有变化时通过inotify自动失效
+    server.EnableCompression(true);//客户端支持时压缩文本类的响应正文
     server.SetBaseDir(WWWROOT);//设置静态资源根目录，告诉服务器有静态资源请求到来，需要到哪里去找资源文件
     server.Get("/hello", Hello);
     server.Post("/login", Login);
-    server.Put("/1234.txt", PutFile);
+    server.Put("/1234.txt", PutFile, OpenPutFile);
     server.Delete("/1234.txt", DelFile);
     server.Listen();
     return 0;
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cassert>
 #include <cstring>
 #include <ctime>
@@ -12,21 +13,34 @@
 #include <mutex>
 #include <condition_variable>
 #include <memory>
-#include <typeinfo>
+#include <atomic>
+#include <type_traits>
+#include <cstddef>
+#include <deque>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/timerfd.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define INF 0
 #define DBG 1
 #define ERR 2
+#ifndef LOG_LEVEL
 #define LOG_LEVEL DBG
+#endif
 
 #define LOG(level, format, ...) do{\
         if (level < LOG_LEVEL) break;\
@@ -42,22 +56,355 @@
 #define ERR_LOG(format, ...) LOG(ERR, format, ##__VA_ARGS__)
 
 #define BUFFER_DEFAULT_SIZE 1024
+/*缓冲区空间的slab分配器：空间按大小分级（1K,4K,16K,64K,256K,1M,4M），更大的直接mmap*/
+/*每个线程一个arena，EventLoop线程的arena就是这个EventLoop的空间池：本线程分配和释放都不加锁，*/
+/*其他线程释放的空间通过无锁链表还给所属的arena，由所属线程下次分配时取回*/
+#define SLAB_HEADER_SIZE 64                 //每块空间之前的块头大小，保证数据按缓存行对齐
+#define SLAB_CLASS_COUNT 7
+#define SLAB_REGION_SIZE (2 * 1024 * 1024)  //每次向系统申请的最小区域大小
+#define SLAB_LARGE_CLASS 3                  //64KB及以上是大块：可以使用大页，空闲过多时定期把物理内存还给系统
+#define SLAB_KEEP_RESIDENT (2 * 1024 * 1024) //大块每个级别的空闲块最多占用多少物理内存
+class SlabArena;
+struct SlabChunk {
+    SlabArena *_arena;  //所属arena，直接mmap的空间为NULL
+    SlabChunk *_next;   //空闲链表
+    uint64_t _size;     //可用空间大小
+    uint32_t _cls;      //所属级别
+    bool _huge;         //是否位于MAP_HUGETLB映射的区域中
+    bool _trimmed;      //空闲时物理内存已经还给了系统
+    char *Data() { return (char *)this + SLAB_HEADER_SIZE; }
+    static SlabChunk *FromData(char *data) { return (SlabChunk *)(data - SLAB_HEADER_SIZE); }
+};
+class SlabArena {
+    private:
+        struct SizeClass {
+            SlabChunk *_free;                   //本线程的空闲链表
+            uint32_t _free_count;
+            std::atomic<SlabChunk *> _remote;   //其他线程释放的空闲块
+            char *_cur;                         //当前区域中还没有切分的空间
+            char *_end;
+            bool _huge;                         //当前区域是否是大页
+        };
+        SizeClass _classes[SLAB_CLASS_COUNT];
+    private:
+        static std::atomic<bool> &HugePageFlag() { static std::atomic<bool> flag(false); return flag; }
+        //向系统申请一块新区域用于切分
+        void NewRegion(SizeClass &sc, uint64_t stride, bool large) {
+            uint64_t len = std::max<uint64_t>(SLAB_REGION_SIZE, stride * 4);
+            len = (len + SLAB_REGION_SIZE - 1) / SLAB_REGION_SIZE * SLAB_REGION_SIZE;
+            void *mem = MAP_FAILED;
+            sc._huge = false;
+            if (large && HugePageFlag().load(std::memory_order_relaxed)) {
+                mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (mem != MAP_FAILED) sc._huge = true;
+            }
+            if (mem == MAP_FAILED) {
+                mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED) {
+                    ERR_LOG("SLAB MMAP FAILED!");
+                    abort();
+                }
+                //没有预留大页时退而使用透明大页
+                if (large && HugePageFlag().load(std::memory_order_relaxed)) madvise(mem, len, MADV_HUGEPAGE);
+            }
+            sc._cur = (char *)mem;
+            sc._end = sc._cur + len;
+        }
+        void PushFree(SizeClass &sc, SlabChunk *chunk) {
+            chunk->_next = sc._free;
+            sc._free = chunk;
+            sc._free_count++;
+        }
+        //取回其他线程释放的空闲块
+        void DrainRemote(SizeClass &sc) {
+            if (sc._remote.load(std::memory_order_relaxed) == NULL) return;
+            SlabChunk *list = sc._remote.exchange(NULL, std::memory_order_acquire);
+            while (list) {
+                SlabChunk *next = list->_next;
+                PushFree(sc, list);
+                list = next;
+            }
+        }
+    public:
+        SlabArena() {
+            for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+                _classes[i]._free = NULL;
+                _classes[i]._free_count = 0;
+                _classes[i]._remote.store(NULL);
+                _classes[i]._cur = NULL;
+                _classes[i]._end = NULL;
+                _classes[i]._huge = false;
+            }
+        }
+        static void EnableHugePages(bool enable) { HugePageFlag().store(enable); }
+        static uint64_t ClassSize(uint32_t cls) { return 1024ULL << (2 * cls); }
+        //能容纳size字节的最小级别，超过最大级别返回-1
+        static int ClassOf(uint64_t size) {
+            for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+                if (size <= ClassSize(i)) return i;
+            }
+            return -1;
+        }
+        //只能由arena所属的线程调用
+        SlabChunk *Allocate(uint32_t cls) {
+            SizeClass &sc = _classes[cls];
+            if (sc._free == NULL) DrainRemote(sc);
+            if (sc._free) {
+                SlabChunk *chunk = sc._free;
+                sc._free = chunk->_next;
+                sc._free_count--;
+                chunk->_trimmed = false;
+                return chunk;
+            }
+            uint64_t stride = ClassSize(cls) + SLAB_HEADER_SIZE;
+            if (sc._cur == NULL || sc._cur + stride > sc._end) {
+                NewRegion(sc, stride, cls >= SLAB_LARGE_CLASS);//上一个区域剩余的零头不再使用
+            }
+            SlabChunk *chunk = (SlabChunk *)sc._cur;
+            sc._cur += stride;
+            chunk->_arena = this;
+            chunk->_size = ClassSize(cls);
+            chunk->_cls = cls;
+            chunk->_huge = sc._huge;
+            chunk->_trimmed = false;
+            return chunk;
+        }
+        //大块的空闲块超过SLAB_KEEP_RESIDENT的部分，把物理内存还给系统，下次使用时再由缺页中断分配
+        //分配和释放的路径上不做系统调用，由所属线程定期调用（EventLoop每秒一次），或者在arena没有所属线程时调用
+        void Trim() {
+            uint64_t page = sysconf(_SC_PAGESIZE);
+            for (int i = SLAB_LARGE_CLASS; i < SLAB_CLASS_COUNT; i++) {
+                SizeClass &sc = _classes[i];
+                DrainRemote(sc);
+                uint64_t resident = 0;
+                for (SlabChunk *chunk = sc._free; chunk; chunk = chunk->_next) {
+                    if (chunk->_trimmed || chunk->_huge) continue;
+                    if (resident + chunk->_size <= SLAB_KEEP_RESIDENT) {
+                        resident += chunk->_size;//链表头部是最近释放的，优先保留
+                        continue;
+                    }
+                    uintptr_t begin = ((uintptr_t)chunk->Data() + page - 1) / page * page;
+                    uintptr_t end = ((uintptr_t)chunk->Data() + chunk->_size) / page * page;
+                    if (end > begin) madvise((void *)begin, end - begin, MADV_DONTNEED);
+                    chunk->_trimmed = true;
+                }
+            }
+        }
+        void FreeLocal(SlabChunk *chunk) { PushFree(_classes[chunk->_cls], chunk); }
+        //其他线程释放，压入所属级别的无锁链表
+        void FreeRemote(SlabChunk *chunk) {
+            std::atomic<SlabChunk *> &head = _classes[chunk->_cls]._remote;
+            SlabChunk *old = head.load(std::memory_order_relaxed);
+            do {
+                chunk->_next = old;
+            } while (head.compare_exchange_weak(old, chunk, std::memory_order_release, std::memory_order_relaxed) == false);
+        }
+};
+class SlabAllocator {
+    private:
+        //线程退出时arena并不释放（其他线程可能还持有其中的空间），而是交给之后创建的线程继续使用
+        //这两个对象永不析构，进程退出时其他线程仍然可以安全地使用
+        static std::mutex &OrphanMutex() { static std::mutex *mutex = new std::mutex; return *mutex; }
+        static std::vector<SlabArena *> &Orphans() { static std::vector<SlabArena *> *orphans = new std::vector<SlabArena *>; return *orphans; }
+        static SlabArena *AdoptArena() {
+            std::unique_lock<std::mutex> lock(OrphanMutex());
+            if (Orphans().empty()) return new SlabArena();
+            SlabArena *arena = Orphans().back();
+            Orphans().pop_back();
+            return arena;
+        }
+        struct ArenaHolder {
+            SlabArena **_arena;
+            bool *_exited;
+            ArenaHolder(SlabArena **arena, bool *exited):_arena(arena), _exited(exited) {}
+            ~ArenaHolder() {
+                std::unique_lock<std::mutex> lock(OrphanMutex());
+                //没有所属线程的arena不会再定期收缩，线程退出时顺便收缩所有的无主arena
+                (*_arena)->Trim();
+                for (auto arena : Orphans()) arena->Trim();
+                Orphans().push_back(*_arena);
+                *_arena = NULL;
+                *_exited = true;
+            }
+        };
+        static SlabArena *LocalArena() {
+            static thread_local SlabArena *arena = NULL;
+            static thread_local bool exited = false;
+            if (arena) return arena;
+            arena = AdoptArena();
+            if (exited == false) {
+                static thread_local ArenaHolder holder(&arena, &exited);
+            }
+            return arena;
+        }
+    public:
+        //大页只用于64KB及以上的级别，申请不到预留的大页时使用透明大页
+        static void EnableHugePages(bool enable) { SlabArena::EnableHugePages(enable); }
+        //收缩本线程arena中多余空闲块占用的物理内存
+        static void Trim() { LocalArena()->Trim(); }
+        //分配至少size字节的空间，capacity返回实际可用的大小
+        static char *Allocate(uint64_t size, uint64_t *capacity) {
+            int cls = SlabArena::ClassOf(size);
+            if (cls < 0) {
+                uint64_t page = sysconf(_SC_PAGESIZE);
+                uint64_t len = (size + SLAB_HEADER_SIZE + page - 1) / page * page;
+                void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED) {
+                    ERR_LOG("SLAB MMAP FAILED!");
+                    abort();
+                }
+                SlabChunk *chunk = (SlabChunk *)mem;
+                chunk->_arena = NULL;
+                chunk->_size = len - SLAB_HEADER_SIZE;
+                *capacity = chunk->_size;
+                return chunk->Data();
+            }
+            SlabChunk *chunk = LocalArena()->Allocate(cls);
+            *capacity = chunk->_size;
+            return chunk->Data();
+        }
+        //可以在任意线程中释放
+        static void Free(char *data) {
+            if (data == NULL) return;
+            SlabChunk *chunk = SlabChunk::FromData(data);
+            if (chunk->_arena == NULL) {
+                munmap(chunk, chunk->_size + SLAB_HEADER_SIZE);
+            }else if (chunk->_arena == LocalArena()) {
+                chunk->_arena->FreeLocal(chunk);
+            }else {
+                chunk->_arena->FreeRemote(chunk);
+            }
+        }
+};
+
+/*环形缓冲区空间：同一块物理内存(memfd)在虚拟地址空间中前后映射两次，*/
+/*从环中任意位置开始、不超过容量长度的数据在虚拟地址上总是连续的，读写都不需要处理回绕，也不需要搬移数据*/
+#define RING_BUFFER_DEFAULT_SIZE (64 * 1024)
+class RingAllocator {
+    public:
+        //空间大小向上取整到页大小的2的幂次倍，失败返回NULL
+        static char *Allocate(uint64_t len, uint64_t *capacity) {
+            uint64_t size = sysconf(_SC_PAGESIZE);
+            while (size < len) size <<= 1;
+            int fd = memfd_create("buffer_ring", MFD_CLOEXEC);
+            if (fd < 0) {
+                ERR_LOG("MEMFD CREATE FAILED!");
+                return NULL;
+            }
+            if (ftruncate(fd, size) < 0) {
+                ERR_LOG("RING TRUNCATE FAILED!");
+                close(fd);
+                return NULL;
+            }
+            //先保留两倍大小的连续地址空间，再把memfd固定映射到前后两半
+            char *base = (char *)mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) {
+                close(fd);
+                return NULL;
+            }
+            void *first = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+            void *second = mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+            close(fd);//映射建立之后描述符就不需要了
+            if (first == MAP_FAILED || second == MAP_FAILED) {
+                ERR_LOG("RING MAP FAILED!");
+                munmap(base, size * 2);
+                return NULL;
+            }
+            *capacity = size;
+            return base;
+        }
+        static void Free(char *data, uint64_t capacity) {
+            if (data == NULL) return;
+            munmap(data, capacity * 2);
+        }
+};
+
 class Buffer {
     private:
-        std::vector<char> _buffer; //使用vector进行内存空间管理
+        char *_data;          //空间从slab分配器获取，第一次写入时才分配
+        uint64_t _capacity;   //空间大小
         uint64_t _reader_idx; //读偏移
         uint64_t _writer_idx; //写偏移
+        bool _ring;           //环形模式：空间由RingAllocator映射两次，读偏移始终小于容量，写偏移最多到读偏移+容量
+    private:
+        void FreeSpace() {
+            FreeData(_data, _capacity, _ring);
+            _data = NULL;
+            _capacity = 0;
+            _reader_idx = 0;
+            _writer_idx = 0;
+        }
+        static void FreeData(char *data, uint64_t capacity, bool ring) {
+            if (ring) RingAllocator::Free(data, capacity);
+            else SlabAllocator::Free(data);
+        }
+        //换到一块至少len字节的新空间，只搬移可读数据
+        void MoveTo(uint64_t len) {
+            uint64_t rsz = ReadAbleSize();
+            uint64_t capacity = 0;
+            bool ring = _ring;
+            char *data = NULL;
+            if (ring) data = RingAllocator::Allocate(len, &capacity);
+            if (data == NULL) {
+                ring = false;//环形空间映射失败时退回普通模式
+                data = SlabAllocator::Allocate(len, &capacity);
+            }
+            if (rsz > 0) std::copy(ReadPosition(), ReadPosition() + rsz, data);
+            FreeData(_data, _capacity, _ring);
+            _ring = ring;
+            _data = data;
+            _capacity = capacity;
+            _reader_idx = 0;
+            _writer_idx = rsz;
+        }
     public:
-        Buffer():_reader_idx(0), _writer_idx(0), _buffer(BUFFER_DEFAULT_SIZE){}
-        char *Begin() { return &*_buffer.begin(); }
+        Buffer():_data(NULL), _capacity(0), _reader_idx(0), _writer_idx(0), _ring(false) {}
+        //拷贝只复制可读数据
+        Buffer(const Buffer &other):_data(NULL), _capacity(0), _reader_idx(0), _writer_idx(0), _ring(other._ring) {
+            WriteAndPush(other._data + other._reader_idx, other._writer_idx - other._reader_idx);
+        }
+        Buffer(Buffer &&other):_data(other._data), _capacity(other._capacity),
+            _reader_idx(other._reader_idx), _writer_idx(other._writer_idx), _ring(other._ring) {
+            other._data = NULL;
+            other._capacity = 0;
+            other._reader_idx = 0;
+            other._writer_idx = 0;
+        }
+        Buffer &operator=(Buffer other) {
+            Swap(other);
+            return *this;
+        }
+        ~Buffer() { FreeData(_data, _capacity, _ring); }
+        void Swap(Buffer &other) {
+            std::swap(_data, other._data);
+            std::swap(_capacity, other._capacity);
+            std::swap(_reader_idx, other._reader_idx);
+            std::swap(_writer_idx, other._writer_idx);
+            std::swap(_ring, other._ring);
+        }
+        //切换环形模式，已有的数据搬到新模式的空间中
+        void EnableRing(bool enable) {
+            if (enable == _ring) return;
+            if (_data == NULL) {
+                _ring = enable;
+                return;
+            }
+            Buffer tmp;
+            tmp._ring = enable;
+            tmp.WriteAndPush(ReadPosition(), ReadAbleSize());
+            Swap(tmp);
+        }
+        bool IsRing() { return _ring; }
+        char *Begin() { return _data; }
         //获取当前写入起始地址, _buffer的空间起始地址，加上写偏移量
         char *WritePosition() { return Begin() + _writer_idx; }
         //获取当前读取起始地址
         char *ReadPosition() { return Begin() + _reader_idx; }
         //获取缓冲区末尾空闲空间大小--写偏移之后的空闲空间, 总体空间大小减去写偏移
-        uint64_t TailIdleSize() { return _buffer.size() - _writer_idx; }
+        //环形模式下所有空闲空间都紧跟在写位置之后
+        uint64_t TailIdleSize() { return _ring ? _capacity - ReadAbleSize() : _capacity - _writer_idx; }
         //获取缓冲区起始空闲空间大小--读偏移之前的空闲空间
-        uint64_t HeadIdleSize() { return _reader_idx; }
+        uint64_t HeadIdleSize() { return _ring ? 0 : _reader_idx; }
         //获取可读数据大小 = 写偏移 - 读偏移
         uint64_t ReadAbleSize() { return _writer_idx - _reader_idx; }
         //将读偏移向后移动
@@ -66,6 +413,11 @@ class Buffer {
             //向后移动的大小，必须小于可读数据大小
             assert(len <= ReadAbleSize());
             _reader_idx += len;
+            //环形模式下读偏移越过第一份映射后，两个偏移一起退回一圈，数据在第二份映射中的位置和第一份中是同一块内存
+            if (_ring && _reader_idx >= _capacity) {
+                _reader_idx -= _capacity;
+                _writer_idx -= _capacity;
+            }
         }
         //将写偏移向后移动 
         void MoveWriteOffset(uint64_t len) {
@@ -77,7 +429,11 @@ class Buffer {
         void EnsureWriteSpace(uint64_t len) {
             //如果末尾空闲空间大小足够，直接返回
             if (TailIdleSize() >= len) { return; }
-            //末尾空闲空间不够，则判断加上起始位置的空闲空间大小是否足够, 够了就将数据移动到起始位置
+            //还没有分配空间，第一次写入时分配
+            if (_data == NULL) {
+                return MoveTo(std::max<uint64_t>(len, _ring ? RING_BUFFER_DEFAULT_SIZE : BUFFER_DEFAULT_SIZE));
+            }
+            //末尾空闲空间不够（环形模式下起始空闲空间总是0，直接扩容），则判断加上起始位置的空闲空间大小是否足够, 够了就将数据移动到起始位置
             if (len <= TailIdleSize() + HeadIdleSize()) {
                 //将数据移动到起始位置
                 uint64_t rsz = ReadAbleSize();//把当前数据大小先保存起来
@@ -85,9 +441,10 @@ class Buffer {
                 _reader_idx = 0;    //将读偏移归0
                 _writer_idx = rsz;  //将写位置置为可读数据大小， 因为当前的可读数据大小就是写偏移量
             }else {
-                //总体空间不够，则需要扩容，不移动数据，直接给写偏移之后扩容足够空间即可
-                DBG_LOG("RESIZE %ld", _writer_idx + len);
-                _buffer.resize(_writer_idx + len);
+                //总体空间不够，则需要扩容，从slab分配器获取更大级别的空间，只搬移可读数据，至少翻倍避免频繁扩容
+                uint64_t size = std::max(ReadAbleSize() + len, _capacity * 2);
+                DBG_LOG("RESIZE %ld", size);
+                MoveTo(size);
             }
         } 
         //写入数据
@@ -141,6 +498,7 @@ class Buffer {
             return str;
         }
         char *FindCRLF() {
+            if (ReadAbleSize() == 0) return NULL;
             char *res = (char*)memchr(ReadPosition(), '\n', ReadAbleSize());
             return res;
         }
@@ -158,12 +516,183 @@ class Buffer {
             MoveReadOffset(str.size());
             return str;
         }
+        /*以下接口返回指向缓冲区内部的视图，不拷贝数据，视图在缓冲区下一次写入、扩容、收缩或释放之前有效*/
+        //获取从读位置开始到delim（包含delim）的数据，找不到返回空视图
+        std::string_view PeekUntil(std::string_view delim) {
+            if (ReadAbleSize() == 0 || delim.empty()) return std::string_view();
+            const char *pos;
+            if (delim.size() == 1) pos = (const char *)memchr(ReadPosition(), delim[0], ReadAbleSize());
+            else pos = (const char *)memmem(ReadPosition(), ReadAbleSize(), delim.data(), delim.size());
+            if (pos == NULL) return std::string_view();
+            return std::string_view(ReadPosition(), pos - ReadPosition() + delim.size());
+        }
+        //获取一行数据（包含末尾的换行），不足一行返回空视图
+        std::string_view PeekLine() { return PeekUntil("\n"); }
+        //查找头部结束标记\r\n\r\n，返回标记的起始位置，找不到返回NULL
+        char *FindCRLFCRLF() {
+            char *pos = ReadPosition();
+            char *end = pos + ReadAbleSize();
+            if (end - pos < 4) return NULL;
+#ifdef __SSE2__
+            //每次比较16个起始位置：分别加载偏移0~3的16字节与\r\n\r\n逐字节比较，四个结果相与
+            const __m128i cr = _mm_set1_epi8('\r');
+            const __m128i lf = _mm_set1_epi8('\n');
+            for (; pos + 16 + 3 <= end; pos += 16) {
+                __m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)pos), cr);
+                __m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pos + 1)), lf);
+                __m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pos + 2)), cr);
+                __m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pos + 3)), lf);
+                int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(m0, m1), _mm_and_si128(m2, m3)));
+                if (mask != 0) return pos + __builtin_ctz(mask);
+            }
+#endif
+            for (; pos + 4 <= end; pos++) {
+                if (pos[0] == '\r' && pos[1] == '\n' && pos[2] == '\r' && pos[3] == '\n') return pos;
+            }
+            return NULL;
+        }
+        //取走len字节数据，返回这部分数据的视图
+        std::string_view ConsumeView(uint64_t len) {
+            assert(len <= ReadAbleSize());
+            std::string_view view(ReadPosition(), len);
+            MoveReadOffset(len);
+            return view;
+        }
         //清空缓冲区
         void Clear() {
             //只需要将偏移量归0即可
             _reader_idx = 0;
             _writer_idx = 0;
         }
+        //当前占用的空间大小
+        uint64_t Capacity() { return _capacity; }
+        //数据已经全部读取时把空间还给slab分配器（所属线程的arena），下次写入时再重新获取
+        //环形空间的映射和解除映射都是系统调用，不在每次处理完数据后释放，只在Shrink或析构时释放
+        void Release() {
+            if (ReadAbleSize() > 0 || _data == NULL || _ring) return;
+            FreeSpace();
+        }
+        //占用的空间超过size时，把数据搬到刚好够用的空间中，释放原来的大块空间
+        void Shrink(uint64_t size) {
+            if (_capacity <= size) return;
+            if (ReadAbleSize() == 0) return FreeSpace();
+            MoveTo(std::max<uint64_t>(ReadAbleSize(), _ring ? RING_BUFFER_DEFAULT_SIZE : BUFFER_DEFAULT_SIZE));
+        }
+};
+
+/*不可修改的共享数据片段：多个连接发送同一份数据时共享同一块内存，只增加引用计数，不拷贝数据*/
+class Slice {
+    private:
+        std::shared_ptr<const std::string> _data;
+        size_t _offset; //片段在_data中的起始位置
+        size_t _len;    //片段长度
+    public:
+        Slice():_offset(0), _len(0) {}
+        //拷贝一次数据，之后所有的Slice共享这份数据
+        Slice(const char *data, size_t len):_data(std::make_shared<const std::string>(data, len)), _offset(0), _len(len) {}
+        explicit Slice(std::string &&data):_offset(0), _len(data.size()) {
+            _data = std::make_shared<const std::string>(std::move(data));
+        }
+        const char *Data() const { return _len == 0 ? NULL : _data->data() + _offset; }
+        size_t Size() const { return _len; }
+        bool Empty() const { return _len == 0; }
+        //跳过起始的len字节
+        void Advance(size_t len) {
+            assert(len <= _len);
+            _offset += len;
+            _len -= len;
+        }
+};
+
+/*发送缓冲区：拷贝进来的数据放在Buffer中，共享的Slice只保存引用，按写入顺序发送*/
+/*每个Slice记录插入时Buffer累计写入的字节数，发送时按这个位置把Buffer的数据和Slice交错组织成iovec*/
+#define OUT_BUFFER_MAX_IOV 64
+class OutBuffer {
+    private:
+        struct SliceItem {
+            uint64_t _pos;  //插入时_buf累计写入的字节数，这个位置之前的Buffer数据要先于该Slice发送
+            Slice _slice;
+        };
+        Buffer _buf;                    //拷贝进来的数据
+        uint64_t _buf_written;          //_buf累计写入的字节数
+        uint64_t _buf_consumed;         //_buf累计发送的字节数
+        std::deque<SliceItem> _slices;  //引用的共享数据
+        uint64_t _slice_bytes;          //所有Slice中未发送的字节数
+    public:
+        OutBuffer():_buf_written(0), _buf_consumed(0), _slice_bytes(0) {}
+        uint64_t ReadAbleSize() { return _buf.ReadAbleSize() + _slice_bytes; }
+        //其中以共享片段方式引用、没有拷贝的字节数
+        uint64_t SliceSize() { return _slice_bytes; }
+        //接下来要分多次写入len字节时，预先准备好空间，避免中途扩容搬移数据
+        void EnsureWriteSpace(uint64_t len) { _buf.EnsureWriteSpace(len); }
+        void WriteAndPush(const void *data, uint64_t len) {
+            _buf.WriteAndPush(data, len);
+            _buf_written += len;
+        }
+        void WriteBufferAndPush(Buffer &data) {
+            WriteAndPush(data.ReadPosition(), data.ReadAbleSize());
+        }
+        void WriteSlice(const Slice &slice) {
+            if (slice.Empty()) return;
+            _slices.push_back(SliceItem{_buf_written, slice});
+            _slice_bytes += slice.Size();
+        }
+        //按发送顺序组织待发送数据，返回iovec的数量
+        int Gather(struct iovec *iov, int max) {
+            int cnt = 0;
+            uint64_t pos = _buf_consumed;
+            char *start = _buf.ReadPosition();
+            for (auto &item : _slices) {
+                if (cnt >= max) return cnt;
+                if (item._pos > pos) {
+                    iov[cnt].iov_base = start + (pos - _buf_consumed);
+                    iov[cnt].iov_len = item._pos - pos;
+                    cnt++;
+                    pos = item._pos;
+                    if (cnt >= max) return cnt;
+                }
+                iov[cnt].iov_base = (void*)item._slice.Data();
+                iov[cnt].iov_len = item._slice.Size();
+                cnt++;
+            }
+            if (cnt < max && _buf_written > pos) {
+                iov[cnt].iov_base = start + (pos - _buf_consumed);
+                iov[cnt].iov_len = _buf_written - pos;
+                cnt++;
+            }
+            return cnt;
+        }
+        //移除已经发送的len字节，按发送顺序依次从Buffer和Slice中扣除
+        void MoveReadOffset(uint64_t len) {
+            assert(len <= ReadAbleSize());
+            while (len > 0) {
+                uint64_t buf_len = _slices.empty() ? _buf_written - _buf_consumed : _slices.front()._pos - _buf_consumed;
+                if (buf_len > 0) {
+                    uint64_t n = std::min(len, buf_len);
+                    _buf.MoveReadOffset(n);
+                    _buf_consumed += n;
+                    len -= n;
+                    continue;
+                }
+                Slice &slice = _slices.front()._slice;
+                uint64_t n = std::min<uint64_t>(len, slice.Size());
+                slice.Advance(n);
+                _slice_bytes -= n;
+                len -= n;
+                if (slice.Empty()) _slices.pop_front();
+            }
+        }
+        void Clear() {
+            _buf.Clear();
+            _buf_written = 0;
+            _buf_consumed = 0;
+            _slices.clear();
+            _slice_bytes = 0;
+        }
+        uint64_t Capacity() { return _buf.Capacity(); }
+        void Release() { _buf.Release(); }
+        void Shrink(uint64_t size) { _buf.Shrink(size); }
+        void EnableRing(bool enable) { _buf.EnableRing(enable); }
 };
 
 #define MAX_LISTEN 1024
@@ -175,6 +704,8 @@ class Socket {
         Socket(int fd): _sockfd(fd) {}
         ~Socket() { Close(); }
         int Fd() { return _sockfd; }
+        //关闭原有描述符，管理新的描述符--连接对象复用时使用
+        void Reset(int fd) { Close(); _sockfd = fd; }
         //创建套接字
         bool Create() {
             // int socket(int domain, int type, int protocol)
@@ -270,6 +801,23 @@ class Socket {
             if (len == 0) return 0;
             return Send(buf, len, MSG_DONTWAIT); // MSG_DONTWAIT 表示当前发送为非阻塞。
         }
+        //一次发送多块不连续的数据
+        ssize_t NonBlockSendv(struct iovec *iov, int cnt) {
+            if (cnt == 0) return 0;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = cnt;
+            ssize_t ret = sendmsg(_sockfd, &msg, MSG_DONTWAIT);
+            if (ret < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    return 0;
+                }
+                ERR_LOG("SOCKET SEND FAILED!!");
+                return -1;
+            }
+            return ret;
+        }
         //关闭套接字
         void Close() {
             if (_sockfd != -1) {
@@ -282,9 +830,9 @@ class Socket {
             //1. 创建套接字，2. 绑定地址，3. 开始监听，4. 设置非阻塞， 5. 启动地址重用
             if (Create() == false) return false;
             if (block_flag) NonBlock();
+            ReuseAddress();//地址重用必须在绑定之前设置才有效
             if (Bind(ip, port) == false) return false;
             if (Listen() == false) return false;
-            ReuseAddress();
             return true;
         }
         //创建一个客户端连接
@@ -294,13 +842,12 @@ class Socket {
             if (Connect(ip, port) == false) return false;
             return true;
         }
-        //设置套接字选项---开启地址端口重用
+        //设置套接字选项---开启地址重用，服务器重启时可以立即绑定处于TIME_WAIT的端口
+        //不开启端口重用（SO_REUSEPORT）：同一个端口上已经有服务器在监听时，绑定应当失败，而不是和它分摊连接
         void ReuseAddress() {
             // int setsockopt(int fd, int leve, int optname, void *val, int vallen)
             int val = 1;
             setsockopt(_sockfd, SOL_SOCKET, SO_REUSEADDR, (void*)&val, sizeof(int));
-            val = 1;
-            setsockopt(_sockfd, SOL_SOCKET, SO_REUSEPORT, (void*)&val, sizeof(int));
         }
         //设置套接字阻塞属性-- 设置为非阻塞
         void NonBlock() {
@@ -327,6 +874,8 @@ class Channel {
     public:
         Channel(EventLoop *loop, int fd):_fd(fd), _events(0), _revents(0), _loop(loop) {}
         int Fd() { return _fd; }
+        //更换管理的描述符，保留设置好的回调函数--连接对象复用时使用，调用前必须已经移除了监控
+        void Reset(int fd) { _fd = fd; _events = 0; _revents = 0; }
         uint32_t Events() { return _events; }//获取想要监控的事件
         void SetREvents(uint32_t events) { _revents = events; }//设置实际就绪的事件
         void SetReadCallback(const EventCallback &cb) { _read_callback = cb; }
@@ -423,9 +972,10 @@ class Poller {
             Update(channel, EPOLL_CTL_DEL);
         }
         //开始监控，返回活跃连接
-        void Poll(std::vector<Channel*> *active) {
+        //timeout为-1表示阻塞等待，0表示不等待
+        void Poll(std::vector<Channel*> *active, int timeout = -1) {
             // int epoll_wait(int epfd, struct epoll_event *evs, int maxevents, int timeout)
-            int nfds = epoll_wait(_epfd, _evs, MAX_EPOLLEVENTS, -1);
+            int nfds = epoll_wait(_epfd, _evs, MAX_EPOLLEVENTS, timeout);
             if (nfds < 0) {
                 if (errno == EINTR) {
                     return ;
@@ -444,8 +994,88 @@ class Poller {
 };
 
 
-using TaskFunc = std::function<void()>;
-using ReleaseFunc = std::function<void()>;
+/*只能移动的函数对象：可调用对象不超过N字节时直接放在内部，不需要动态分配，超过N字节才在堆上分配*/
+/*任务压入队列时只移动一次，捕获的对象不会被拷贝*/
+template<class Sig, size_t N> class InplaceFunction;
+template<class R, class ...Args, size_t N>
+class InplaceFunction<R(Args...), N> {
+    private:
+        static_assert(N >= sizeof(void *), "inline storage must hold at least a pointer");
+        //每种可调用对象一张操作表
+        struct Ops {
+            R (*_invoke)(void *storage, Args &&...args);
+            void (*_move)(void *dst, void *src);//移动之后src中的对象已经析构
+            void (*_destroy)(void *storage);
+        };
+        template<class F>
+        static constexpr bool Inline() {
+            return sizeof(F) <= N && alignof(F) <= alignof(void *) &&
+                   std::is_nothrow_move_constructible<F>::value;
+        }
+        template<class F>
+        struct InlineOps {
+            static F *Get(void *storage) { return (F *)storage; }
+            static R Invoke(void *storage, Args &&...args) { return (*Get(storage))(std::forward<Args>(args)...); }
+            static void Move(void *dst, void *src) {
+                new (dst) F(std::move(*Get(src)));
+                Get(src)->~F();
+            }
+            static void Destroy(void *storage) { Get(storage)->~F(); }
+            static constexpr Ops _ops = { Invoke, Move, Destroy };
+        };
+        template<class F>
+        struct HeapOps {
+            static F *&Get(void *storage) { return *(F **)storage; }
+            static R Invoke(void *storage, Args &&...args) { return (*Get(storage))(std::forward<Args>(args)...); }
+            static void Move(void *dst, void *src) { Get(dst) = Get(src); }
+            static void Destroy(void *storage) { delete Get(storage); }
+            static constexpr Ops _ops = { Invoke, Move, Destroy };
+        };
+
+        //按指针对齐，避免按最大对齐方式填充浪费空间，对齐要求更高的可调用对象放到堆上
+        alignas(void *) unsigned char _storage[N];
+        const Ops *_ops;    //为NULL表示没有保存可调用对象
+    public:
+        InplaceFunction():_ops(NULL) {}
+        InplaceFunction(std::nullptr_t):_ops(NULL) {}
+        template<class F, class D = typename std::decay<F>::type,
+                 class = typename std::enable_if<!std::is_same<D, InplaceFunction>::value>::type>
+        InplaceFunction(F &&f) {
+            if constexpr (Inline<D>()) {
+                new (_storage) D(std::forward<F>(f));
+                _ops = &InlineOps<D>::_ops;
+            }else {
+                *(D **)_storage = new D(std::forward<F>(f));
+                _ops = &HeapOps<D>::_ops;
+            }
+        }
+        InplaceFunction(InplaceFunction &&other) noexcept :_ops(other._ops) {
+            if (_ops) _ops->_move(_storage, other._storage);
+            other._ops = NULL;
+        }
+        InplaceFunction &operator=(InplaceFunction &&other) noexcept {
+            if (this == &other) return *this;
+            if (_ops) _ops->_destroy(_storage);
+            _ops = other._ops;
+            if (_ops) _ops->_move(_storage, other._storage);
+            other._ops = NULL;
+            return *this;
+        }
+        InplaceFunction(const InplaceFunction &) = delete;
+        InplaceFunction &operator=(const InplaceFunction &) = delete;
+        ~InplaceFunction() { if (_ops) _ops->_destroy(_storage); }
+        explicit operator bool() const { return _ops != NULL; }
+        R operator()(Args ...args) {
+            assert(_ops != NULL);
+            return _ops->_invoke(_storage, std::forward<Args>(args)...);
+        }
+};
+
+//定时任务和EventLoop任务池中任务的内部存储大小：常见的std::bind(成员函数, shared_ptr/this, 参数)都不需要动态分配
+#define TIMER_TASK_INLINE_SIZE 32
+#define LOOP_TASK_INLINE_SIZE 64
+using TaskFunc = InplaceFunction<void(), TIMER_TASK_INLINE_SIZE>;
+using ReleaseFunc = InplaceFunction<void(), TIMER_TASK_INLINE_SIZE>;
 class TimerTask{
     private:
         uint64_t _id;       // 定时器任务对象ID
@@ -454,14 +1084,14 @@ class TimerTask{
         TaskFunc _task_cb;  //定时器对象要执行的定时任务
         ReleaseFunc _release; //用于删除TimerWheel中保存的定时器对象信息
     public:
-        TimerTask(uint64_t id, uint32_t delay, const TaskFunc &cb): 
-            _id(id), _timeout(delay), _task_cb(cb), _canceled(false) {}
+        TimerTask(uint64_t id, uint32_t delay, TaskFunc &&cb): 
+            _id(id), _timeout(delay), _canceled(false), _task_cb(std::move(cb)) {}
         ~TimerTask() { 
             if (_canceled == false) _task_cb(); 
             _release(); 
         }
         void Cancel() { _canceled = true; }
-        void SetRelease(const ReleaseFunc &cb) { _release = cb; }
+        void SetRelease(ReleaseFunc &&cb) { _release = std::move(cb); }
         uint32_t DelayTime() { return _timeout; }
 };
 
@@ -521,9 +1151,11 @@ class TimerWheel {
             for (int i = 0; i < times; i++) {
                 RunTimerTask();
             }
+            //顺便收缩本线程缓冲区空间中多余的空闲大块
+            SlabAllocator::Trim();
         }
-        void TimerAddInLoop(uint64_t id, uint32_t delay, const TaskFunc &cb) {
-            PtrTask pt(new TimerTask(id, delay, cb));
+        void TimerAddInLoop(uint64_t id, uint32_t delay, TaskFunc &&cb) {
+            PtrTask pt(new TimerTask(id, delay, std::move(cb)));
             pt->SetRelease(std::bind(&TimerWheel::RemoveTimer, this, id));
             int pos = (_tick + delay) % _capacity;
             _wheel[pos].push_back(pt);
@@ -556,7 +1188,7 @@ class TimerWheel {
         }
         /*定时器中有个_timers成员，定时器信息的操作有可能在多线程中进行，因此需要考虑线程安全问题*/
         /*如果不想加锁，那就把对定期的所有操作，都放到一个线程中进行*/
-        void TimerAdd(uint64_t id, uint32_t delay, const TaskFunc &cb);
+        void TimerAdd(uint64_t id, uint32_t delay, TaskFunc &&cb);
         //刷新/延迟定时任务
         void TimerRefresh(uint64_t id);
         void TimerCancel(uint64_t id);
@@ -570,27 +1202,35 @@ class TimerWheel {
         }
 };
 
+class Connection;
+using PtrConnection = std::shared_ptr<Connection>;
 class EventLoop {
     private:
-        using Functor = std::function<void()>;
+        using Functor = InplaceFunction<void(), LOOP_TASK_INLINE_SIZE>;
         std::thread::id _thread_id;//线程ID
         int _event_fd;//eventfd唤醒IO事件监控有可能导致的阻塞
         std::unique_ptr<Channel> _event_channel;
         Poller _poller;//进行所有描述符的事件监控
         std::vector<Functor> _tasks;//任务池
+        std::vector<Functor> _running;//正在执行的任务，与任务池交换，执行完清空后保留空间，下一轮不需要重新分配
         std::mutex _mutex;//实现任务池操作的线程安全
         TimerWheel _timer_wheel;//定时器模块
+        /*本线程负责的所有连接，只在本线程中插入和移除，不需要跨线程投递任务，也不需要加锁*/
+        /*其他线程按ID查找连接使用的是TcpServer中的ConnectionTable*/
+        std::unordered_map<uint64_t, PtrConnection> _conns;
+        std::vector<PtrConnection> _flush_list; //cork模式下本轮循环中有数据待发送的连接
+        std::vector<PtrConnection> _ready_list; //本轮处理配额用完、还有数据待处理的连接，下一轮继续处理
     public:
         //执行任务池中的所有任务
         void RunAllTask() {
-            std::vector<Functor> functor;
             {
                 std::unique_lock<std::mutex> _lock(_mutex);
-                _tasks.swap(functor);
+                _tasks.swap(_running);
             }
-            for (auto &f : functor) {
+            for (auto &f : _running) {
                 f();
             }
+            _running.clear();
             return ;
         }
         static int CreateEventFd() {
@@ -639,15 +1279,22 @@ class EventLoop {
         //三步走--事件监控-》就绪事件处理-》执行任务
         void Start() {
             while(1) {
-                //1. 事件监控， 
+                //上一轮配额用完的连接，排在本轮的就绪事件之后继续处理，避免一个连接独占线程
+                std::vector<PtrConnection> ready;
+                ready.swap(_ready_list);
+                //1. 事件监控，有连接等待继续处理时不阻塞
                 std::vector<Channel *> actives;
-                _poller.Poll(&actives);
+                _poller.Poll(&actives, ready.empty() ? -1 : 0);
                 //2. 事件处理。 
                 for (auto &channel : actives) {
                     channel->HandleEvent();
                 }
-                //3. 执行任务
+                //3. 继续处理上一轮没有处理完的连接
+                RunReady(ready);
+                //4. 执行任务
                 RunAllTask();
+                //5. 发送cork模式的连接在本轮循环中缓存的数据
+                FlushPending();
             }
         }
         //用于判断当前线程是否是EventLoop对应的线程；
@@ -658,17 +1305,21 @@ class EventLoop {
             assert(_thread_id == std::this_thread::get_id());
         }
         //判断将要执行的任务是否处于当前线程中，如果是则执行，不是则压入队列。
-        void RunInLoop(const Functor &cb) {
+        //任务以完美转发的方式传入，在当前线程中直接执行时不构造Functor，压入队列时直接移动到任务池中
+        template<class F>
+        void RunInLoop(F &&cb) {
             if (IsInLoop()) {
-                return cb();
+                cb();
+                return;
             }
-            return QueueInLoop(cb);
+            return QueueInLoop(std::forward<F>(cb));
         }
         //将操作压入任务池
-        void QueueInLoop(const Functor &cb) {
+        template<class F>
+        void QueueInLoop(F &&cb) {
             {
                 std::unique_lock<std::mutex> _lock(_mutex);
-                _tasks.push_back(cb);
+                _tasks.emplace_back(std::forward<F>(cb));
             }
             //唤醒有可能因为没有事件就绪，而导致的epoll阻塞；
             //其实就是给eventfd写入一个数据，eventfd就会触发可读事件
@@ -678,10 +1329,25 @@ class EventLoop {
         void UpdateEvent(Channel *channel) { return _poller.UpdateEvent(channel); }
         //移除描述符的监控
         void RemoveEvent(Channel *channel) { return _poller.RemoveEvent(channel); }
-        void TimerAdd(uint64_t id, uint32_t delay, const TaskFunc &cb) { return _timer_wheel.TimerAdd(id, delay, cb); }
+        void TimerAdd(uint64_t id, uint32_t delay, TaskFunc &&cb) { return _timer_wheel.TimerAdd(id, delay, std::move(cb)); }
         void TimerRefresh(uint64_t id) { return _timer_wheel.TimerRefresh(id); }
         void TimerCancel(uint64_t id) { return _timer_wheel.TimerCancel(id); }
         bool HasTimer(uint64_t id) { return _timer_wheel.HasTimer(id); }
+        //登记cork模式下有数据待发送的连接，本轮循环结束时统一发送
+        void QueueFlush(const PtrConnection &conn) { _flush_list.push_back(conn); }
+        void FlushPending();
+        //登记处理配额用完、还有数据待处理的连接，下一轮循环中继续处理
+        void QueueReady(const PtrConnection &conn) { _ready_list.push_back(conn); }
+        void RunReady(std::vector<PtrConnection> &conns);
+        /*连接管理：只能在本线程中调用*/
+        void AddConnection(uint64_t id, const PtrConnection &conn) {
+            AssertInLoop();
+            _conns.insert(std::make_pair(id, conn));
+        }
+        void RemoveConnection(uint64_t id) {
+            AssertInLoop();
+            _conns.erase(id);
+        }
 };
 class LoopThread {
     private:
@@ -744,79 +1410,246 @@ class LoopThreadPool {
             _next_idx = (_next_idx + 1) % _thread_count;
             return _loops[_next_idx];
         }
+        //获取所有负责连接通信的EventLoop，没有从属线程时就是baseloop
+        std::vector<EventLoop *> AllLoops() {
+            if (_thread_count == 0) {
+                return std::vector<EventLoop *>(1, _baseloop);
+            }
+            return _loops;
+        }
 };
 
 
+/*通用容器：不超过ANY_INLINE_SIZE字节的对象直接放在容器内部，不需要动态分配，更大的对象才在堆上分配*/
+/*类型标识是每个类型一个静态变量的地址，编译期就确定，取出数据时只比较一次指针，不依赖RTTI*/
+#ifndef ANY_INLINE_SIZE
+#define ANY_INLINE_SIZE 448
+#endif
 class Any{
     private:
-        class holder {
-            public:
-                virtual ~holder() {}
-                virtual const std::type_info& type() = 0;
-                virtual holder *clone() = 0;
+        template<class T>
+        struct TypeTag { static constexpr char _id = 0; };
+        //每个类型一张操作表：类型标识以及析构、拷贝、移动操作
+        struct Ops {
+            const void *_type;
+            void (*_destroy)(Any &self);
+            void (*_copy)(Any &dst, const Any &src);
+            void (*_move)(Any &dst, Any &src);//移动之后src中的对象已经析构
         };
         template<class T>
-        class placeholder: public holder {
-            public:
-                placeholder(const T &val): _val(val) {}
-                // 获取子类对象保存的数据类型
-                virtual const std::type_info& type() { return typeid(T); }
-                // 针对当前的对象自身，克隆出一个新的子类对象
-                virtual holder *clone() { return new placeholder(_val); }
-            public:
-                T _val;
+        static constexpr bool Inline() {
+            return sizeof(T) <= ANY_INLINE_SIZE && alignof(T) <= alignof(std::max_align_t) &&
+                   std::is_nothrow_move_constructible<T>::value;
+        }
+        //数据放在容器内部
+        template<class T>
+        struct InlineOps {
+            static T *Get(const Any &self) { return (T *)self._storage; }
+            static void Destroy(Any &self) { Get(self)->~T(); }
+            static void Copy(Any &dst, const Any &src) { new (dst._storage) T(*Get(src)); }
+            static void Move(Any &dst, Any &src) {
+                new (dst._storage) T(std::move(*Get(src)));
+                Get(src)->~T();
+            }
+            static constexpr Ops _ops = { &TypeTag<T>::_id, Destroy, Copy, Move };
         };
-        holder *_content;
-    public:
-        Any():_content(NULL) {}
+        //数据在堆上，容器内部只保存指针
         template<class T>
-        Any(const T &val):_content(new placeholder<T>(val)) {}
-        Any(const Any &other):_content(other._content ? other._content->clone() : NULL) {}
-        ~Any() { delete _content; }
+        struct HeapOps {
+            static T *&Get(const Any &self) { return *(T **)self._storage; }
+            static void Destroy(Any &self) { delete Get(self); }
+            static void Copy(Any &dst, const Any &src) { Get(dst) = new T(*Get(src)); }
+            static void Move(Any &dst, Any &src) { Get(dst) = Get(src); }
+            static constexpr Ops _ops = { &TypeTag<T>::_id, Destroy, Copy, Move };
+        };
+        template<class T>
+        using OpsOf = typename std::conditional<Inline<T>(), InlineOps<T>, HeapOps<T>>::type;
+
+        alignas(std::max_align_t) unsigned char _storage[ANY_INLINE_SIZE];
+        const Ops *_ops;    //为NULL表示没有保存数据
+    public:
+        Any():_ops(NULL) {}
+        template<class T, class = typename std::enable_if<!std::is_same<typename std::decay<T>::type, Any>::value>::type>
+        Any(T &&val):_ops(NULL) { emplace<typename std::decay<T>::type>(std::forward<T>(val)); }
+        Any(const Any &other):_ops(other._ops) {
+            if (_ops) _ops->_copy(*this, other);
+        }
+        Any(Any &&other) noexcept :_ops(other._ops) {
+            if (_ops) _ops->_move(*this, other);
+            other._ops = NULL;
+        }
+        ~Any() { reset(); }
 
         Any &swap(Any &other) {
-            std::swap(_content, other._content);
+            Any tmp(std::move(other));
+            other = std::move(*this);
+            *this = std::move(tmp);
             return *this;
         }
-
-        // 返回子类对象保存的数据的指针
+        //释放保存的数据
+        void reset() {
+            if (_ops) _ops->_destroy(*this);
+            _ops = NULL;
+        }
+        bool empty() const { return _ops == NULL; }
+        //保存的是否是T类型的数据
+        template<class T>
+        bool is() const { return _ops && _ops->_type == &TypeTag<T>::_id; }
+        //释放原来的数据，用参数直接在容器中构造一个T类型的对象，不需要先构造临时对象再拷贝
+        template<class T, class ...Args>
+        T *emplace(Args &&...args) {
+            reset();
+            if constexpr (Inline<T>()) new (_storage) T(std::forward<Args>(args)...);
+            else *(T **)_storage = new T(std::forward<Args>(args)...);
+            _ops = &OpsOf<T>::_ops;
+            return get<T>();
+        }
+        // 返回保存的数据的指针
         template<class T>
         T *get() {
             //想要获取的数据类型，必须和保存的数据类型一致
-            assert(typeid(T) == _content->type());
-            return &((placeholder<T>*)_content)->_val;
+            assert(is<T>());
+            return OpsOf<T>::Get(*this);
         }
         //赋值运算符的重载函数
-        template<class T>
-        Any& operator=(const T &val) {
-            //为val构造一个临时的通用容器，然后与当前容器自身进行指针交换，临时对象释放的时候，原先保存的数据也就被释放
-            Any(val).swap(*this);
+        template<class T, class = typename std::enable_if<!std::is_same<typename std::decay<T>::type, Any>::value>::type>
+        Any& operator=(T &&val) {
+            emplace<typename std::decay<T>::type>(std::forward<T>(val));
             return *this;
         }
         Any& operator=(const Any &other) {
-            Any(other).swap(*this);
+            if (this != &other) *this = Any(other);
+            return *this;
+        }
+        Any& operator=(Any &&other) noexcept {
+            if (this == &other) return *this;
+            reset();
+            _ops = other._ops;
+            if (_ops) _ops->_move(*this, other);
+            other._ops = NULL;
             return *this;
         }
 };
 
-class Connection;
 //DISCONECTED -- 连接关闭状态；   CONNECTING -- 连接建立成功-待处理状态
 //CONNECTED -- 连接建立完成，各种设置已完成，可以通信的状态；  DISCONNECTING -- 待关闭状态
 typedef enum { DISCONNECTED, CONNECTING, CONNECTED, DISCONNECTING}ConnStatu;
-using PtrConnection = std::shared_ptr<Connection>;
+//暂停读取的原因：每个原因单独记录，所有原因都解除之后才恢复读事件监控，一个原因的恢复不会打断其他原因的暂停
+typedef enum {
+    PAUSE_BY_USER,          //业务调用PauseRead（比如HTTP等待异步响应、接收器处理不过来）
+    PAUSE_BY_WATER_MARK,    //自身待发送数据超过高水位线
+    PAUSE_BY_DOWNSTREAM,    //以本连接为上游的下游连接超过高水位线，可能有多个下游，按次数记录
+    PAUSE_REASON_COUNT
+}ReadPauseReason;
+/*跨线程发送数据的无锁收件箱：任意线程并发压入，只有连接所属的EventLoop线程取出*/
+/*每条数据只有一次内存分配，压入只是一次CAS，不需要加锁；共享的Slice也经过收件箱，保证同一个线程发送的数据顺序不变*/
+class SendInbox {
+    private:
+        struct Node {
+            Node *_next;
+            Slice _slice;   //不为空表示这是一个共享数据片段
+            size_t _len;    //拷贝进来的数据长度，数据紧跟在Node之后
+            Node():_next(NULL), _len(0) {}
+            char *Data() { return (char *)(this + 1); }
+        };
+        std::atomic<Node *> _head; //后压入的在前面，取出时反转链表恢复压入顺序
+    private:
+        //节点和数据一次分配；分配失败和new一样抛出std::bad_alloc，由发送数据的线程在调用处感知
+        static Node *NewNode(size_t len) {
+            void *mem = malloc(sizeof(Node) + len);
+            if (mem == NULL) {
+                ERR_LOG("SEND INBOX ALLOC %zu BYTES FAILED!", len);
+                throw std::bad_alloc();
+            }
+            return new (mem) Node();
+        }
+        //压入节点，返回压入之前收件箱是否为空
+        bool PushNode(Node *node) {
+            Node *head = _head.load(std::memory_order_relaxed);
+            do {
+                node->_next = head;
+            } while (_head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed) == false);
+            return head == NULL;
+        }
+    public:
+        SendInbox():_head(NULL) {}
+        ~SendInbox() { Clear(); }
+        //压入数据，返回压入之前收件箱是否为空，从空变为非空时调用者需要投递一次取出任务
+        bool Push(const char *data, size_t len) {
+            Node *node = NewNode(len);
+            node->_len = len;
+            memcpy(node->Data(), data, len);
+            return PushNode(node);
+        }
+        bool PushSlice(const Slice &slice) {
+            Node *node = NewNode(0);
+            node->_slice = slice;
+            return PushNode(node);
+        }
+        //按压入顺序取出所有数据放入发送缓冲区，out为NULL则直接丢弃
+        void PopAll(OutBuffer *out) {
+            Node *list = _head.exchange(NULL, std::memory_order_acquire);
+            Node *prev = NULL;
+            while (list) {
+                Node *next = list->_next;
+                list->_next = prev;
+                prev = list;
+                list = next;
+            }
+            while (prev) {
+                Node *next = prev->_next;
+                if (out) {
+                    if (prev->_slice.Empty()) out->WriteAndPush(prev->Data(), prev->_len);
+                    else out->WriteSlice(prev->_slice);
+                }
+                prev->~Node();
+                free(prev);
+                prev = next;
+            }
+        }
+        bool Empty() { return _head.load(std::memory_order_acquire) == NULL; }
+        void Clear() { PopAll(NULL); }
+};
+
+//发送缓冲区的高低水位线：待发送数据超过高水位线时通知使用者（可选择暂停读取），降到低水位线以下再恢复
+#define DEFAULT_HIGH_WATER_MARK (64 * 1024 * 1024)
+#define DEFAULT_LOW_WATER_MARK (16 * 1024 * 1024)
+#define DEFAULT_READ_BUDGET 65535
+#define BUFFER_SHRINK_SIZE (64 * 1024)           //缓冲区空间超过这个大小，空闲一段时间后收缩
+#define DEFAULT_BUFFER_SHRINK_DELAY 10           //大缓冲区空闲多少秒后收缩
 class Connection : public std::enable_shared_from_this<Connection> {
     private:
         uint64_t _conn_id;  // 连接的唯一ID，便于连接的管理和查找
         //uint64_t _timer_id;   //定时器ID，必须是唯一的，这块为了简化操作使用conn_id作为定时器ID
         int _sockfd;        // 连接关联的文件描述符
         bool _enable_inactive_release;  // 连接是否启动非活跃销毁的判断标志，默认为false
+        bool _recyclable;   // 连接释放后是否可以放回连接池复用，切换过协议的连接回调已经改变，不再复用
         EventLoop *_loop;   // 连接所关联的一个EventLoop
         ConnStatu _statu;   // 连接状态
         Socket _socket;     // 套接字操作管理
         Channel _channel;   // 连接的事件管理
         Buffer _in_buffer;  // 输入缓冲区---存放从socket中读取到的数据
-        Buffer _out_buffer; // 输出缓冲区---存放要发送给对端的数据
+        OutBuffer _out_buffer; // 输出缓冲区---存放要发送给对端的数据，可以引用共享的Slice
+        SendInbox _inbox;   // 其他线程发送的数据先放在这里，由连接所属线程一次性转入输出缓冲区
         Any _context;       // 请求的接收处理上下文
+        /*发送缓冲区背压控制*/
+        size_t _high_water_mark;    // 高水位线
+        size_t _low_water_mark;     // 低水位线
+        bool _above_high_water;     // 当前待发送数据是否处于高水位线之上（只在超过时通知一次，降到低水位线以下才重置）
+        bool _auto_pause_read;      // 超过高水位线时是否自动暂停读取
+        bool _cork;                 // cork模式：发送的数据先缓存，本轮事件循环结束时统一发送一次
+        /*公平调度：限制一个连接在一轮事件循环中读取的字节数和处理的消息数*/
+        size_t _read_budget;        // 每次读取的最大字节数
+        size_t _msg_budget;         // 每次调用消息回调最多处理的消息数，0表示不限制
+        size_t _msg_left;           // 本次调用剩余的消息配额
+        bool _budget_limited;       // 本次调用是否受配额限制（连接关闭前的处理不受限制）
+        bool _ready_queued;         // 是否已经登记到EventLoop的就绪队列中
+        int _shrink_delay;          // 大缓冲区空闲多长时间后收缩，单位秒
+        bool _flush_queued;         // 是否已经登记到EventLoop的待发送列表中
+        std::weak_ptr<Connection> _upstream; // 关联的上游连接，设置后暂停/恢复的是上游连接的读取，否则是自身
+        std::weak_ptr<Connection> _paused_target; // 超过高水位线时暂停了读取的连接，降下来时恢复的是同一个连接
+        int _read_pauses[PAUSE_REASON_COUNT];    // 每个原因的暂停次数，只在连接所属线程中修改
+        std::atomic<size_t> _out_bytes;      // 待发送数据量，可以在任意线程中获取
 
         /*这四个回调函数，是让服务器模块来设置的（其实服务器模块的处理回调也是组件使用者设置的）*/
         /*换句话说，这几个回调都是组件使用者使用的*/
@@ -824,10 +1657,16 @@ class Connection : public std::enable_shared_from_this<Connection> {
         using MessageCallback = std::function<void(const PtrConnection&, Buffer *)>;
         using ClosedCallback = std::function<void(const PtrConnection&)>;
         using AnyEventCallback = std::function<void(const PtrConnection&)>;
+        using HighWaterMarkCallback = std::function<void(const PtrConnection&, size_t)>;
+        using WriteCompleteCallback = std::function<void(const PtrConnection&)>;
         ConnectedCallback _connected_callback;
         MessageCallback _message_callback;
         ClosedCallback _closed_callback;
         AnyEventCallback _event_callback;
+        HighWaterMarkCallback _high_water_callback;     // 待发送数据超过高水位线时调用
+        WriteCompleteCallback _write_complete_callback; // 发送缓冲区中的数据全部发送完毕时调用
+        std::function<void()> _drain_task;              // 待发送数据降到低水位线时执行一次的任务
+        std::function<bool()> _raw_reader;              // 接管可读事件，由业务自己从描述符中读取
         /*组件内的连接关闭回调--组件内设置的，因为服务器组件内会把所有的连接管理起来，一旦某个连接要关闭*/
         /*就应该从管理的地方移除掉自己的信息*/
         ClosedCallback _server_closed_callback;
@@ -835,43 +1674,119 @@ class Connection : public std::enable_shared_from_this<Connection> {
         /*五个channel的事件回调函数*/
         //描述符可读事件触发后调用的函数，接收socket数据放到接收缓冲区中，然后调用_message_callback
         void HandleRead() {
+            //业务接管了读取（比如用splice把数据直接移动到文件），返回false表示交还给连接
+            if (_raw_reader) {
+                if (_raw_reader() == false) _raw_reader = nullptr;
+                return;
+            }
+            //已经在就绪队列中等待继续处理，并且积压的数据超过了读取配额，暂不读取，数据留在socket接收缓冲区中
+            if (_ready_queued && _in_buffer.ReadAbleSize() >= _read_budget) {
+                return;
+            }
             //1. 接收socket的数据，放到缓冲区
-            char buf[65536];
-            ssize_t ret = _socket.NonBlockRecv(buf, 65535);
-            if (ret < 0) {
-                //出错了,不能直接关闭连接
-                return ShutdownInLoop();
+            ssize_t ret;
+            if (_in_buffer.IsRing()) {
+                //环形缓冲区的空闲空间总是连续的，直接接收到缓冲区中，省去一次拷贝
+                size_t len = std::min<size_t>(_read_budget, 65535);
+                if (_in_buffer.TailIdleSize() == 0) _in_buffer.EnsureWriteSpace(len);
+                len = std::min<size_t>(len, _in_buffer.TailIdleSize());
+                ret = _socket.NonBlockRecv(_in_buffer.WritePosition(), len);
+                if (ret < 0) {
+                    return ShutdownInLoop();
+                }
+                _in_buffer.MoveWriteOffset(ret);
+            }else {
+                char buf[65536];
+                ret = _socket.NonBlockRecv(buf, std::min<size_t>(_read_budget, 65535));
+                if (ret < 0) {
+                    //出错了,不能直接关闭连接
+                    return ShutdownInLoop();
+                }
+                //这里的等于0表示的是没有读取到数据，而并不是连接断开了，连接断开返回的是-1
+                //将数据放入输入缓冲区,写入之后顺便将写偏移向后移动
+                _in_buffer.WriteAndPush(buf, ret);
             }
-            //这里的等于0表示的是没有读取到数据，而并不是连接断开了，连接断开返回的是-1
-            //将数据放入输入缓冲区,写入之后顺便将写偏移向后移动
-            _in_buffer.WriteAndPush(buf, ret);
-            //2. 调用message_callback进行业务处理
-            if (_in_buffer.ReadAbleSize() > 0) {
-                //shared_from_this--从当前对象自身获取自身的shared_ptr管理对象
-                return _message_callback(shared_from_this(), &_in_buffer);
+            //2. 调用message_callback进行业务处理，已经在就绪队列中的连接等轮到它时再处理
+            if (_in_buffer.ReadAbleSize() > 0 && _ready_queued == false) {
+                return ProcessInput();
+            }
+        }
+        //受消息配额限制地调用message_callback
+        void ProcessInput() {
+            _budget_limited = (_msg_budget > 0);
+            _msg_left = _msg_budget;
+            //shared_from_this--从当前对象自身获取自身的shared_ptr管理对象
+            _message_callback(shared_from_this(), &_in_buffer);
+            _budget_limited = false;
+            ReclaimBuffers();
+        }
+        //定时收缩大缓冲区的定时器ID，与非活跃连接释放的定时器ID区分开
+        uint64_t ShrinkTimerId() { return _conn_id | (1ULL << 63); }
+        //缓冲区中的数据处理完后：小空间直接归还给空间池；大空间暂时保留，避免频繁扩容，空闲一段时间后再收缩
+        void ReclaimBuffers() {
+            if (_statu == DISCONNECTED) return;//连接释放后由连接池或者析构函数回收
+            bool big = false;
+            if (_in_buffer.Capacity() > BUFFER_SHRINK_SIZE) big = true;
+            else _in_buffer.Release();
+            if (_out_buffer.Capacity() > BUFFER_SHRINK_SIZE) big = true;
+            else if (_out_buffer.ReadAbleSize() == 0) _out_buffer.Release();
+            if (big == false) return;
+            uint64_t id = ShrinkTimerId();
+            if (_loop->HasTimer(id)) {
+                return _loop->TimerRefresh(id);
             }
+            std::weak_ptr<Connection> weak = shared_from_this();
+            _loop->TimerAdd(id, _shrink_delay, [weak]() {
+                PtrConnection conn = weak.lock();
+                if (conn) conn->ShrinkBuffers();
+            });
+        }
+        //大缓冲区空闲超时：没有数据则释放空间，有数据则搬到刚好够用的空间中
+        void ShrinkBuffers() {
+            if (_statu == DISCONNECTED) return;
+            _in_buffer.Shrink(BUFFER_SHRINK_SIZE);
+            _out_buffer.Shrink(BUFFER_SHRINK_SIZE);
         }
         //描述符可写事件触发后调用的函数，将发送缓冲区中的数据进行发送
         void HandleWrite() {
-            //_out_buffer中保存的数据就是要发送的数据
-            ssize_t ret = _socket.NonBlockSend(_out_buffer.ReadPosition(), _out_buffer.ReadAbleSize());
-            if (ret < 0) {
-                //发送错误就该关闭连接了，
-                if (_in_buffer.ReadAbleSize() > 0) {
-                    _message_callback(shared_from_this(), &_in_buffer);
-                }
-                return Release();//这时候就是实际的关闭释放操作了。
+            if (FlushOutBuffer() == false) {
+                return WriteFailed();
             }
-            _out_buffer.MoveReadOffset(ret);//千万不要忘了，将读偏移向后移动
             if (_out_buffer.ReadAbleSize() == 0) {
                 _channel.DisableWrite();// 没有数据待发送了，关闭写事件监控
-                //如果当前是连接待关闭状态，则有数据，发送完数据释放连接，没有数据则直接释放
-                if (_statu == DISCONNECTING) {
-                    return Release();
-                }
+                return WriteDrained();
             }
             return;
         }
+        //将发送缓冲区中的数据写入socket，出错返回false
+        bool FlushOutBuffer() {
+            //_out_buffer中保存的数据就是要发送的数据，Buffer数据和Slice交错在一起，一次sendmsg发送
+            struct iovec iov[OUT_BUFFER_MAX_IOV];
+            int cnt = _out_buffer.Gather(iov, OUT_BUFFER_MAX_IOV);
+            ssize_t ret = _socket.NonBlockSendv(iov, cnt);
+            if (ret < 0) {
+                return false;
+            }
+            _out_buffer.MoveReadOffset(ret);//千万不要忘了，将读偏移向后移动
+            OutBufferShrinked();
+            return true;
+        }
+        void WriteFailed() {
+            //发送错误就该关闭连接了，
+            if (_in_buffer.ReadAbleSize() > 0) {
+                _message_callback(shared_from_this(), &_in_buffer);
+            }
+            return Release();//这时候就是实际的关闭释放操作了。
+        }
+        //发送缓冲区中的数据全部发送完毕
+        void WriteDrained() {
+            ReclaimBuffers();
+            if (_write_complete_callback) _write_complete_callback(shared_from_this());
+            //如果当前是连接待关闭状态，则有数据，发送完数据释放连接，没有数据则直接释放
+            if (_statu == DISCONNECTING) {
+                return Release();
+            }
+        }
         //描述符触发挂断事件
         void HandleClose() {
             /*一旦连接挂断了，套接字就什么都干不了了，因此有数据待处理就处理一下，完毕关闭连接*/
@@ -895,43 +1810,172 @@ class Connection : public std::enable_shared_from_this<Connection> {
             assert(_statu == CONNECTING);//当前的状态必须一定是上层的半连接状态
             _statu = CONNECTED;//当前函数执行完毕，则连接进入已完成连接状态
             // 一旦启动读事件监控就有可能会立即触发读事件，如果这时候启动了非活跃连接销毁
-            _channel.EnableRead();
+            // 连接建立之前已经有暂停读取的原因（比如上游关联的下游已经超过高水位线），则先不启动
+            if (ReadPaused() == false) _channel.EnableRead();
             if (_connected_callback) _connected_callback(shared_from_this());
         }
         //这个接口才是实际的释放接口
         void ReleaseInLoop() {
-            //1. 修改连接状态，将其置为DISCONNECTED
+            //释放操作有可能被重复压入任务池(比如超时销毁和对端关闭同时发生)，已经释放过就不再处理
+            if (_statu == DISCONNECTED) return;
+            //1. 修改连接状态，将其置为DISCONNECTED，收件箱中还没有转入的数据直接丢弃
             _statu = DISCONNECTED;
+            _inbox.Clear();
             //2. 移除连接的事件监控
             _channel.Remove();
             //3. 关闭描述符
             _socket.Close();
             //4. 如果当前定时器队列中还有定时销毁任务，则取消任务
             if (_loop->HasTimer(_conn_id)) CancelInactiveReleaseInLoop();
+            if (_loop->HasTimer(ShrinkTimerId())) _loop->TimerCancel(ShrinkTimerId());
+            //等待发送缓冲区降下来的任务也要执行，由任务自己判断连接已经关闭
+            if (_drain_task) RunDrainTask();
+            _raw_reader = nullptr;
+            //超过高水位线时暂停了上游的读取，本连接不会再降下来，解除这次暂停
+            _above_high_water = false;
+            ResumeBackpressureTarget();
             //5. 调用关闭回调函数，避免先移除服务器管理的连接信息导致Connection被释放，再去处理会出错，因此先调用用户的回调函数
             if (_closed_callback) _closed_callback(shared_from_this());
             //移除服务器内部管理的连接信息
             if (_server_closed_callback) _server_closed_callback(shared_from_this());
         }
         //这个接口并不是实际的发送接口，而只是把数据放到了发送缓冲区，启动了可写事件监控
-        void SendInLoop(Buffer &buf) {
+        void SendInLoop(const char *data, size_t len) {
+            DrainInbox();//先转入其他线程更早发送的数据，保证同一个线程发送的数据顺序不变
             if (_statu == DISCONNECTED) return ;
-            _out_buffer.WriteBufferAndPush(buf);
-            if (_channel.WriteAble() == false) {
-                _channel.EnableWrite();
+            _out_buffer.WriteAndPush(data, len);
+            OutBufferGrowed();
+            WantWrite();
+        }
+        void SendSliceInLoop(const Slice &slice) {
+            DrainInbox();
+            if (_statu == DISCONNECTED) return ;
+            _out_buffer.WriteSlice(slice);
+            OutBufferGrowed();
+            WantWrite();
+        }
+        //发送缓冲区中有了数据：普通模式启动写事件监控；cork模式登记到EventLoop，本轮循环结束时直接发送
+        void WantWrite() {
+            if (_channel.WriteAble()) return;//已经在等待可写事件了
+            if (_cork == false) {
+                return _channel.EnableWrite();
             }
+            if (_flush_queued) return;
+            _flush_queued = true;
+            _loop->QueueFlush(shared_from_this());
+        }
+        //直接发送发送缓冲区中的数据，发送不完再启动写事件监控
+        void TryFlush() {
+            //已经在等待可写事件了，交给HandleWrite发送
+            if (_statu == DISCONNECTED || _channel.WriteAble() || _out_buffer.ReadAbleSize() == 0) return;
+            if (FlushOutBuffer() == false) {
+                return WriteFailed();
+            }
+            if (_out_buffer.ReadAbleSize() == 0) {
+                return WriteDrained();
+            }
+            _channel.EnableWrite();
+        }
+        //把收件箱中的数据一次性转入发送缓冲区，连接已经释放则丢弃
+        //所有依赖发送顺序的操作（发送、关闭）在执行之前都要先调用，因为投递取出任务的线程在压入数据之后才投递任务，
+        //其他线程在这之间压入数据并投递的任务有可能先执行
+        void DrainInbox() {
+            if (_inbox.Empty()) return;
+            if (_statu == DISCONNECTED) return _inbox.Clear();
+            _inbox.PopAll(&_out_buffer);
+            OutBufferGrowed();
+        }
+        //收件箱从空变为非空时投递的任务：转入数据后直接发送一次，发送不完再启动写事件监控
+        void DrainInboxInLoop() {
+            DrainInbox();
+            TryFlush();
+        }
+        //待发送数据增加后，判断是否越过了高水位线
+        void OutBufferGrowed() {
+            size_t bytes = _out_buffer.ReadAbleSize();
+            _out_bytes.store(bytes, std::memory_order_relaxed);
+            if (_above_high_water || bytes < _high_water_mark) return;
+            _above_high_water = true;
+            if (_high_water_callback) _high_water_callback(shared_from_this(), bytes);
+            if (_auto_pause_read) PauseBackpressureTarget();
+        }
+        //待发送数据减少后，判断是否降到了低水位线以下
+        void OutBufferShrinked() {
+            size_t bytes = _out_buffer.ReadAbleSize();
+            _out_bytes.store(bytes, std::memory_order_relaxed);
+            if (_drain_task && bytes <= _low_water_mark) RunDrainTask();
+            if (_above_high_water == false || bytes > _low_water_mark) return;
+            _above_high_water = false;
+            ResumeBackpressureTarget();
+        }
+        //放到本轮事件循环的任务中执行，避免在发送的过程中重入发送接口
+        void RunDrainTask() {
+            _loop->QueueInLoop(std::move(_drain_task));
+            _drain_task = nullptr;
+        }
+        void WhenDrainedInLoop(const std::function<void()> &task) {
+            DrainInbox();
+            _drain_task = task;
+            if (_statu == DISCONNECTED || _out_buffer.ReadAbleSize() <= _low_water_mark) RunDrainTask();
+        }
+        //背压作用的连接：关联了上游连接，则暂停上游的读取，否则暂停自身的读取
+        //记录下暂停的是哪个连接，之后关联关系变化了也能恢复同一个连接
+        void PauseBackpressureTarget() {
+            PtrConnection upstream = _upstream.lock();
+            if (upstream == nullptr) {
+                _paused_target = shared_from_this();
+                return PauseReadInLoop(PAUSE_BY_WATER_MARK);
+            }
+            _paused_target = upstream;
+            upstream->_loop->RunInLoop(std::bind(&Connection::PauseReadInLoop, upstream, PAUSE_BY_DOWNSTREAM));
+        }
+        void ResumeBackpressureTarget() {
+            PtrConnection target = _paused_target.lock();
+            _paused_target.reset();
+            if (target == nullptr) return;
+            if (target.get() == this) return ResumeReadInLoop(PAUSE_BY_WATER_MARK);
+            target->_loop->RunInLoop(std::bind(&Connection::ResumeReadInLoop, target, PAUSE_BY_DOWNSTREAM));
+        }
+        void PauseReadInLoop(ReadPauseReason reason) {
+            if (reason == PAUSE_BY_DOWNSTREAM) _read_pauses[reason]++;
+            else _read_pauses[reason] = 1;
+            UpdateReadInLoop();
+        }
+        void ResumeReadInLoop(ReadPauseReason reason) {
+            if (_read_pauses[reason] == 0) return;
+            if (reason == PAUSE_BY_DOWNSTREAM) _read_pauses[reason]--;
+            else _read_pauses[reason] = 0;
+            UpdateReadInLoop();
+        }
+        bool ReadPaused() {
+            for (int i = 0; i < PAUSE_REASON_COUNT; i++) {
+                if (_read_pauses[i] > 0) return true;
+            }
+            return false;
+        }
+        //按照是否还有暂停的原因启动或关闭读事件监控，连接建立之前只记录原因
+        void UpdateReadInLoop() {
+            if (_statu != CONNECTED) return;
+            bool paused = ReadPaused();
+            if (paused && _channel.ReadAble()) _channel.DisableRead();
+            else if (paused == false && _channel.ReadAble() == false) _channel.EnableRead();
+        }
+        void ResumeInputInLoop() {
+            if (_statu != CONNECTED || _ready_queued) return;//在就绪队列中的连接轮到它时会继续处理
+            if (_in_buffer.ReadAbleSize() > 0) ProcessInput();
         }
         //这个关闭操作并非实际的连接释放操作，需要判断还有没有数据待处理，待发送
         void ShutdownInLoop() {
+            DrainInbox();
+            if (_statu == DISCONNECTED) return;
             _statu = DISCONNECTING;// 设置连接为半关闭状态
+            _budget_limited = false;//关闭之前剩余的数据全部处理，不受配额限制
             if (_in_buffer.ReadAbleSize() > 0) {
                 if (_message_callback) _message_callback(shared_from_this(), &_in_buffer);
             }
             //要么就是写入数据的时候出错关闭，要么就是没有待发送数据，直接关闭
             if (_out_buffer.ReadAbleSize() > 0) {
-                if (_channel.WriteAble() == false) {
-                    _channel.EnableWrite();
-                }
+                WantWrite();
             }
             if (_out_buffer.ReadAbleSize() == 0) {
                 Release();
@@ -964,11 +2008,16 @@ class Connection : public std::enable_shared_from_this<Connection> {
             _message_callback = msg;
             _closed_callback = closed;
             _event_callback = event;
+            _recyclable = false;
         }
     public:
         Connection(EventLoop *loop, uint64_t conn_id, int sockfd):_conn_id(conn_id), _sockfd(sockfd),
-            _enable_inactive_release(false), _loop(loop), _statu(CONNECTING), _socket(_sockfd),
-            _channel(loop, _sockfd) {
+            _enable_inactive_release(false), _recyclable(true), _loop(loop), _statu(CONNECTING), _socket(_sockfd),
+            _channel(loop, _sockfd), _high_water_mark(DEFAULT_HIGH_WATER_MARK), _low_water_mark(DEFAULT_LOW_WATER_MARK),
+            _above_high_water(false), _auto_pause_read(false), _cork(false),
+            _read_budget(DEFAULT_READ_BUDGET), _msg_budget(0), _msg_left(0), _budget_limited(false), _ready_queued(false),
+            _shrink_delay(DEFAULT_BUFFER_SHRINK_DELAY), _flush_queued(false), _out_bytes(0) {
+            memset(_read_pauses, 0, sizeof(_read_pauses));
             _channel.SetCloseCallback(std::bind(&Connection::HandleClose, this));
             _channel.SetEventCallback(std::bind(&Connection::HandleEvent, this));
             _channel.SetReadCallback(std::bind(&Connection::HandleRead, this));
@@ -976,14 +2025,50 @@ class Connection : public std::enable_shared_from_this<Connection> {
             _channel.SetErrorCallback(std::bind(&Connection::HandleError, this));
         }
         ~Connection() { DBG_LOG("RELEASE CONNECTION:%p", this); }
+        /*以下两个接口由连接池使用：连接释放后清理状态放回池中，保留缓冲区空间以及channel和使用者设置的回调函数*/
+        //清理上一个连接遗留的状态，必须在连接所属的EventLoop线程中，且连接已经释放之后调用
+        void Reset() {
+            _enable_inactive_release = false;
+            //连接放回连接池时缓冲区空间还给slab分配器
+            _in_buffer.Clear();
+            _in_buffer.Release();
+            _out_buffer.Clear();
+            _out_buffer.Release();
+            _inbox.Clear();
+            _context.reset();
+            _above_high_water = false;
+            _flush_queued = false;
+            _ready_queued = false;
+            _upstream.reset();
+            _paused_target.reset();
+            memset(_read_pauses, 0, sizeof(_read_pauses));
+            _drain_task = nullptr;
+            _raw_reader = nullptr;
+            _out_bytes.store(0, std::memory_order_relaxed);
+        }
+        //复用时绑定新的连接ID和描述符，重新进入CONNECTING状态
+        void Init(uint64_t conn_id, int sockfd) {
+            _conn_id = conn_id;
+            _sockfd = sockfd;
+            _statu = CONNECTING;
+            _socket.Reset(sockfd);
+            _channel.Reset(sockfd);
+        }
+        bool Recyclable() { return _recyclable; }
         //获取管理的文件描述符
         int Fd() { return _sockfd; }
         //获取连接ID
-        int Id() { return _conn_id; }
+        uint64_t Id() { return _conn_id; }
+        //获取连接所属的EventLoop
+        EventLoop *GetLoop() { return _loop; }
         //是否处于CONNECTED状态
         bool Connected() { return (_statu == CONNECTED); }
         //设置上下文--连接建立完成时进行调用
         void SetContext(const Any &context) { _context = context; }
+        void SetContext(Any &&context) { _context = std::move(context); }
+        //用参数直接在连接中构造上下文对象，返回对象的指针
+        template<class T, class ...Args>
+        T *EmplaceContext(Args &&...args) { return _context.emplace<T>(std::forward<Args>(args)...); }
         //获取上下文，返回的是指针
         Any *GetContext() { return &_context; }
         void SetConnectedCallback(const ConnectedCallback&cb) { _connected_callback = cb; }
@@ -991,32 +2076,128 @@ class Connection : public std::enable_shared_from_this<Connection> {
         void SetClosedCallback(const ClosedCallback&cb) { _closed_callback = cb; }
         void SetAnyEventCallback(const AnyEventCallback&cb) { _event_callback = cb; }
         void SetSrvClosedCallback(const ClosedCallback&cb) { _server_closed_callback = cb; }
+        void SetHighWaterMarkCallback(const HighWaterMarkCallback&cb) { _high_water_callback = cb; }
+        void SetWriteCompleteCallback(const WriteCompleteCallback&cb) { _write_complete_callback = cb; }
+        //设置发送缓冲区的高低水位线，连接建立之前设置
+        void SetWaterMarks(size_t high, size_t low) { _high_water_mark = high; _low_water_mark = low; }
+        //超过高水位线时是否自动暂停读取，降到低水位线以下自动恢复
+        void SetAutoPauseRead(bool enable) { _auto_pause_read = enable; }
+        //启用cork模式，连接建立之前设置：一轮事件循环中多次发送的数据合并成一次写入，
+        //只有内核发送缓冲区满了写不完时才启动写事件监控
+        void SetCork(bool enable) { _cork = enable; }
+        //设置大缓冲区空闲多少秒后收缩，连接建立之前设置
+        void SetBufferShrinkDelay(int sec) { _shrink_delay = sec; }
+        //输入输出缓冲区使用环形模式，适合持续的流式数据，连接建立之前设置
+        void SetRingBuffer(bool enable) { _in_buffer.EnableRing(enable); _out_buffer.EnableRing(enable); }
+        //设置公平调度的配额：每次最多读取bytes字节，每次调用消息回调最多处理msgs条消息（0表示不限制），连接建立之前设置
+        void SetReadBudget(size_t bytes, size_t msgs) { _read_budget = bytes > 0 ? bytes : DEFAULT_READ_BUDGET; _msg_budget = msgs; }
+        //业务在消息回调中每处理完一条消息（已经从缓冲区中取走）调用一次，返回false表示配额用完，
+        //业务应当停止处理直接返回，剩余的数据会在下一轮事件循环中再次调用消息回调处理
+        bool ConsumeMessageBudget() {
+            if (_budget_limited == false) return true;
+            if (--_msg_left > 0) return true;
+            _budget_limited = false;
+            if (_in_buffer.ReadAbleSize() > 0 && _ready_queued == false) {
+                _ready_queued = true;
+                _loop->QueueReady(shared_from_this());
+            }
+            return false;
+        }
+        //由EventLoop在下一轮循环中调用，继续处理缓冲区中剩余的数据
+        void ResumeReady() {
+            _ready_queued = false;
+            if (_statu != CONNECTED) return;
+            if (_in_buffer.ReadAbleSize() > 0) ProcessInput();
+        }
+        //cork模式下由EventLoop在本轮循环结束时调用
+        void FlushCorked() {
+            _flush_queued = false;
+            TryFlush();
+        }
+        //关联上游连接：比如代理/转发场景，本连接发送的数据来自上游连接，背压时暂停的是上游连接的读取
+        void SetUpstream(const PtrConnection &upstream) { _upstream = upstream; }
+        //接管可读事件：之后描述符可读时直接调用reader，不再接收到输入缓冲区中，也不调用消息回调；
+        //reader返回false后交还给连接，恢复正常的接收。必须在连接所属线程中，并且输入缓冲区中的数据已经处理完时调用
+        void SetRawReader(const std::function<bool()> &reader) {
+            _loop->AssertInLoop();
+            _raw_reader = reader;
+        }
+        //待发送数据量，可以在任意线程中调用
+        size_t OutboundBytes() { return _out_bytes.load(std::memory_order_relaxed); }
+        size_t HighWaterMark() { return _high_water_mark; }
+        //待发送数据降到低水位线以下（已经在低水位线以下则是立即）时，在连接所属线程中执行一次task，
+        //用于生产者在任意线程中等待发送缓冲区腾出空间；只保留最后设置的一个任务，连接释放时也会执行
+        void WhenDrained(const std::function<void()> &task) {
+            _loop->RunInLoop(std::bind(&Connection::WhenDrainedInLoop, shared_from_this(), task));
+        }
+        //暂停/恢复读事件监控，数据留在socket接收缓冲区中，由TCP流控限制对端的发送
+        //只解除业务自己的暂停，高水位线等其他原因造成的暂停仍然有效
+        void PauseRead() {
+            _loop->RunInLoop(std::bind(&Connection::PauseReadInLoop, shared_from_this(), PAUSE_BY_USER));
+        }
+        void ResumeRead() {
+            _loop->RunInLoop(std::bind(&Connection::ResumeReadInLoop, shared_from_this(), PAUSE_BY_USER));
+        }
+        //业务暂停了消息处理（比如等待异步操作完成）之后，重新处理输入缓冲区中剩余的数据
+        void ResumeInput() {
+            _loop->RunInLoop(std::bind(&Connection::ResumeInputInLoop, shared_from_this()));
+        }
         //连接建立就绪后，进行channel回调设置，启动读监控，调用_connected_callback
         void Established() {
-            _loop->RunInLoop(std::bind(&Connection::EstablishedInLoop, this));
+            _loop->RunInLoop(std::bind(&Connection::EstablishedInLoop, shared_from_this()));
         }
         //发送数据，将数据放到发送缓冲区，启动写事件监控
         void Send(const char *data, size_t len) {
-            //外界传入的data，可能是个临时的空间，我们现在只是把发送操作压入了任务池，有可能并没有被立即执行
-            //因此有可能执行的时候，data指向的空间有可能已经被释放了。
-            Buffer buf;
-            buf.WriteAndPush(data, len);
-            _loop->RunInLoop(std::bind(&Connection::SendInLoop, this, std::move(buf)));
+            if (_loop->IsInLoop()) {
+                return SendInLoop(data, len);
+            }
+            //外界传入的data，可能是个临时的空间，发送操作有可能并没有被立即执行，因此要把数据拷贝到收件箱中
+            //收件箱从空变为非空时才投递一次任务唤醒EventLoop，之后压入的数据由同一个任务一起转入发送缓冲区
+            if (_inbox.Push(data, len)) {
+                _loop->QueueInLoop(std::bind(&Connection::DrainInboxInLoop, shared_from_this()));
+            }
+        }
+        //在连接所属线程中由fill把数据直接组织到发送缓冲区，省去先组织到临时空间再拷贝进来的一次拷贝
+        template <typename F>
+        void SendWith(F &&fill) {
+            _loop->AssertInLoop();
+            DrainInbox();
+            if (_statu == DISCONNECTED) return ;
+            fill(&_out_buffer);
+            OutBufferGrowed();
+            WantWrite();
+        }
+        //发送共享数据，发送缓冲区只引用数据，不拷贝
+        void SendSlice(const Slice &slice) {
+            if (_loop->IsInLoop()) {
+                return SendSliceInLoop(slice);
+            }
+            if (_inbox.PushSlice(slice)) {
+                _loop->QueueInLoop(std::bind(&Connection::DrainInboxInLoop, shared_from_this()));
+            }
+        }
+        /*以下两个接口用于批量发送时合并唤醒：先把数据压入多个连接的收件箱，再按EventLoop分组投递一次任务取出*/
+        //压入共享数据，返回收件箱是否从空变为非空（只有这时才需要投递取出任务）
+        bool PushSlice(const Slice &slice) { return _inbox.PushSlice(slice); }
+        //取出收件箱中的数据并发送，必须在连接所属的EventLoop线程中调用
+        void FlushInbox() {
+            _loop->AssertInLoop();
+            DrainInboxInLoop();
         }
         //提供给组件使用者的关闭接口--并不实际关闭，需要判断有没有数据待处理
         void Shutdown() {
-            _loop->RunInLoop(std::bind(&Connection::ShutdownInLoop, this));
+            _loop->RunInLoop(std::bind(&Connection::ShutdownInLoop, shared_from_this()));
         }
         void Release() {
-            _loop->QueueInLoop(std::bind(&Connection::ReleaseInLoop, this));
+            _loop->QueueInLoop(std::bind(&Connection::ReleaseInLoop, shared_from_this()));
         }
         //启动非活跃销毁，并定义多长时间无通信就是非活跃，添加定时任务
         void EnableInactiveRelease(int sec) {
-            _loop->RunInLoop(std::bind(&Connection::EnableInactiveReleaseInLoop, this, sec));
+            _loop->RunInLoop(std::bind(&Connection::EnableInactiveReleaseInLoop, shared_from_this(), sec));
         }
         //取消非活跃销毁
         void CancelInactiveRelease() {
-            _loop->RunInLoop(std::bind(&Connection::CancelInactiveReleaseInLoop, this));
+            _loop->RunInLoop(std::bind(&Connection::CancelInactiveReleaseInLoop, shared_from_this()));
         }
         //切换协议---重置上下文以及阶段性回调处理函数 -- 而是这个接口必须在EventLoop线程中立即执行
         //防备新的事件触发后，处理的时候，切换任务还没有被执行--会导致数据使用原协议处理了。
@@ -1027,6 +2208,144 @@ class Connection : public std::enable_shared_from_this<Connection> {
         }
 };
 
+/*连接ID到连接的并发查找表，用于业务线程按ID给连接发送数据*/
+/*按ID分成多个分片，每个分片一把锁，读写只锁一个分片：写操作只在连接建立和释放时由连接所属线程进行，*/
+/*查找分散在各个分片上，多个线程同时查找几乎不会竞争同一把锁；保存的是weak_ptr，不影响连接的生命周期*/
+#define CONN_TABLE_SHARDS 64
+class ConnectionTable {
+    private:
+        struct alignas(64) Shard { //按缓存行对齐，避免不同分片的锁之间伪共享
+            std::mutex _mutex;
+            std::unordered_map<uint64_t, std::weak_ptr<Connection>> _conns;
+        };
+        Shard _shards[CONN_TABLE_SHARDS];
+    private:
+        Shard &GetShard(uint64_t id) { return _shards[id % CONN_TABLE_SHARDS]; }
+    public:
+        void Insert(uint64_t id, const PtrConnection &conn) {
+            Shard &shard = GetShard(id);
+            std::unique_lock<std::mutex> lock(shard._mutex);
+            shard._conns[id] = conn;
+        }
+        void Remove(uint64_t id) {
+            Shard &shard = GetShard(id);
+            std::unique_lock<std::mutex> lock(shard._mutex);
+            shard._conns.erase(id);
+        }
+        //连接不存在或者已经释放，返回空
+        PtrConnection Find(uint64_t id) {
+            Shard &shard = GetShard(id);
+            std::unique_lock<std::mutex> lock(shard._mutex);
+            auto it = shard._conns.find(id);
+            if (it == shard._conns.end()) {
+                return PtrConnection();
+            }
+            return it->second.lock();
+        }
+};
+
+/*连接池：每个EventLoop一个，连接释放后并不析构，而是清理状态后放回池中，下次获取新连接时直接复用*/
+/*复用的连接保留了缓冲区已经扩容的空间，以及channel和组件使用者设置的回调函数，避免大量短连接时频繁的申请释放内存*/
+/*shared_ptr的控制块也从池中分配：删除器负责回收连接，分配器负责复用控制块的内存*/
+#define CONN_POOL_MAX 1024
+class ConnectionPool;
+template<class T>
+class PoolAllocator {
+    public:
+        using value_type = T;
+        ConnectionPool *_pool;
+    public:
+        PoolAllocator(ConnectionPool *pool):_pool(pool) {}
+        template<class U>
+        PoolAllocator(const PoolAllocator<U> &other):_pool(other._pool) {}
+        T *allocate(size_t n);
+        void deallocate(T *ptr, size_t n);
+        template<class U>
+        bool operator==(const PoolAllocator<U> &other) const { return _pool == other._pool; }
+        template<class U>
+        bool operator!=(const PoolAllocator<U> &other) const { return _pool != other._pool; }
+};
+class ConnectionPool {
+    private:
+        /*连接计数归0时调用，并不释放连接，而是交给连接所属的EventLoop去回收*/
+        struct Recycler {
+            ConnectionPool *_pool;
+            void operator()(Connection *conn) const { _pool->Recycle(conn); }
+        };
+        EventLoop *_loop;               // 池中的连接都属于这个EventLoop
+        std::mutex _mutex;              // 获取连接在baseloop线程中进行，回收在连接所属线程中进行，需要加锁
+        std::vector<Connection *> _conns; // 已经清理完毕，可以复用的连接
+        size_t _block_size;             // 控制块的大小，同一个池中的控制块类型都相同
+        std::vector<void *> _blocks;    // 空闲的控制块内存
+    private:
+        //连接的最后一个shared_ptr可能在任意线程中释放，回收操作统一放到连接所属的线程中进行
+        //用QueueInLoop而不是RunInLoop，保证任务池中已经压入的针对这个连接的任务先执行完毕
+        void Recycle(Connection *conn) {
+            _loop->QueueInLoop(std::bind(&ConnectionPool::RecycleInLoop, this, conn));
+        }
+        void RecycleInLoop(Connection *conn) {
+            if (conn->Recyclable()) {
+                conn->Reset();
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_conns.size() < CONN_POOL_MAX) {
+                    _conns.push_back(conn);
+                    return;
+                }
+            }
+            delete conn;
+        }
+    public:
+        ConnectionPool(EventLoop *loop):_loop(loop), _block_size(0) {}
+        ~ConnectionPool() {
+            for (auto conn : _conns) delete conn;
+            for (auto block : _blocks) ::operator delete(block);
+        }
+        /*获取一个管理新连接的对象，reused表示是否是复用的连接（复用的连接已经设置过回调函数）*/
+        PtrConnection Get(uint64_t conn_id, int sockfd, bool *reused) {
+            Connection *conn = NULL;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_conns.empty() == false) {
+                    conn = _conns.back();
+                    _conns.pop_back();
+                }
+            }
+            *reused = (conn != NULL);
+            if (conn == NULL) {
+                conn = new Connection(_loop, conn_id, sockfd);
+            }else {
+                conn->Init(conn_id, sockfd);
+            }
+            return PtrConnection(conn, Recycler{this}, PoolAllocator<Connection>(this));
+        }
+        void *AllocBlock(size_t size) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (size == _block_size && _blocks.empty() == false) {
+                    void *block = _blocks.back();
+                    _blocks.pop_back();
+                    return block;
+                }
+                if (_block_size == 0) _block_size = size;
+            }
+            return ::operator new(size);
+        }
+        void FreeBlock(void *block, size_t size) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (size == _block_size && _blocks.size() < CONN_POOL_MAX) {
+                    _blocks.push_back(block);
+                    return;
+                }
+            }
+            ::operator delete(block);
+        }
+};
+template<class T>
+T *PoolAllocator<T>::allocate(size_t n) { return (T *)_pool->AllocBlock(n * sizeof(T)); }
+template<class T>
+void PoolAllocator<T>::deallocate(T *ptr, size_t n) { _pool->FreeBlock(ptr, n * sizeof(T)); }
+
 class Acceptor {
     private:
         Socket _socket;//用于创建监听套接字
@@ -1066,20 +2385,37 @@ class TcpServer {
         int _port;
         int _timeout;           //这是非活跃连接的统计时间---多长时间无通信就是非活跃连接
         bool _enable_inactive_release;//是否启动了非活跃连接超时销毁的判断标志
+        bool _enable_conn_pool; //是否启用连接池复用连接对象
         EventLoop _baseloop;    //这是主线程的EventLoop对象，负责监听事件的处理
         Acceptor _acceptor;    //这是监听套接字的管理对象
         LoopThreadPool _pool;   //这是从属EventLoop线程池
-        std::unordered_map<uint64_t, PtrConnection> _conns;//保存管理所有连接对应的shared_ptr对象
+        //负责连接通信的所有EventLoop，连接由各自所属的EventLoop管理，Start之后只读
+        std::vector<EventLoop *> _loops;
+        ConnectionTable _conn_table; //连接ID到连接的查找表，任意线程都可以查找
+        //每个EventLoop对应的连接池，在Start中创建完毕之后只读，不需要加锁
+        std::unordered_map<EventLoop *, std::unique_ptr<ConnectionPool>> _conn_pools;
 
         using ConnectedCallback = std::function<void(const PtrConnection&)>;
         using MessageCallback = std::function<void(const PtrConnection&, Buffer *)>;
         using ClosedCallback = std::function<void(const PtrConnection&)>;
         using AnyEventCallback = std::function<void(const PtrConnection&)>;
+        using HighWaterMarkCallback = std::function<void(const PtrConnection&, size_t)>;
+        using WriteCompleteCallback = std::function<void(const PtrConnection&)>;
         using Functor = std::function<void()>;
         ConnectedCallback _connected_callback;
         MessageCallback _message_callback;
         ClosedCallback _closed_callback;
         AnyEventCallback _event_callback;
+        HighWaterMarkCallback _high_water_callback;
+        WriteCompleteCallback _write_complete_callback;
+        size_t _high_water_mark;
+        size_t _low_water_mark;
+        bool _auto_pause_read;
+        bool _cork;
+        size_t _read_budget;
+        size_t _msg_budget;
+        int _shrink_delay;
+        bool _ring_buffer;
     private:
         void RunAfterInLoop(const Functor &task, int delay) {
             _next_id++;
@@ -1088,34 +2424,66 @@ class TcpServer {
         //为新连接构造一个Connection进行管理
         void NewConnection(int fd) {
             _next_id++;
-            PtrConnection conn(new Connection(_pool.NextLoop(), _next_id, fd));
-            conn->SetMessageCallback(_message_callback);
-            conn->SetClosedCallback(_closed_callback);
-            conn->SetConnectedCallback(_connected_callback);
-            conn->SetAnyEventCallback(_event_callback);
-            conn->SetSrvClosedCallback(std::bind(&TcpServer::RemoveConnection, this, std::placeholders::_1));
+            EventLoop *loop = _pool.NextLoop();
+            PtrConnection conn;
+            bool reused = false;
+            if (_enable_conn_pool) {
+                conn = _conn_pools[loop]->Get(_next_id, fd, &reused);
+            }else {
+                conn.reset(new Connection(loop, _next_id, fd));
+            }
+            //复用的连接保留了之前设置的回调函数，不需要重新设置
+            if (reused == false) {
+                conn->SetMessageCallback(_message_callback);
+                conn->SetClosedCallback(_closed_callback);
+                conn->SetConnectedCallback(_connected_callback);
+                conn->SetAnyEventCallback(_event_callback);
+                conn->SetSrvClosedCallback(std::bind(&TcpServer::RemoveConnection, this, std::placeholders::_1));
+                conn->SetHighWaterMarkCallback(_high_water_callback);
+                conn->SetWriteCompleteCallback(_write_complete_callback);
+                conn->SetWaterMarks(_high_water_mark, _low_water_mark);
+                conn->SetAutoPauseRead(_auto_pause_read);
+                conn->SetCork(_cork);
+                conn->SetReadBudget(_read_budget, _msg_budget);
+                conn->SetBufferShrinkDelay(_shrink_delay);
+                conn->SetRingBuffer(_ring_buffer);
+            }
+            //连接的登记和初始化一次性投递到连接所属的线程中进行
+            loop->RunInLoop(std::bind(&TcpServer::NewConnectionInLoop, this, conn));
+        }
+        void NewConnectionInLoop(const PtrConnection &conn) {
+            conn->GetLoop()->AddConnection(conn->Id(), conn);
+            _conn_table.Insert(conn->Id(), conn);
             if (_enable_inactive_release) conn->EnableInactiveRelease(_timeout);//启动非活跃超时销毁
             conn->Established();//就绪初始化
-            _conns.insert(std::make_pair(_next_id, conn));
-        }
-        void RemoveConnectionInLoop(const PtrConnection &conn) {
-            int id = conn->Id();
-            auto it = _conns.find(id);
-            if (it != _conns.end()) {
-                _conns.erase(it);
-            }
         }
-        //从管理Connection的_conns中移除连接信息
+        //从连接所属EventLoop中移除连接信息，连接释放就是在所属线程中进行的，不需要再投递任务
         void RemoveConnection(const PtrConnection &conn) {
-            _baseloop.RunInLoop(std::bind(&TcpServer::RemoveConnectionInLoop, this, conn));
+            _conn_table.Remove(conn->Id());
+            conn->GetLoop()->RemoveConnection(conn->Id());
+        }
+        //在EventLoop线程中取出本线程各个连接收件箱中的广播数据
+        static void BroadcastInLoop(const std::shared_ptr<std::vector<PtrConnection>> &conns) {
+            for (auto &conn : *conns) {
+                conn->FlushInbox();
+            }
         }
     public:
         TcpServer(int port):
             _port(port), 
             _next_id(0), 
             _enable_inactive_release(false), 
+            _enable_conn_pool(true),
             _acceptor(&_baseloop, port),
-            _pool(&_baseloop) {
+            _pool(&_baseloop),
+            _high_water_mark(DEFAULT_HIGH_WATER_MARK),
+            _low_water_mark(DEFAULT_LOW_WATER_MARK),
+            _auto_pause_read(false),
+            _cork(false),
+            _read_budget(DEFAULT_READ_BUDGET),
+            _msg_budget(0),
+            _shrink_delay(DEFAULT_BUFFER_SHRINK_DELAY),
+            _ring_buffer(false) {
             _acceptor.SetAcceptCallback(std::bind(&TcpServer::NewConnection, this, std::placeholders::_1));
             _acceptor.Listen();//将监听套接字挂到baseloop上
         }
@@ -1124,19 +2492,86 @@ class TcpServer {
         void SetMessageCallback(const MessageCallback&cb) { _message_callback = cb; }
         void SetClosedCallback(const ClosedCallback&cb) { _closed_callback = cb; }
         void SetAnyEventCallback(const AnyEventCallback&cb) { _event_callback = cb; }
+        void SetHighWaterMarkCallback(const HighWaterMarkCallback&cb) { _high_water_callback = cb; }
+        void SetWriteCompleteCallback(const WriteCompleteCallback&cb) { _write_complete_callback = cb; }
+        //设置发送缓冲区高低水位线，以及超过高水位线时是否自动暂停读取（关联了上游连接时暂停上游连接）
+        void SetWaterMarks(size_t high, size_t low) { _high_water_mark = high; _low_water_mark = low; }
+        void EnableAutoPauseRead(bool enable) { _auto_pause_read = enable; }
+        //启用cork模式：一轮事件循环中对同一个连接的多次发送合并为一次写入，必须在Start之前设置
+        void EnableCork(bool enable) { _cork = enable; }
+        //设置每个连接在一轮事件循环中的读取字节数和处理消息数配额，配额用完还有数据的连接排到其他连接之后继续处理
+        //消息配额需要业务在消息回调中配合调用Connection::ConsumeMessageBudget
+        void SetReadBudget(size_t bytes, size_t msgs) { _read_budget = bytes; _msg_budget = msgs; }
+        //连接的缓冲区超过64KB时，空闲多少秒后收缩（小缓冲区数据处理完立即归还给所属线程的空间池），必须在Start之前设置
+        void SetBufferShrinkDelay(int sec) { _shrink_delay = sec; }
+        //连接的缓冲区使用环形模式（同一块内存映射两次），数据始终连续，不需要搬移，适合持续的流式协议，必须在Start之前设置
+        //每个连接的环形空间至少64KB，且处理完数据后不归还，不适合大量空闲连接的场景
+        void EnableRingBuffer(bool enable) { _ring_buffer = enable; }
         void EnableInactiveRelease(int timeout) { _timeout = timeout; _enable_inactive_release = true; }
+        //是否启用连接池，默认启用，必须在Start之前设置
+        void EnableConnectionPool(bool enable) { _enable_conn_pool = enable; }
         //用于添加一个定时任务
         void RunAfter(const Functor &task, int delay) {
             _baseloop.RunInLoop(std::bind(&TcpServer::RunAfterInLoop, this, task, delay));
         }
-        void Start() { _pool.Create();  _baseloop.Start(); }
+        //根据连接ID查找连接，可以在任意线程中调用，连接不存在返回空
+        PtrConnection GetConnection(uint64_t id) { return _conn_table.Find(id); }
+        //按连接ID发送数据，可以在任意线程中调用，数据会投递到连接所属的EventLoop中发送
+        //连接已经不存在时直接返回false
+        bool SendTo(uint64_t id, const char *data, size_t len) {
+            PtrConnection conn = _conn_table.Find(id);
+            if (!conn) return false;
+            conn->Send(data, len);
+            return true;
+        }
+        bool SendTo(uint64_t id, const std::string &data) { return SendTo(id, data.c_str(), data.size()); }
+        //把同一份数据发送给多个连接：所有连接的发送缓冲区引用同一个Slice，内存占用与连接数无关
+        //数据先压入各个连接的收件箱（与Send的顺序保持一致），需要唤醒的连接按所属EventLoop分组，每个EventLoop只投递一次任务
+        void Broadcast(const std::vector<PtrConnection> &conns, const Slice &slice) {
+            std::unordered_map<EventLoop *, std::shared_ptr<std::vector<PtrConnection>>> groups;
+            for (auto &conn : conns) {
+                if (conn->PushSlice(slice) == false) continue;//已经有取出任务在等待执行了
+                auto &group = groups[conn->GetLoop()];
+                if (!group) group = std::make_shared<std::vector<PtrConnection>>();
+                group->push_back(conn);
+            }
+            for (auto &it : groups) {
+                it.first->RunInLoop(std::bind(&TcpServer::BroadcastInLoop, it.second));
+            }
+        }
+        void Start() {
+            _pool.Create();
+            _loops = _pool.AllLoops();
+            for (auto loop : _loops) {
+                _conn_pools[loop].reset(new ConnectionPool(loop));
+            }
+            _baseloop.Start();
+        }
 };
 
 
 void Channel::Remove() { return _loop->RemoveEvent(this); }
+void EventLoop::RunReady(std::vector<PtrConnection> &conns) {
+    for (auto &conn : conns) {
+        conn->ResumeReady();
+    }
+}
+void EventLoop::FlushPending() {
+    //发送完成的回调中有可能继续发送数据，登记新的连接，因此循环到列表为空为止
+    while (_flush_list.empty() == false) {
+        std::vector<PtrConnection> conns;
+        conns.swap(_flush_list);
+        for (auto &conn : conns) {
+            conn->FlushCorked();
+        }
+    }
+}
 void Channel::Update() { return _loop->UpdateEvent(this); }
-void TimerWheel::TimerAdd(uint64_t id, uint32_t delay, const TaskFunc &cb) {
-    _loop->RunInLoop(std::bind(&TimerWheel::TimerAddInLoop, this, id, delay, cb));
+void TimerWheel::TimerAdd(uint64_t id, uint32_t delay, TaskFunc &&cb) {
+    //定时任务只能移动，移动到投递的任务中，任务执行时再移动到定时器对象中
+    _loop->RunInLoop([this, id, delay, cb = std::move(cb)]() mutable {
+        TimerAddInLoop(id, delay, std::move(cb));
+    });
 }
 //刷新/延迟定时任务
 void TimerWheel::TimerRefresh(uint64_t id) {
@@ -0,0 +1,104 @@
+/*连接上下文测试：对比原来基于虚函数和typeid的Any与内部存储的Any
+    ./bench_any_context [次数]
+    1. connect：每个新连接设置一次HttpContext上下文，统计堆内存分配次数和耗时
+    2. message：每批数据取一次上下文，统计每次取出的耗时
+*/
+#include <chrono>
+#include "../source/http/http.hpp"
+
+static uint64_t g_allocs = 0;//只在主线程中测试，不需要原子操作
+
+void *operator new(size_t size) {
+    g_allocs++;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+//原来的实现：每次赋值都在堆上分配一个placeholder，取出时比较typeid
+class LegacyAny{
+    private:
+        class holder {
+            public:
+                virtual ~holder() {}
+                virtual const std::type_info& type() = 0;
+                virtual holder *clone() = 0;
+        };
+        template<class T>
+        class placeholder: public holder {
+            public:
+                placeholder(const T &val): _val(val) {}
+                virtual const std::type_info& type() { return typeid(T); }
+                virtual holder *clone() { return new placeholder(_val); }
+            public:
+                T _val;
+        };
+        holder *_content;
+    public:
+        LegacyAny():_content(NULL) {}
+        template<class T>
+        LegacyAny(const T &val):_content(new placeholder<T>(val)) {}
+        LegacyAny(const LegacyAny &other):_content(other._content ? other._content->clone() : NULL) {}
+        ~LegacyAny() { delete _content; }
+        LegacyAny &swap(LegacyAny &other) {
+            std::swap(_content, other._content);
+            return *this;
+        }
+        template<class T>
+        T *get() {
+            assert(typeid(T) == _content->type());
+            return &((placeholder<T>*)_content)->_val;
+        }
+        template<class T>
+        LegacyAny& operator=(const T &val) {
+            LegacyAny(val).swap(*this);
+            return *this;
+        }
+};
+
+template<class F>
+void Measure(const char *name, int count, F func) {
+    uint64_t allocs = g_allocs;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) func(i);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("  %-28s %5.1f allocations/op %8.1f ns/op\n", name, (double)(g_allocs - allocs) / count, elapsed * 1e9 / count);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    uint64_t sink = 0;
+    printf("sizeof(HttpContext) = %zu, inline storage %d bytes\n", sizeof(HttpContext), ANY_INLINE_SIZE);
+    printf("connect:\n");
+    Measure("legacy  context = HttpContext()", count, [&](int) {
+        LegacyAny context;
+        context = HttpContext();
+        sink += context.get<HttpContext>()->RespStatu();
+    });
+    Measure("any     context = HttpContext()", count, [&](int) {
+        Any context;
+        context = HttpContext();
+        sink += context.get<HttpContext>()->RespStatu();
+    });
+    Measure("any     emplace<HttpContext>()", count, [&](int) {
+        Any context;
+        sink += context.emplace<HttpContext>()->RespStatu();
+    });
+    printf("message:\n");
+    LegacyAny legacy = HttpContext();
+    Any any;
+    any.emplace<HttpContext>();
+    Measure("legacy  get<HttpContext>()", count * 10, [&](int) {
+        sink += legacy.get<HttpContext>()->RespStatu();
+        asm volatile("" ::: "memory");
+    });
+    Measure("any     get<HttpContext>()", count * 10, [&](int) {
+        sink += any.get<HttpContext>()->RespStatu();
+        asm volatile("" ::: "memory");
+    });
+    if (sink == 0) printf("?\n");
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*广播测试：同一条消息发送给所有订阅者，订阅者只连接不读取，数据全部堆积在服务器的发送缓冲区中
+    ./bench_broadcast [copy/slice] [订阅者数] [消息大小] [消息条数] [服务器线程数]
+    copy : 逐个连接调用Connection::Send，每个连接拷贝一份数据
+    slice: 调用TcpServer::Broadcast，所有连接共享同一个Slice
+    统计投递耗时、待发送数据总量以及进程内存的增长
+*/
+#include <atomic>
+#include <chrono>
+#include "../source/server.hpp"
+#include "bench_util.hpp"
+
+static std::mutex g_mutex;
+static std::vector<PtrConnection> g_conns;
+
+void OnConnected(const PtrConnection &conn) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    g_conns.push_back(conn);
+}
+void OnMessage(const PtrConnection &conn, Buffer *buf) {
+    buf->MoveReadOffset(buf->ReadAbleSize());
+}
+//等待所有连接所属的EventLoop把之前投递的任务执行完毕
+void WaitLoops(const std::vector<PtrConnection> &conns) {
+    std::vector<EventLoop *> loops;
+    for (auto &conn : conns) {
+        if (std::find(loops.begin(), loops.end(), conn->GetLoop()) == loops.end()) loops.push_back(conn->GetLoop());
+    }
+    std::atomic<int> pending(loops.size());
+    for (auto loop : loops) {
+        loop->QueueInLoop([&pending]() { pending--; });
+    }
+    while (pending.load() > 0) usleep(1000);
+}
+
+int main(int argc, char *argv[])
+{
+    bool slice_mode = argc > 1 ? strcmp(argv[1], "slice") == 0 : true;
+    int subs = argc > 2 ? atoi(argv[2]) : 1000;
+    int size = argc > 3 ? atoi(argv[3]) : 4096;
+    int count = argc > 4 ? atoi(argv[4]) : 100;
+    int threads = argc > 5 ? atoi(argv[5]) : 2;
+    uint16_t port = 8601;
+
+    std::atomic<TcpServer *> server_ptr(NULL);
+    std::thread server_thread([&]() {
+        TcpServer server(port);
+        server.SetThreadCount(threads);
+        server.SetConnectedCallback(OnConnected);
+        server.SetMessageCallback(OnMessage);
+        server_ptr = &server;
+        server.Start();
+    });
+    while (server_ptr.load() == NULL) usleep(1000);
+    usleep(100000);
+    //订阅者：缩小接收缓冲区，只连接不读取
+    std::vector<int> clients;
+    for (int i = 0; i < subs; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int rcvbuf = 4096;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        struct sockaddr_in addr;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) { perror("connect"); return 1; }
+        clients.push_back(fd);
+    }
+    while (true) {
+        std::unique_lock<std::mutex> lock(g_mutex);
+        if ((int)g_conns.size() == subs) break;
+        lock.unlock();
+        usleep(1000);
+    }
+    std::vector<PtrConnection> conns = g_conns;
+    WaitLoops(conns);
+    TcpServer *server = server_ptr.load();
+    std::string payload(size, 'x');
+    long rss_before = RssKB();
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        if (slice_mode) {
+            server->Broadcast(conns, Slice(payload.c_str(), payload.size()));
+        }else {
+            for (auto &conn : conns) conn->Send(payload.c_str(), payload.size());
+        }
+    }
+    double enqueue = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    WaitLoops(conns);
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    usleep(200000);//让可写事件把能发送的数据写入内核
+    WaitLoops(conns);
+    size_t pending = 0;
+    for (auto &conn : conns) pending += conn->OutboundBytes();
+    long rss_after = RssKB();
+    printf("%-5s %d subscribers x %d msgs x %d bytes: enqueue %.1f ms, applied %.1f ms, "
+           "%.1f ns/delivery, pending %.1f MB, rss +%.1f MB\n",
+           slice_mode ? "slice" : "copy", subs, count, size, enqueue * 1e3, total * 1e3,
+           total * 1e9 / ((double)subs * count), pending / 1048576.0, (rss_after - rss_before) / 1024.0);
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
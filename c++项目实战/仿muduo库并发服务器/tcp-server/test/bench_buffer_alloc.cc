@@ -0,0 +1,137 @@
+/*缓冲区空间分配测试：对比slab分配器和原来std::vector实现的Buffer
+    ./bench_buffer_alloc [slab/vector] [线程数] [秒数]
+    1. churn：每个线程不停地创建缓冲区，写入大小混合的数据（大部分几KB，少量几百KB到几MB），读出后销毁
+    2. cross：生产线程创建并写满缓冲区，交给另一个线程销毁（跨线程释放）
+    每项结束后统计进程常驻内存
+*/
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <deque>
+#include "../source/server.hpp"
+#include "bench_util.hpp"
+
+//原来的实现：std::vector管理空间，构造时分配1KB，只扩容不收缩
+class VecBuffer {
+    private:
+        std::vector<char> _buffer;
+        uint64_t _reader_idx;
+        uint64_t _writer_idx;
+    public:
+        VecBuffer():_buffer(BUFFER_DEFAULT_SIZE), _reader_idx(0), _writer_idx(0) {}
+        uint64_t ReadAbleSize() { return _writer_idx - _reader_idx; }
+        void MoveReadOffset(uint64_t len) { _reader_idx += len; }
+        void WriteAndPush(const void *data, uint64_t len) {
+            if (_buffer.size() - _writer_idx < len) {
+                if (len <= _buffer.size() - _writer_idx + _reader_idx) {
+                    uint64_t rsz = ReadAbleSize();
+                    std::copy(&_buffer[_reader_idx], &_buffer[_reader_idx] + rsz, &_buffer[0]);
+                    _reader_idx = 0;
+                    _writer_idx = rsz;
+                }else {
+                    _buffer.resize(_writer_idx + len);
+                }
+            }
+            memcpy(&_buffer[_writer_idx], data, len);
+            _writer_idx += len;
+        }
+};
+static char g_data[16 * 1024];
+//大部分几KB，少量几百KB，极少数几MB
+size_t RandomSize(std::mt19937 &rng) {
+    uint32_t r = rng() % 1000;
+    if (r < 900) return 512 + rng() % (16 * 1024);
+    if (r < 990) return 64 * 1024 + rng() % (256 * 1024);
+    return 1024 * 1024 + rng() % (3 * 1024 * 1024);
+}
+template<typename BufferT>
+void Fill(BufferT &buf, size_t size) {
+    for (size_t n = 0; n < size; n += sizeof(g_data)) {
+        size_t len = std::min(sizeof(g_data), size - n);
+        buf.WriteAndPush(g_data, len);
+    }
+}
+
+template<typename BufferT>
+void Churn(int threads, int seconds) {
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> ops(0);
+    std::vector<std::thread> ths;
+    for (int t = 0; t < threads; t++) {
+        ths.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            uint64_t n = 0;
+            //每个线程同时持有一些缓冲区，模拟连接
+            std::vector<std::unique_ptr<BufferT>> live(64);
+            while (running.load(std::memory_order_relaxed)) {
+                size_t idx = rng() % live.size();
+                live[idx].reset(new BufferT);
+                Fill(*live[idx], RandomSize(rng));
+                live[idx]->MoveReadOffset(live[idx]->ReadAbleSize());
+                n++;
+            }
+            ops += n;
+        });
+    }
+    sleep(seconds);
+    running = false;
+    for (auto &th : ths) th.join();
+    printf("  churn: %8.0f buffers/s, rss after load %6ld KB\n", ops.load() / (double)seconds, RssKB());
+}
+
+template<typename BufferT>
+void Cross(int threads, int seconds) {
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> ops(0);
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<BufferT *> queue;
+    std::thread consumer([&]() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() { return queue.empty() == false || running.load() == false; });
+            if (queue.empty()) break;
+            std::deque<BufferT *> tmp;
+            tmp.swap(queue);
+            lock.unlock();
+            for (auto buf : tmp) delete buf;//在另一个线程中释放
+            ops += tmp.size();
+        }
+    });
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; t++) {
+        producers.emplace_back([&, t]() {
+            std::mt19937 rng(t + 100);
+            while (running.load(std::memory_order_relaxed)) {
+                BufferT *buf = new BufferT;
+                Fill(*buf, 4096 + rng() % (60 * 1024));
+                std::unique_lock<std::mutex> lock(mutex);
+                if (queue.size() > 1024) { lock.unlock(); delete buf; continue; }
+                queue.push_back(buf);
+                cond.notify_one();
+            }
+        });
+    }
+    sleep(seconds);
+    running = false;
+    for (auto &th : producers) th.join();
+    cond.notify_all();
+    consumer.join();
+    printf("  cross: %8.0f buffers/s, rss after load %6ld KB\n", ops.load() / (double)seconds, RssKB());
+}
+
+int main(int argc, char *argv[])
+{
+    bool slab = argc > 1 ? strcmp(argv[1], "vector") != 0 : true;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 3 ? atoi(argv[3]) : 3;
+    printf("%s, %d threads (rss at start %ld KB)\n", slab ? "slab" : "std::vector", threads, RssKB());
+    if (slab) {
+        Churn<Buffer>(threads, seconds);
+        Cross<Buffer>(threads, seconds);
+    }else {
+        Churn<VecBuffer>(threads, seconds);
+        Cross<VecBuffer>(threads, seconds);
+    }
+    return 0;
+}
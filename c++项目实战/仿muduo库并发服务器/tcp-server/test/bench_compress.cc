@@ -0,0 +1,151 @@
+/*响应压缩测试：对比不压缩、在通信线程中压缩、在工作线程中压缩时的吞吐、传输字节数，以及同一线程上其他请求的延迟
+    ./bench_compress [off/inline/pool] [压缩级别] [客户端数] [秒数]
+    1. 客户端用长连接轮流请求 /api/items（约32KB的json，每次都要压缩）和 /app.js（64KB的静态文件，缓存中只压缩一次）
+    2. 另一个连接不停地请求 /ping，统计平均和最大延迟：在通信线程中压缩时，ping要排在压缩后边
+    每种路径的第一个响应解压后与原始数据比较
+*/
+#include <atomic>
+#include <chrono>
+#include "../source/http/http.hpp"
+
+static std::atomic<uint64_t> g_requests(0), g_bytes(0);
+static std::string g_items, g_script;
+
+void Items(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent(g_items, "application/json");
+}
+void Ping(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent("pong", "text/plain");
+}
+
+std::string MakeItems() {
+    std::string json = "[";
+    for (int i = 0; json.size() < 32 * 1024; i++) {
+        if (i) json += ",";
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"item-" + std::to_string(i * 7919 % 10007) +
+                "\",\"price\":" + std::to_string(i * 37 % 1000) + ".99,\"tags\":[\"new\",\"sale\"],\"stock\":" + std::to_string(i % 13) + "}";
+    }
+    return json + "]";
+}
+std::string MakeScript() {
+    std::string js;
+    for (int i = 0; js.size() < 64 * 1024; i++) {
+        js += "function handler" + std::to_string(i) + "(event) { return document.getElementById('item-" +
+              std::to_string(i % 97) + "').classList.toggle('active'); }\n";
+    }
+    return js;
+}
+
+std::string Inflate(const std::string &data) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, 15 + 32);//自动识别gzip/zlib格式
+    std::string out(1024 * 1024, '\0');
+    zs.next_in = (Bytef *)data.data();
+    zs.avail_in = data.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    inflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    inflateEnd(&zs);
+    return out;
+}
+
+//发送一个请求，按Content-Length收取完整的响应，返回正文
+bool Request(int fd, const std::string &req, std::string *body, bool *encoded) {
+    if (send(fd, req.c_str(), req.size(), 0) <= 0) return false;
+    std::string data;
+    char buf[65536];
+    size_t need = std::string::npos, end = 0;
+    while (data.size() < need) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) return false;
+        data.append(buf, ret);
+        if (need != std::string::npos || (end = data.find("\r\n\r\n")) == std::string::npos) continue;
+        size_t pos = data.find("Content-Length: ");
+        if (pos == std::string::npos || pos > end) return false;
+        need = end + 4 + strtoull(&data[pos + 16], NULL, 10);
+        *encoded = data.find("Content-Encoding: ") < end;
+    }
+    g_bytes += data.size();
+    *body = data.substr(end + 4);
+    return true;
+}
+
+void Client(uint16_t port, std::atomic<bool> *running) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    const char *paths[] = {"/api/items", "/app.js"};
+    const std::string *expect[] = {&g_items, &g_script};
+    for (uint64_t i = 0; running->load(); i++) {
+        std::string req = std::string("GET ") + paths[i % 2] + " HTTP/1.1\r\nConnection: keep-alive\r\nAccept-Encoding: gzip, deflate\r\n\r\n";
+        std::string body;
+        bool encoded = false;
+        if (Request(cli_sock.Fd(), req, &body, &encoded) == false) return;
+        if (i < 2 && (encoded ? Inflate(body) : body) != *expect[i % 2]) {
+            printf("%s: response mismatch\n", paths[i % 2]);
+            abort();
+        }
+        g_requests++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "pool";
+    int level = argc > 2 ? atoi(argv[2]) : COMPRESS_DEFAULT_LEVEL;
+    int clients = argc > 3 ? atoi(argv[3]) : 4;
+    int seconds = argc > 4 ? atoi(argv[4]) : 3;
+    uint16_t port = 8611;
+    g_items = MakeItems();
+    g_script = MakeScript();
+    char tmpl[] = "/tmp/bench_compress_XXXXXX";
+    std::string root = mkdtemp(tmpl);
+    Util::WriteFile(root + "/app.js", g_script);
+
+    std::thread server_thread([=]() {
+        HttpServer server(port);
+        server.SetBaseDir(root);
+        server.EnableFileCache(true);
+        server.EnableCompression(mode != "off", level);
+        if (mode == "pool") server.SetCompressThreadCount(2);
+        server.Get("/api/items", Items);
+        server.Get("/ping", Ping);
+        server.Listen();
+    });
+    usleep(200000);
+    std::atomic<bool> running(true);
+    std::vector<std::thread> cli_threads;
+    for (int i = 0; i < clients; i++) {
+        cli_threads.emplace_back(Client, port, &running);
+    }
+    usleep(200000);
+    uint64_t start = g_requests.load(), start_bytes = g_bytes.load();
+    auto begin = std::chrono::steady_clock::now();
+    auto end = begin + std::chrono::seconds(seconds);
+    //ping与其他连接在同一个通信线程中
+    Socket ping_sock;
+    if (ping_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    double ping_total = 0, ping_max = 0;
+    int pings = 0;
+    while (std::chrono::steady_clock::now() < end) {
+        auto t0 = std::chrono::steady_clock::now();
+        std::string body;
+        bool encoded;
+        if (Request(ping_sock.Fd(), "GET /ping HTTP/1.1\r\nConnection: keep-alive\r\n\r\n", &body, &encoded) == false) abort();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        ping_total += us;
+        ping_max = std::max(ping_max, us);
+        pings++;
+        usleep(1000);
+    }
+    uint64_t count = g_requests.load() - start;
+    uint64_t bytes = g_bytes.load() - start_bytes;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%-6s level %d, %d clients: %8.0f requests/s, %6.0f bytes/response, ping avg %6.0f us max %7.0f us\n",
+           mode.c_str(), level, clients, count / elapsed, (double)bytes / std::max<uint64_t>(count, 1), ping_total / pings, ping_max);
+    fflush(stdout);
+    std::string cmd = "rm -rf " + root;
+    if (system(cmd.c_str()) != 0) printf("remove %s failed\n", root.c_str());
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
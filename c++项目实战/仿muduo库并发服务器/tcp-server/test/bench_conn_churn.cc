@@ -0,0 +1,61 @@
+/*短连接压力测试：客户端不断地 建立连接->发送1字节->等待服务器关闭 ，统计服务器每秒完成的连接数
+    ./bench_conn_churn [pool(1/0)] [服务器线程数] [客户端线程数] [秒数]
+    对比启用与不启用连接池时，每秒处理的连接数
+*/
+#include <atomic>
+#include <chrono>
+#include "../source/server.hpp"
+
+static std::atomic<uint64_t> g_closed(0);
+
+void OnMessage(const PtrConnection &conn, Buffer *buf) {
+    buf->MoveReadOffset(buf->ReadAbleSize());
+    conn->Shutdown();
+}
+void OnClosed(const PtrConnection &conn) {
+    g_closed++;
+}
+
+void Client(uint16_t port, std::atomic<bool> *running) {
+    while (running->load()) {
+        Socket cli_sock;
+        if (cli_sock.CreateClient(port, "127.0.0.1") == false) continue;
+        char c = 'x';
+        cli_sock.Send(&c, 1);
+        char buf[16];
+        while (recv(cli_sock.Fd(), buf, sizeof(buf), 0) > 0);//等待服务器关闭连接
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool pool = argc > 1 ? atoi(argv[1]) != 0 : true;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    int clients = argc > 3 ? atoi(argv[3]) : 4;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    uint16_t port = 8600;
+
+    std::thread server_thread([=]() {
+        TcpServer server(port);
+        server.SetThreadCount(threads);
+        server.EnableConnectionPool(pool);
+        server.SetMessageCallback(OnMessage);
+        server.SetClosedCallback(OnClosed);
+        server.Start();
+    });
+    usleep(200000);
+    std::atomic<bool> running(true);
+    std::vector<std::thread> cli_threads;
+    for (int i = 0; i < clients; i++) {
+        cli_threads.emplace_back(Client, port, &running);
+    }
+    uint64_t start = g_closed.load();
+    auto begin = std::chrono::steady_clock::now();
+    sleep(seconds);
+    uint64_t count = g_closed.load() - start;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("pool %s, %d loop threads, %d clients: %.0f connections/s\n",
+           pool ? "on" : "off", threads, clients, count / elapsed);
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
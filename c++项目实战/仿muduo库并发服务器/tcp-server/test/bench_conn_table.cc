@@ -0,0 +1,93 @@
+/*按连接ID查找连接的并发测试：多个线程不停地按随机ID查找连接，同时一个线程不停地插入和移除连接
+    ./bench_conn_table [查找线程数] [连接数] [秒数]
+    对比一把全局锁保护的unordered_map和分片的ConnectionTable，每秒完成的查找次数
+*/
+#include <atomic>
+#include <chrono>
+#include <random>
+#include "../source/server.hpp"
+
+//对照组：一把锁保护整张表
+class GlobalLockTable {
+    private:
+        std::mutex _mutex;
+        std::unordered_map<uint64_t, std::weak_ptr<Connection>> _conns;
+    public:
+        void Insert(uint64_t id, const PtrConnection &conn) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _conns[id] = conn;
+        }
+        void Remove(uint64_t id) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _conns.erase(id);
+        }
+        PtrConnection Find(uint64_t id) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _conns.find(id);
+            if (it == _conns.end()) return PtrConnection();
+            return it->second.lock();
+        }
+};
+
+template<typename Table>
+void Run(const char *name, int threads, int count, int seconds, const std::vector<PtrConnection> &conns) {
+    Table table;
+    //连接i当前的ID是 i + round*count，插入/移除线程逐个把连接换成新的ID，模拟连接的建立和释放
+    for (int i = 0; i < count; i++) table.Insert(i, conns[i]);
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> churns(0);
+    std::thread churn([&]() {
+        uint64_t round = 0;
+        while (running.load(std::memory_order_relaxed)) {
+            for (int i = 0; i < count && running.load(std::memory_order_relaxed); i++) {
+                table.Remove(i + round * count);
+                table.Insert(i + (round + 1) * count, conns[i]);
+                churns.fetch_add(1, std::memory_order_relaxed);
+            }
+            round++;
+        }
+    });
+    std::vector<uint64_t> lookups(threads, 0), hits(threads, 0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; t++) {
+        readers.emplace_back([&, t]() {
+            std::mt19937_64 rng(t);
+            uint64_t n = 0, h = 0;
+            while (running.load(std::memory_order_relaxed)) {
+                //ID在最近两轮的范围内，大约一半能够找到
+                uint64_t base = churns.load(std::memory_order_relaxed);
+                uint64_t id = base + rng() % (2 * count);
+                id = id > (uint64_t)count ? id - count : id;
+                if (table.Find(id)) h++;
+                n++;
+            }
+            lookups[t] = n;
+            hits[t] = h;
+        });
+    }
+    auto begin = std::chrono::steady_clock::now();
+    sleep(seconds);
+    running = false;
+    churn.join();
+    for (auto &th : readers) th.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    uint64_t total = 0, total_hits = 0;
+    for (int t = 0; t < threads; t++) { total += lookups[t]; total_hits += hits[t]; }
+    printf("%-16s %2d threads: %12.0f lookups/s (hit %4.1f%%), %10.0f churns/s\n", name, threads,
+           total / elapsed, total ? 100.0 * total_hits / total : 0.0, churns.load() / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 16;
+    int count = argc > 2 ? atoi(argv[2]) : 10000;
+    int seconds = argc > 3 ? atoi(argv[3]) : 3;
+    EventLoop loop;
+    std::vector<PtrConnection> conns;
+    for (int i = 0; i < count; i++) {
+        conns.push_back(std::make_shared<Connection>(&loop, i, -1));//只用于查找，不需要真实的描述符
+    }
+    Run<GlobalLockTable>("global mutex", threads, count, seconds, conns);
+    Run<ConnectionTable>("ConnectionTable", threads, count, seconds, conns);
+    return 0;
+}
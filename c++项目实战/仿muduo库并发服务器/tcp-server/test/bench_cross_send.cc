@@ -0,0 +1,94 @@
+/*跨线程发送测试：多个业务线程在EventLoop线程之外不停地给连接发送小消息，客户端接收并统计
+    ./bench_cross_send [inbox/legacy] [业务线程数] [每个线程的消息数] [消息大小] [服务器线程数]
+    inbox : 直接调用Connection::Send，数据压入连接的无锁收件箱
+    legacy: 模拟原来的做法，每条消息构造一个Buffer，绑定成任务压入EventLoop的任务池
+    每个业务线程对应一个连接，统计客户端收齐所有数据的耗时
+*/
+#include <atomic>
+#include <chrono>
+#include "../source/server.hpp"
+
+static std::mutex g_mutex;
+static std::vector<PtrConnection> g_conns;
+
+void OnConnected(const PtrConnection &conn) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    g_conns.push_back(conn);
+}
+void OnMessage(const PtrConnection &conn, Buffer *buf) {
+    buf->MoveReadOffset(buf->ReadAbleSize());
+}
+//原来的跨线程发送：拷贝到Buffer，std::bind之后存入std::function，加锁压入任务池，每条消息唤醒一次
+void SendBuffer(const PtrConnection &conn, Buffer &buf) {
+    conn->Send(buf.ReadPosition(), buf.ReadAbleSize());
+}
+void LegacySend(const PtrConnection &conn, const char *data, size_t len) {
+    Buffer buf;
+    buf.WriteAndPush(data, len);
+    conn->GetLoop()->QueueInLoop(std::bind(SendBuffer, conn, std::move(buf)));
+}
+
+int main(int argc, char *argv[])
+{
+    bool inbox = argc > 1 ? strcmp(argv[1], "legacy") != 0 : true;
+    int producers = argc > 2 ? atoi(argv[2]) : 4;
+    int count = argc > 3 ? atoi(argv[3]) : 200000;
+    int size = argc > 4 ? atoi(argv[4]) : 64;
+    int threads = argc > 5 ? atoi(argv[5]) : 2;
+    uint16_t port = 8602;
+
+    std::thread server_thread([=]() {
+        TcpServer server(port);
+        server.SetThreadCount(threads);
+        server.SetConnectedCallback(OnConnected);
+        server.SetMessageCallback(OnMessage);
+        server.Start();
+    });
+    usleep(200000);
+    std::vector<std::unique_ptr<Socket>> clients;
+    for (int i = 0; i < producers; i++) {
+        clients.emplace_back(new Socket);
+        if (clients.back()->CreateClient(port, "127.0.0.1") == false) return 1;
+    }
+    while (true) {
+        std::unique_lock<std::mutex> lock(g_mutex);
+        if ((int)g_conns.size() == producers) break;
+        lock.unlock();
+        usleep(1000);
+    }
+    uint64_t expect = (uint64_t)count * size;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < producers; i++) {
+        int fd = clients[i]->Fd();
+        readers.emplace_back([fd, expect]() {
+            char buf[65536];
+            uint64_t total = 0;
+            while (total < expect) {
+                ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+                if (ret <= 0) break;
+                total += ret;
+            }
+        });
+    }
+    std::string msg(size, 'x');
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < producers; i++) {
+        PtrConnection conn = g_conns[i];
+        workers.emplace_back([=, &msg]() {
+            for (int j = 0; j < count; j++) {
+                if (inbox) conn->Send(msg.c_str(), msg.size());
+                else LegacySend(conn, msg.c_str(), msg.size());
+            }
+        });
+    }
+    for (auto &th : workers) th.join();
+    double produce = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    for (auto &th : readers) th.join();
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%-6s %d producers x %d msgs x %d bytes: send calls %.0f ns/msg, delivered %.2f M msgs/s\n",
+           inbox ? "inbox" : "legacy", producers, count, size, produce * 1e9 / ((double)producers * count),
+           (double)producers * count / total / 1e6);
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
@@ -0,0 +1,110 @@
+/*公平调度测试：一个客户端持续发送很深的流水线请求，几个轻量客户端一问一答，所有连接在同一个EventLoop线程中
+    ./bench_fairness [消息配额(0表示不限制)] [轻量客户端数] [秒数] [流水线深度]
+    统计轻量客户端请求延迟的分布，以及流水线客户端的吞吐
+*/
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "../source/http/http.hpp"
+
+void Hello(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent("hello world", "text/plain");
+}
+int Connect(uint16_t port) {
+    Socket *sock = new Socket;//描述符由进程结束时回收
+    if (sock->CreateClient(port, "127.0.0.1") == false) return -1;
+    return sock->Fd();
+}
+bool SendAll(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t ret = send(fd, data.c_str() + sent, data.size() - sent, 0);
+        if (ret <= 0) return false;
+        sent += ret;
+    }
+    return true;
+}
+bool RecvN(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t ret = recv(fd, buf + got, len - got, 0);
+        if (ret <= 0) return false;
+        got += ret;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int budget = argc > 1 ? atoi(argv[1]) : 16;
+    int lights = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    int depth = argc > 4 ? atoi(argv[4]) : 1024;
+    uint16_t port = 8605;
+
+    std::thread server_thread([=]() {
+        HttpServer server(port);
+        server.SetThreadCount(1);//所有连接都在同一个EventLoop线程中
+        server.SetReadBudget(0, budget);
+        server.Get("/hello", Hello);
+        server.Listen();
+    });
+    usleep(200000);
+    std::string req = "GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+    //得到一个响应的长度（所有响应都是一样的）
+    int probe = Connect(port);
+    SendAll(probe, req);
+    char head[4096];
+    ssize_t rsp_len = recv(probe, head, sizeof(head), 0);
+    if (rsp_len <= 0) return 1;
+
+    std::atomic<bool> running(true);
+    //流水线客户端：发送线程保持depth个请求在途，接收线程读取响应
+    std::atomic<uint64_t> heavy_done(0);
+    int heavy = Connect(port);
+    std::string batch;
+    for (int i = 0; i < depth; i++) batch += req;
+    std::thread heavy_writer([&]() {
+        uint64_t sent = 0;
+        while (running.load()) {
+            if (sent - heavy_done.load() > (uint64_t)depth) { usleep(100); continue; }
+            if (SendAll(heavy, batch) == false) break;
+            sent += depth;
+        }
+    });
+    std::thread heavy_reader([&]() {
+        std::vector<char> buf(rsp_len * 64);
+        while (running.load()) {
+            if (RecvN(heavy, buf.data(), buf.size()) == false) break;
+            heavy_done += 64;
+        }
+    });
+    //轻量客户端：一问一答，记录每个请求的延迟
+    std::vector<std::vector<double>> lat(lights);
+    std::vector<std::thread> light_threads;
+    for (int i = 0; i < lights; i++) {
+        light_threads.emplace_back([&, i]() {
+            int fd = Connect(port);
+            std::vector<char> buf(rsp_len);
+            while (running.load()) {
+                auto begin = std::chrono::steady_clock::now();
+                if (SendAll(fd, req) == false || RecvN(fd, buf.data(), buf.size()) == false) break;
+                lat[i].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+                usleep(1000);
+            }
+        });
+    }
+    uint64_t heavy_begin = heavy_done.load();
+    sleep(seconds);
+    uint64_t heavy_count = heavy_done.load() - heavy_begin;
+    running = false;
+    for (auto &th : light_threads) th.join();
+    std::vector<double> all;
+    for (auto &v : lat) all.insert(all.end(), v.begin(), v.end());
+    std::sort(all.begin(), all.end());
+    auto pct = [&all](double p) { return all.empty() ? 0.0 : all[std::min(all.size() - 1, (size_t)(p * all.size()))]; };
+    printf("budget %4d: light requests %zu, latency us p50 %.0f p99 %.0f p999 %.0f max %.0f; heavy %.0f req/s\n",
+           budget, all.size(), pct(0.5), pct(0.99), pct(0.999), all.empty() ? 0.0 : all.back(), heavy_count / (double)seconds);
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
@@ -0,0 +1,87 @@
+/*静态文件缓存测试：对比启用与不启用文件缓存时，静态资源请求每秒的处理数量
+    ./bench_file_cache [cache(1/0)] [客户端数] [秒数]
+    在临时目录中生成几个常见大小的静态文件，客户端用长连接依次不停地请求这些文件
+    不启用缓存时每个请求都要 stat + 打开、读取文件；启用后命中时没有任何文件相关的系统调用，文件内容也不拷贝
+*/
+#include <atomic>
+#include <chrono>
+#include "../source/http/http.hpp"
+
+static std::atomic<uint64_t> g_requests(0);
+
+struct File {
+    const char *_name;
+    size_t _size;
+};
+static File g_files[] = {{"/index.html", 2 * 1024}, {"/css/site.css", 12 * 1024}, {"/js/app.js", 48 * 1024}, {"/img/logo.png", 96 * 1024}};
+
+std::string MakeRoot() {
+    char tmpl[] = "/tmp/bench_file_cache_XXXXXX";
+    std::string root = mkdtemp(tmpl);
+    mkdir((root + "/css").c_str(), 0755);
+    mkdir((root + "/js").c_str(), 0755);
+    mkdir((root + "/img").c_str(), 0755);
+    for (auto &file : g_files) {
+        Util::WriteFile(root + file._name, std::string(file._size, 'x'));
+    }
+    return root;
+}
+
+//用长连接依次请求所有文件，按Content-Length收取完整的响应
+void Client(uint16_t port, std::atomic<bool> *running) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    std::vector<char> buf(256 * 1024);
+    for (uint64_t i = 0; running->load(); i++) {
+        File &file = g_files[i % (sizeof(g_files) / sizeof(g_files[0]))];
+        std::string req = std::string("GET ") + file._name + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+        if (send(cli_sock.Fd(), req.c_str(), req.size(), 0) <= 0) break;
+        size_t got = 0, need = 0;
+        while (need == 0 || got < need) {
+            ssize_t ret = recv(cli_sock.Fd(), &buf[got], buf.size() - got, 0);
+            if (ret <= 0) return;
+            got += ret;
+            if (need != 0) continue;
+            std::string_view head(&buf[0], got);
+            size_t end = head.find("\r\n\r\n");
+            if (end == std::string_view::npos) continue;
+            size_t pos = head.find("Content-Length: ");
+            if (pos == std::string_view::npos || pos > end) return;
+            need = end + 4 + strtoull(&buf[pos + 16], NULL, 10);
+        }
+        g_requests++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool cache = argc > 1 ? atoi(argv[1]) != 0 : true;
+    int clients = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    uint16_t port = 8608;
+    std::string root = MakeRoot();
+
+    std::thread server_thread([=]() {
+        HttpServer server(port);
+        server.SetBaseDir(root);
+        server.EnableFileCache(cache);
+        server.Listen();
+    });
+    usleep(200000);
+    std::atomic<bool> running(true);
+    std::vector<std::thread> cli_threads;
+    for (int i = 0; i < clients; i++) {
+        cli_threads.emplace_back(Client, port, &running);
+    }
+    usleep(200000);
+    uint64_t start = g_requests.load();
+    auto begin = std::chrono::steady_clock::now();
+    sleep(seconds);
+    uint64_t count = g_requests.load() - start;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("file cache %s, %d clients: %.0f requests/s\n", cache ? "on" : "off", clients, count / elapsed);
+    fflush(stdout);
+    std::string cmd = "rm -rf " + root;
+    if (system(cmd.c_str()) != 0) printf("remove %s failed\n", root.c_str());
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
@@ -0,0 +1,73 @@
+/*请求解析的内存分配测试：统计HttpContext解析一个带20个头部字段的请求需要多少次堆内存分配，以及每个请求的耗时
+    ./bench_http_alloc [请求数]
+    请求已经全部在缓冲区中，只测试解析，不包括网络收发和业务处理
+*/
+#include <atomic>
+#include <chrono>
+#include "../source/http/http.hpp"
+
+static uint64_t g_allocs = 0;//只在主线程中解析，不需要原子操作
+
+void *operator new(size_t size) {
+    g_allocs++;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+std::string BuildRequest() {
+    std::string req = "GET /index.html?user=xiaoming&pass=123123 HTTP/1.1\r\n";
+    req += "Host: 127.0.0.1:8500\r\n";
+    req += "Connection: keep-alive\r\n";
+    req += "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n";
+    req += "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
+    req += "Accept-Encoding: gzip, deflate, br\r\n";
+    req += "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n";
+    req += "Cache-Control: max-age=0\r\n";
+    req += "Upgrade-Insecure-Requests: 1\r\n";
+    req += "Sec-Fetch-Site: none\r\n";
+    req += "Sec-Fetch-Mode: navigate\r\n";
+    req += "Sec-Fetch-User: ?1\r\n";
+    req += "Sec-Fetch-Dest: document\r\n";
+    req += "Cookie: session=4f6c2b1a9d8e7f60; theme=dark\r\n";
+    req += "DNT: 1\r\n";
+    req += "Referer: http://127.0.0.1:8500/\r\n";
+    req += "If-None-Match: \"5f2b-1a2b3c\"\r\n";
+    req += "If-Modified-Since: Mon, 01 Jan 2024 00:00:00 GMT\r\n";
+    req += "Pragma: no-cache\r\n";
+    req += "X-Request-Id: 0123456789abcdef\r\n";
+    req += "X-Forwarded-For: 10.0.0.1\r\n";
+    req += "\r\n";
+    return req;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    std::string req = BuildRequest();
+    Buffer buf;
+    HttpContext context;
+    //预热：让缓冲区空间、正则表达式等一次性的分配先完成
+    for (int i = 0; i < 100; i++) {
+        buf.WriteStringAndPush(req);
+        context.RecvHttpRequest(&buf);
+        context.ReSet();
+    }
+    uint64_t allocs = g_allocs;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        buf.WriteStringAndPush(req);
+        context.RecvHttpRequest(&buf);
+        if (context.RecvStatu() != RECV_HTTP_OVER) {
+            printf("parse failed: %d\n", context.RespStatu());
+            return 1;
+        }
+        context.ReSet();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%d requests, %zu bytes each: %.1f allocations/request, %.0f ns/request\n",
+           count, req.size(), (double)(g_allocs - allocs) / count, elapsed * 1e9 / count);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*请求解析吞吐测试：单线程统计HttpContext每秒能解析多少个请求
+    ./bench_http_parse [秒数]
+    small：最小的GET请求；browser：浏览器发出的带20个头部字段的GET请求
+    whole表示请求一次性到达，split表示请求按64字节分段到达，每段到达后都调用一次解析
+*/
+#include <chrono>
+#include "../source/http/http.hpp"
+
+std::string SmallRequest() {
+    return "GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+}
+std::string BrowserRequest() {
+    std::string req = "GET /index.html?user=xiaoming&pass=123123 HTTP/1.1\r\n";
+    req += "Host: 127.0.0.1:8500\r\n";
+    req += "Connection: keep-alive\r\n";
+    req += "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n";
+    req += "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
+    req += "Accept-Encoding: gzip, deflate, br\r\n";
+    req += "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n";
+    req += "Cache-Control: max-age=0\r\n";
+    req += "Upgrade-Insecure-Requests: 1\r\n";
+    req += "Sec-Fetch-Site: none\r\n";
+    req += "Sec-Fetch-Mode: navigate\r\n";
+    req += "Sec-Fetch-User: ?1\r\n";
+    req += "Sec-Fetch-Dest: document\r\n";
+    req += "Cookie: session=4f6c2b1a9d8e7f60; theme=dark\r\n";
+    req += "DNT: 1\r\n";
+    req += "Referer: http://127.0.0.1:8500/\r\n";
+    req += "If-None-Match: \"5f2b-1a2b3c\"\r\n";
+    req += "If-Modified-Since: Mon, 01 Jan 2024 00:00:00 GMT\r\n";
+    req += "Pragma: no-cache\r\n";
+    req += "X-Request-Id: 0123456789abcdef\r\n";
+    req += "X-Forwarded-For: 10.0.0.1\r\n";
+    req += "\r\n";
+    return req;
+}
+
+void Run(const char *name, const std::string &req, size_t segment, int seconds) {
+    Buffer buf;
+    HttpContext context;
+    uint64_t count = 0;
+    auto begin = std::chrono::steady_clock::now();
+    auto end = begin + std::chrono::seconds(seconds);
+    while (true) {
+        for (int i = 0; i < 1000; i++) {
+            for (size_t off = 0; off < req.size(); off += segment) {
+                buf.WriteAndPush(req.c_str() + off, std::min(segment, req.size() - off));
+                context.RecvHttpRequest(&buf);
+            }
+            if (context.RecvStatu() != RECV_HTTP_OVER) {
+                printf("parse failed: %d\n", context.RespStatu());
+                exit(1);
+            }
+            context.ReSet();
+        }
+        count += 1000;
+        if (std::chrono::steady_clock::now() >= end) break;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("  %-16s %4zu bytes: %10.0f requests/s\n", name, req.size(), count / elapsed);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    std::string small = SmallRequest(), browser = BrowserRequest();
+    Run("small whole", small, small.size(), seconds);
+    Run("browser whole", browser, browser.size(), seconds);
+    Run("small split", small, 64, seconds);
+    Run("browser split", browser, 64, seconds);
+    return 0;
+}
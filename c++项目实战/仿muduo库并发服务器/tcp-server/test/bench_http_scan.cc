@@ -0,0 +1,104 @@
+/*头部扫描测试：在接近真实的头部数据上对比逐字节、SSE4.2、AVX2三种实现
+    ./bench_http_scan [秒数]
+    语料是几个带大Cookie（4~8KB）和JWT认证头的浏览器请求
+    scan：只扫描字段名和字段值的吞吐；parse：HttpContext完整解析请求的吞吐
+*/
+#include <chrono>
+#include <random>
+#include "../source/http/http.hpp"
+
+std::string RandomText(std::mt19937 &rng, size_t len, const char *chars) {
+    std::string str(len, ' ');
+    size_t n = strlen(chars);
+    for (auto &c : str) c = chars[rng() % n];
+    return str;
+}
+std::vector<std::string> Corpus() {
+    std::mt19937 rng(7);
+    const char *b64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    std::vector<std::string> reqs;
+    for (size_t cookie : {4096, 6144, 7900}) {//单行不能超过MAX_LINE
+        std::string req = "GET /api/v1/orders?page=2&size=50 HTTP/1.1\r\n";
+        req += "Host: shop.example.com\r\n";
+        req += "Connection: keep-alive\r\n";
+        req += "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n";
+        req += "Accept: application/json, text/plain, */*\r\n";
+        req += "Accept-Encoding: gzip, deflate, br\r\n";
+        req += "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n";
+        req += "Authorization: Bearer " + RandomText(rng, 300, b64) + "." + RandomText(rng, 900, b64) + "." + RandomText(rng, 342, b64) + "\r\n";
+        std::string cookies;
+        while (cookies.size() < cookie) {
+            if (!cookies.empty()) cookies += "; ";
+            cookies += RandomText(rng, 4 + rng() % 12, "abcdefghijklmnopqrstuvwxyz_") + "=" + RandomText(rng, 16 + rng() % 200, b64);
+        }
+        req += "Cookie: " + cookies + "\r\n";
+        req += "Referer: https://shop.example.com/orders\r\n";
+        req += "X-Request-Id: " + RandomText(rng, 32, "0123456789abcdef") + "\r\n";
+        req += "Sec-Fetch-Site: same-origin\r\n";
+        req += "Sec-Fetch-Mode: cors\r\n";
+        req += "\r\n";
+        reqs.push_back(req);
+    }
+    return reqs;
+}
+
+//按照解析器的方式扫描：字段名扫描到冒号，跳过空白，字段值扫描到行尾
+size_t ScanHeaders(const HttpScanner::Impl &impl, const std::string &req) {
+    const char *data = req.c_str();
+    size_t len = req.size(), pos = req.find('\n') + 1, fields = 0;
+    while (pos < len && data[pos] != '\r') {
+        pos += impl._token(data + pos, len - pos);
+        pos++;
+        while (data[pos] == ' ') pos++;
+        pos += impl._value(data + pos, len - pos);
+        pos += 2;
+        fields++;
+    }
+    return fields;
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1;
+    std::vector<std::string> corpus = Corpus();
+    size_t bytes = 0;
+    for (auto &req : corpus) bytes += req.size();
+    printf("corpus: %zu requests, %zu bytes\n", corpus.size(), bytes);
+    for (auto &impl : HttpScanner::Impls()) {
+        uint64_t rounds = 0, fields = 0;
+        auto begin = std::chrono::steady_clock::now();
+        double elapsed;
+        do {
+            for (int i = 0; i < 1000; i++) {
+                for (auto &req : corpus) fields += ScanHeaders(impl, req);
+            }
+            rounds += 1000;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        } while (elapsed < seconds);
+        double scan = rounds * bytes / elapsed / 1e9;
+
+        HttpScanner::Select(impl);
+        Buffer buf;
+        HttpContext context;
+        uint64_t parsed = 0;
+        begin = std::chrono::steady_clock::now();
+        do {
+            for (int i = 0; i < 100; i++) {
+                for (auto &req : corpus) {
+                    buf.WriteStringAndPush(req);
+                    context.RecvHttpRequest(&buf);
+                    if (context.RecvStatu() != RECV_HTTP_OVER) {
+                        printf("parse failed: %d\n", context.RespStatu());
+                        return 1;
+                    }
+                    context.ReSet();
+                }
+            }
+            parsed += 100 * corpus.size();
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        } while (elapsed < seconds);
+        printf("  %-8s scan %6.2f GB/s   parse %8.0f requests/s %s\n", impl._name, scan, parsed / elapsed, fields ? "" : "?");
+        fflush(stdout);
+    }
+    return 0;
+}
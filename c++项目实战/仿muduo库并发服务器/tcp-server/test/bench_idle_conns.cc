@@ -0,0 +1,92 @@
+/*空闲连接内存测试：建立N个空闲连接，统计每个连接占用的常驻内存
+    ./bench_idle_conns [连接数] [大数据连接数] [大数据大小MB] [服务器线程数]
+    1. 建立N个连接，不收发数据
+    2. 每个连接收发一次小消息
+    3. 部分连接各上传一次大数据（服务器收齐之后才处理，接收缓冲区会扩容到数据大小），
+       之后空闲，等待大缓冲区收缩
+*/
+#include <atomic>
+#include <chrono>
+#include "../source/server.hpp"
+#include "bench_util.hpp"
+
+static std::atomic<int> g_connected(0);
+static size_t g_big_size = 0;
+
+void OnConnected(const PtrConnection &conn) { g_connected++; }
+//以'\n'结尾的是小消息，直接回复；否则是大数据，收齐之后再回复
+void OnMessage(const PtrConnection &conn, Buffer *buf) {
+    if (buf->ReadPosition()[buf->ReadAbleSize() - 1] == '\n') {
+        conn->Send(buf->ReadPosition(), buf->ReadAbleSize());
+        buf->MoveReadOffset(buf->ReadAbleSize());
+        return;
+    }
+    if (buf->ReadAbleSize() < g_big_size) return;
+    buf->MoveReadOffset(buf->ReadAbleSize());
+    conn->Send("ok\n", 3);
+}
+//相对于base增加的常驻内存平均到每个连接，单位字节
+double BytesPerConn(long base, int count) { return (RssKB() - base) * 1024.0 / count; }
+bool SendAll(int fd, const char *data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t ret = send(fd, data + sent, len - sent, 0);
+        if (ret <= 0) return false;
+        sent += ret;
+    }
+    return true;
+}
+bool RecvLine(int fd) {
+    char c;
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (c == '\n') return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 5000;
+    int bigs = argc > 2 ? atoi(argv[2]) : 8;
+    int big_mb = argc > 3 ? atoi(argv[3]) : 8;
+    int threads = argc > 4 ? atoi(argv[4]) : 2;
+    int shrink_delay = 2;
+    g_big_size = (size_t)big_mb << 20;
+    uint16_t port = 8606;
+
+    std::thread server_thread([=]() {
+        TcpServer server(port);
+        server.SetThreadCount(threads);
+        server.SetConnectedCallback(OnConnected);
+        server.SetMessageCallback(OnMessage);
+        server.SetBufferShrinkDelay(shrink_delay);
+        server.Start();
+    });
+    usleep(200000);
+    long base = RssKB();
+    std::vector<int> fds;
+    for (int i = 0; i < count; i++) {
+        Socket *sock = new Socket;//描述符由进程结束时回收
+        if (sock->CreateClient(port, "127.0.0.1") == false) return 1;
+        fds.push_back(sock->Fd());
+    }
+    while (g_connected.load() < count) usleep(1000);
+    usleep(200000);
+    printf("%d idle connections:            %6.0f bytes/conn\n", count, BytesPerConn(base, count));
+    for (int fd : fds) {
+        if (SendAll(fd, "hello\n", 6) == false || RecvLine(fd) == false) return 1;
+    }
+    usleep(200000);
+    printf("after one small message each:    %6.0f bytes/conn\n", BytesPerConn(base, count));
+    std::string big(g_big_size, 'x');
+    for (int i = 0; i < bigs && i < count; i++) {
+        if (SendAll(fds[i], big.c_str(), big.size()) == false || RecvLine(fds[i]) == false) return 1;
+    }
+    std::string().swap(big);//客户端的数据不计入统计
+    usleep(200000);
+    printf("after %d x %d MB uploads:         %6.0f bytes/conn\n", bigs, big_mb, BytesPerConn(base, count));
+    sleep(shrink_delay + 2);
+    printf("idle %ds later:                   %6.0f bytes/conn\n", shrink_delay + 2, BytesPerConn(base, count));
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
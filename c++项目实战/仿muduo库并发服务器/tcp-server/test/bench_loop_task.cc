@@ -0,0 +1,70 @@
+/*任务池测试：统计EventLoop投递并执行一个任务的耗时和堆内存分配次数
+    ./bench_loop_task [任务数]
+    每批压入64个任务后执行一次RunAllTask，任务都是连接模块中常见的形式：
+    std::bind(成员函数, shared_ptr)、std::bind(成员函数, this, shared_ptr, 参数)、捕获shared_ptr和字符串的lambda
+    另外统计在EventLoop线程中直接RunInLoop执行的开销
+*/
+#include <chrono>
+#include "../source/server.hpp"
+
+static uint64_t g_allocs = 0;//只在主线程中测试，不需要原子操作
+
+void *operator new(size_t size) {
+    g_allocs++;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+class Target {
+    public:
+        uint64_t _count = 0;
+        void Handle() { _count++; }
+        void HandleWith(const std::shared_ptr<Target> &other, int n) { _count += n + (other ? 1 : 0); }
+};
+
+template<class Make>
+void Measure(const char *name, EventLoop *loop, int count, Make make) {
+    uint64_t allocs = g_allocs;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i += 64) {
+        for (int j = 0; j < 64; j++) loop->QueueInLoop(make());
+        loop->RunAllTask();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("  queue  %-36s %5.2f allocations/task %7.1f ns/task\n", name, (double)(g_allocs - allocs) / count, elapsed * 1e9 / count);
+}
+template<class Make>
+void MeasureDirect(const char *name, EventLoop *loop, int count, Make make) {
+    uint64_t allocs = g_allocs;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) loop->RunInLoop(make());
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("  direct %-36s %5.2f allocations/task %7.1f ns/task\n", name, (double)(g_allocs - allocs) / count, elapsed * 1e9 / count);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    EventLoop loop;//在主线程中构造，主线程就是它的EventLoop线程
+    auto target = std::make_shared<Target>();
+    Target *self = target.get();
+    std::string payload(24, 'x');
+    loop.RunAllTask();//预热任务池的空间
+    Measure("bind(&Handle, shared_ptr)", &loop, count, [&]() {
+        return std::bind(&Target::Handle, target);
+    });
+    Measure("bind(&HandleWith, this, shared_ptr, n)", &loop, count, [&]() {
+        return std::bind(&Target::HandleWith, self, target, 1);
+    });
+    Measure("lambda[shared_ptr, string]", &loop, count, [&]() {
+        return [target, payload]() { target->_count += payload.size(); };
+    });
+    MeasureDirect("bind(&HandleWith, this, shared_ptr, n)", &loop, count, [&]() {
+        return std::bind(&Target::HandleWith, self, target, 1);
+    });
+    if (target->_count == 0) printf("?\n");
+    return 0;
+}
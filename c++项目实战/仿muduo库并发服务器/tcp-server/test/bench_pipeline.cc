@@ -0,0 +1,120 @@
+/*HTTP流水线测试：每个客户端一次发送16个请求，收齐16个响应后再发送下一批，统计服务器每个请求的系统调用次数
+    ./bench_pipeline [cork(1/0)] [客户端数] [批数] [流水线深度]
+    程序中重新定义了epoll_ctl/epoll_wait/send/sendmsg/recv/read/write，统计次数后通过syscall转发，
+    客户端直接使用syscall收发数据，不计入统计
+*/
+#include <atomic>
+#include <chrono>
+#include <sys/syscall.h>
+#include "../source/http/http.hpp"
+
+static std::atomic<uint64_t> g_epoll_ctl(0), g_epoll_wait(0), g_send(0), g_recv(0), g_rw(0);
+
+extern "C" {
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev) {
+    g_epoll_ctl++;
+    return syscall(SYS_epoll_ctl, epfd, op, fd, ev);
+}
+int epoll_wait(int epfd, struct epoll_event *evs, int max, int timeout) {
+    g_epoll_wait++;
+    return syscall(SYS_epoll_wait, epfd, evs, max, timeout);
+}
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+    g_send++;
+    return syscall(SYS_sendto, fd, buf, len, flags, NULL, 0);
+}
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    g_send++;
+    return syscall(SYS_sendmsg, fd, msg, flags);
+}
+ssize_t recv(int fd, void *buf, size_t len, int flags) {
+    g_recv++;
+    return syscall(SYS_recvfrom, fd, buf, len, flags, NULL, NULL);
+}
+//eventfd/timerfd的读写
+ssize_t read(int fd, void *buf, size_t len) {
+    g_rw++;
+    return syscall(SYS_read, fd, buf, len);
+}
+ssize_t write(int fd, const void *buf, size_t len) {
+    g_rw++;
+    return syscall(SYS_write, fd, buf, len);
+}
+}
+
+void Hello(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent("hello world", "text/plain");
+}
+
+int Connect(uint16_t port) {
+    int fd = syscall(SYS_socket, AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (syscall(SYS_connect, fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) return -1;
+    return fd;
+}
+//接收len字节
+bool RecvN(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t ret = syscall(SYS_recvfrom, fd, buf + got, len - got, 0, NULL, NULL);
+        if (ret <= 0) return false;
+        got += ret;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool cork = argc > 1 ? atoi(argv[1]) != 0 : true;
+    int clients = argc > 2 ? atoi(argv[2]) : 4;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5000;
+    int depth = argc > 4 ? atoi(argv[4]) : 16;
+    uint16_t port = 8604;
+
+    std::thread server_thread([=]() {
+        HttpServer server(port);
+        server.SetThreadCount(1);
+        server.EnableCork(cork);
+        server.Get("/hello", Hello);
+        server.Listen();
+    });
+    usleep(200000);
+    std::string req = "GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+    std::string batch;
+    for (int i = 0; i < depth; i++) batch += req;
+    //先发送一个请求，得到一个响应的长度（所有响应都是一样的）
+    int probe = Connect(port);
+    syscall(SYS_sendto, probe, req.c_str(), req.size(), 0, NULL, 0);
+    char head[4096];
+    ssize_t n = syscall(SYS_recvfrom, probe, head, sizeof(head), 0, NULL, NULL);
+    size_t rsp_len = n > 0 ? n : 0;
+    std::vector<int> fds;
+    for (int i = 0; i < clients; i++) fds.push_back(Connect(port));
+    usleep(100000);
+    uint64_t ctl0 = g_epoll_ctl, wait0 = g_epoll_wait, send0 = g_send, recv0 = g_recv, rw0 = g_rw;
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+        int fd = fds[i];
+        threads.emplace_back([=, &batch]() {
+            std::vector<char> buf(rsp_len * depth);
+            for (int r = 0; r < rounds; r++) {
+                syscall(SYS_sendto, fd, batch.c_str(), batch.size(), 0, NULL, 0);
+                if (RecvN(fd, buf.data(), buf.size()) == false) { printf("recv failed\n"); break; }
+            }
+        });
+    }
+    for (auto &th : threads) th.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double reqs = (double)clients * rounds * depth;
+    uint64_t ctl = g_epoll_ctl - ctl0, wait = g_epoll_wait - wait0, snd = g_send - send0, rcv = g_recv - recv0, rw = g_rw - rw0;
+    printf("cork %s, %d clients, depth %d: %.0f req/s, syscalls/req %.3f "
+           "(epoll_ctl %.3f, epoll_wait %.3f, send %.3f, recv %.3f, read/write %.3f)\n",
+           cork ? "on " : "off", clients, depth, reqs / elapsed, (ctl + wait + snd + rcv + rw) / reqs,
+           ctl / reqs, wait / reqs, snd / reqs, rcv / reqs, rw / reqs);
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
@@ -0,0 +1,98 @@
+/*响应组织的内存分配和拷贝测试：对比原来用stringstream组织响应和直接写入发送缓冲区的Serialize
+    ./bench_response [响应数] [正文大小...]
+    每个响应都是 处理函数SetContent + Connection头部 + 组织到发送缓冲区 + 发送缓冲区中的数据全部取走
+    统计每个响应的堆内存分配次数和字节数、拷贝到发送缓冲区的字节数（共享片段方式引用的正文不算），以及耗时
+    SetContent拷贝正文是两种方式共有的，包含在统计中
+*/
+#include <chrono>
+#include <sstream>
+#include "../source/http/http.hpp"
+
+static uint64_t g_allocs = 0;//只在主线程中组织响应，不需要原子操作
+static uint64_t g_alloc_bytes = 0;
+
+void *operator new(size_t size) {
+    g_allocs++;
+    g_alloc_bytes += size;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+//原来的HttpResponse和SendResponse：头部放在unordered_map中，stringstream组织后调用两次str()发送
+struct LegacyResponse {
+    int _statu = 200;
+    std::string _body;
+    std::unordered_map<std::string, std::string> _headers;
+    void SetHeader(const std::string &key, const std::string &val) { _headers.insert(std::make_pair(key, val)); }
+    bool HasHeader(const std::string &key) { return _headers.find(key) != _headers.end(); }
+    void SetContent(const std::string &body, const std::string &type) {
+        _body = body;
+        SetHeader("Content-Type", type);
+    }
+};
+void LegacySend(const std::string &version, LegacyResponse &rsp, OutBuffer *out) {
+    if (rsp._body.empty() == false && rsp.HasHeader("Content-Length") == false) {
+        rsp.SetHeader("Content-Length", std::to_string(rsp._body.size()));
+    }
+    std::stringstream rsp_str;
+    rsp_str << version << " " << std::to_string(rsp._statu) << " " << Util::StatuDesc(rsp._statu) << "\r\n";
+    for (auto &head : rsp._headers) {
+        rsp_str << head.first << ": " << head.second << "\r\n";
+    }
+    rsp_str << "\r\n";
+    rsp_str << rsp._body;
+    out->WriteAndPush(rsp_str.str().c_str(), rsp_str.str().size());
+}
+
+struct Result { double _allocs, _alloc_bytes, _copied, _ns; };
+
+template <typename F>
+Result Run(int count, F &&respond) {
+    OutBuffer out;
+    for (int i = 0; i < 100; i++) {//预热：发送缓冲区空间、状态行表、Date缓存等一次性的分配先完成
+        respond(&out);
+        out.MoveReadOffset(out.ReadAbleSize());
+    }
+    uint64_t allocs = g_allocs, alloc_bytes = g_alloc_bytes, copied = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        respond(&out);
+        copied += out.ReadAbleSize() - out.SliceSize();
+        out.MoveReadOffset(out.ReadAbleSize());
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return Result{(double)(g_allocs - allocs) / count, (double)(g_alloc_bytes - alloc_bytes) / count,
+                  (double)copied / count, elapsed * 1e9 / count};
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    std::vector<size_t> sizes;
+    for (int i = 2; i < argc; i++) sizes.push_back(strtoul(argv[i], NULL, 10));
+    if (sizes.empty()) sizes = {64, 4096, 65536};
+    std::string version = "HTTP/1.1";
+    printf("%-10s %8s %10s %12s %14s %10s\n", "", "body", "allocs", "heap bytes", "copied bytes", "ns");
+    for (size_t size : sizes) {
+        std::string body(size, 'b');
+        int n = size >= 65536 ? count / 10 : count;
+        Result legacy = Run(n, [&](OutBuffer *out) {
+            LegacyResponse rsp;
+            rsp.SetContent(body, "text/plain");
+            rsp.SetHeader("Connection", "keep-alive");
+            LegacySend(version, rsp, out);
+        });
+        Result direct = Run(n, [&](OutBuffer *out) {
+            HttpResponse rsp;
+            rsp.SetContent(body, "text/plain");
+            rsp.SetHeader("Connection", "keep-alive");
+            rsp.Serialize(version, out);
+        });
+        printf("%-10s %8zu %10.1f %12.0f %14.0f %10.0f\n", "stream", size, legacy._allocs, legacy._alloc_bytes, legacy._copied, legacy._ns);
+        printf("%-10s %8zu %10.1f %12.0f %14.0f %10.0f\n", "serialize", size, direct._allocs, direct._alloc_bytes, direct._copied, direct._ns);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*环形缓冲区测试：对比环形模式和原来的搬移整理模式下，持续流式数据的吞吐
+    ./bench_ring_buffer [ring/linear] [秒数] [积压字节数]
+    1. buffer：单线程不停地写入大小不一的数据块，读取时保持一定量的积压（下游处理不过来的流式数据），
+       普通模式末尾空间不够时要把积压的数据搬到起始位置，环形模式不需要
+    2. tcp：客户端持续发送数据流，服务器每次只取走完整的40000字节帧，剩余的半帧留在输入缓冲区中
+*/
+#include <atomic>
+#include <chrono>
+#include <random>
+#include "../source/server.hpp"
+
+#define FRAME_SIZE 40000
+
+double StreamBuffer(bool ring, int seconds, uint64_t backlog) {
+    std::vector<char> src(64 * 1024, 'x');
+    std::mt19937 rng(1);
+    Buffer buf;
+    buf.EnableRing(ring);
+    uint64_t bytes = 0, check = 0;
+    auto begin = std::chrono::steady_clock::now();
+    auto end = begin + std::chrono::seconds(seconds);
+    while (true) {
+        for (int i = 0; i < 1024; i++) {
+            uint64_t len = 4096 + rng() % (60 * 1024);
+            buf.WriteAndPush(&src[0], len);
+            bytes += len;
+            //保持积压量在backlog附近，取走的量随机
+            if (buf.ReadAbleSize() > backlog) {
+                uint64_t take = buf.ReadAbleSize() - backlog + rng() % (16 * 1024);
+                take = std::min(take, buf.ReadAbleSize());
+                check += buf.ReadPosition()[take - 1];
+                buf.MoveReadOffset(take);
+            }
+        }
+        if (std::chrono::steady_clock::now() >= end) break;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (check == 0) printf("?");
+    return bytes / elapsed / 1024 / 1024;
+}
+
+static std::atomic<uint64_t> g_bytes(0);
+
+void OnMessage(const PtrConnection &conn, Buffer *buf) {
+    uint64_t frames = buf->ReadAbleSize() / FRAME_SIZE;
+    if (frames == 0) return;
+    buf->MoveReadOffset(frames * FRAME_SIZE);
+    g_bytes += frames * FRAME_SIZE;
+}
+
+double StreamTcp(bool ring, int seconds) {
+    uint16_t port = 8607;
+    std::thread server_thread([=]() {
+        TcpServer server(port);
+        server.EnableRingBuffer(ring);
+        server.SetMessageCallback(OnMessage);
+        server.Start();
+    });
+    server_thread.detach();
+    usleep(200000);
+    std::atomic<bool> running(true);
+    std::thread client([&]() {
+        Socket cli_sock;
+        if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+        std::vector<char> data(16 * 1024 + 123, 'y');//不与帧大小对齐，缓冲区中总会留下半帧
+        while (running.load()) {
+            if (send(cli_sock.Fd(), &data[0], data.size(), 0) <= 0) break;
+        }
+    });
+    usleep(200000);
+    uint64_t start = g_bytes.load();
+    auto begin = std::chrono::steady_clock::now();
+    sleep(seconds);
+    uint64_t count = g_bytes.load() - start;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    running = false;
+    client.detach();
+    return count / elapsed / 1024 / 1024;
+}
+
+int main(int argc, char *argv[])
+{
+    bool ring = argc > 1 ? std::string(argv[1]) == "ring" : true;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    uint64_t backlog = argc > 3 ? strtoull(argv[3], NULL, 10) : 256 * 1024;
+    printf("%s buffer\n", ring ? "ring" : "linear");
+    printf("  buffer: %8.0f MB/s (backlog %lu bytes)\n", StreamBuffer(ring, seconds, backlog), backlog);
+    fflush(stdout);
+    printf("  tcp:    %8.0f MB/s (%d byte frames)\n", StreamTcp(ring, seconds), FRAME_SIZE);
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
@@ -0,0 +1,90 @@
+/*路由查找测试：对比基数树路由和原来逐个正则匹配的路由，查找耗时随路由数量的变化
+    ./bench_router [每项测试的毫秒数]
+    每个资源注册两条路由 /api/v1/res<i> 和 /api/v1/res<i>/{id:int}（正则版本为 /api/v1/res<i>/(\d+) ）
+    1. first：请求第一条路由
+    2. last：请求最后注册的路由，原来的实现要把前边所有的正则都匹配一遍
+    3. random：随机请求已注册的路由
+    4. miss：请求不存在的路由
+*/
+#include <chrono>
+#include <random>
+#include "../source/http/http.hpp"
+
+static uint64_t g_hits = 0;
+
+void Handle(const HttpRequest &req, HttpResponse *rsp) {
+    g_hits += req._captures.size() + 1;
+}
+
+//原来的实现：按注册顺序逐个进行正则匹配
+class LegacyRouter {
+    private:
+        std::vector<std::pair<std::regex, HttpRouter::Handler>> _handlers;
+    public:
+        void Add(const std::string &pattern, const HttpRouter::Handler &handler) {
+            _handlers.push_back(std::make_pair(std::regex(pattern), handler));
+        }
+        const HttpRouter::Handler *Match(HttpRequest *req) {
+            for (auto &handler : _handlers) {
+                if (std::regex_match(req->_path, req->_matches, handler.first)) return &handler.second;
+            }
+            return NULL;
+        }
+};
+
+template<class Router>
+double Lookup(Router &router, const std::vector<std::string> &paths, int ms) {
+    HttpRequest req;
+    uint64_t count = 0;
+    auto begin = std::chrono::steady_clock::now();
+    auto end = begin + std::chrono::milliseconds(ms);
+    while (true) {
+        for (int i = 0; i < 16; i++) {
+            req._path = paths[count % paths.size()];
+            const HttpRouter::Handler *handler = router.Match(&req);
+            if (handler) (*handler)(req, NULL);
+            count++;
+        }
+        if (std::chrono::steady_clock::now() >= end) break;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return elapsed * 1e9 / count;
+}
+
+int main(int argc, char *argv[])
+{
+    int ms = argc > 1 ? atoi(argv[1]) : 300;
+    int sizes[] = {10, 100, 400, 1000};
+    printf("%6s %8s %12s %12s %8s\n", "routes", "case", "trie ns", "regex ns", "speedup");
+    for (int size : sizes) {
+        HttpRouter trie;
+        LegacyRouter legacy;
+        for (int i = 0; i < size / 2; i++) {
+            std::string base = "/api/v1/res" + std::to_string(i);
+            trie.Add(base, Handle);
+            trie.Add(base + "/{id:int}", Handle);
+            legacy.Add(base, Handle);
+            legacy.Add(base + "/(\\d+)", Handle);
+        }
+        std::mt19937 rng(1);
+        std::vector<std::pair<const char *, std::vector<std::string>>> cases = {
+            {"first", {"/api/v1/res0"}},
+            {"last", {"/api/v1/res" + std::to_string(size / 2 - 1) + "/12345"}},
+            {"random", {}},
+            {"miss", {"/api/v2/res0/12345"}},
+        };
+        for (int i = 0; i < 1024; i++) {
+            std::string path = "/api/v1/res" + std::to_string(rng() % (size / 2));
+            if (rng() % 2) path += "/" + std::to_string(rng() % 100000);
+            cases[2].second.push_back(path);
+        }
+        for (auto &c : cases) {
+            double t = Lookup(trie, c.second, ms);
+            double l = Lookup(legacy, c.second, ms);
+            printf("%6d %8s %12.0f %12.0f %7.0fx\n", size, c.first, t, l, l / t);
+            fflush(stdout);
+        }
+    }
+    if (g_hits == 0) printf("?\n");
+    return 0;
+}
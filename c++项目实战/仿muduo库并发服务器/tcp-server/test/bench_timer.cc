@@ -0,0 +1,476 @@
+/*定时器后端基准测试：时间轮 / 小根堆(懒删除) / multimap / 分层时间轮
+    1. TimerWheel: 与server.hpp中的TimerWheel逻辑一致(shared_ptr析构触发任务，刷新就是再压入一个shared_ptr)，1s一格，60格
+    2. MultimapTimer: 与c++并发编程/工作线程管理定时器/TimerManager.hpp一致的数据结构(multimap + id->iterator)，去掉了工作线程和锁
+    3. HeapTimer: TimerManager.hpp注释中描述的双堆懒删除方案(任务堆 + 删除堆)
+    4. HierWheel: 分层时间轮，1ms精度，4层(256/64/64/64)，侵入式双向链表，取消和刷新都是O(1)
+  使用模拟时钟驱动，所以测出来的是数据结构本身的开销，而不是timerfd/条件变量的开销
+  三种负载：
+    idle     -- 连接空闲超时，大量连接频繁刷新
+    deadline -- 请求超时，绝大多数在超时前被取消
+    periodic -- 周期定时器，同一时刻集中触发
+  输出：add/refresh/cancel/expire 的 ns/op，每个存活定时器的内存占用，触发延迟(实际触发时间-期望触发时间)的分位数
+*/
+#include <map>
+#include <queue>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <malloc.h>
+#include "../source/server.hpp"
+
+/*统计堆内存，用于计算每个定时器的内存占用*/
+static int64_t g_live_bytes = 0;
+void *operator new(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) throw std::bad_alloc();
+    g_live_bytes += malloc_usable_size(ptr);
+    return ptr;
+}
+void operator delete(void *ptr) noexcept {
+    if (ptr == NULL) return;
+    g_live_bytes -= malloc_usable_size(ptr);
+    free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+using TimerCallback = std::function<void()>;
+
+/*1. 与server.hpp一致的时间轮，秒级精度*/
+class WheelTimer {
+    private:
+        using WeakTask = std::weak_ptr<TimerTask>;
+        using PtrTask = std::shared_ptr<TimerTask>;
+        int _tick;
+        int _capacity;
+        uint64_t _now_ms;
+        std::vector<std::vector<PtrTask>> _wheel;
+        std::unordered_map<uint64_t, WeakTask> _timers;
+    private:
+        void RemoveTimer(uint64_t id) { _timers.erase(id); }
+        static uint32_t ToTicks(uint64_t delay_ms) {
+            uint32_t ticks = (delay_ms + 999) / 1000;
+            return ticks == 0 ? 1 : ticks;
+        }
+    public:
+        static const char *Name() { return "TimerWheel"; }
+        WheelTimer():_tick(0), _capacity(60), _now_ms(0), _wheel(_capacity) {}
+        ~WheelTimer() {
+            //测试结束时轮子里剩余的任务不再执行
+            for (auto &slot : _wheel) {
+                for (auto &pt : slot) pt->Cancel();
+            }
+            _wheel.clear();
+        }
+        void Add(uint64_t id, uint64_t delay_ms, const TimerCallback &cb) {
+            PtrTask pt(new TimerTask(id, ToTicks(delay_ms), cb));
+            pt->SetRelease(std::bind(&WheelTimer::RemoveTimer, this, id));
+            int pos = (_tick + pt->DelayTime()) % _capacity;
+            _wheel[pos].push_back(pt);
+            _timers[id] = WeakTask(pt);
+        }
+        void Refresh(uint64_t id) {
+            auto it = _timers.find(id);
+            if (it == _timers.end()) return;
+            PtrTask pt = it->second.lock();
+            if (!pt) return;
+            int pos = (_tick + pt->DelayTime()) % _capacity;
+            _wheel[pos].push_back(pt);
+        }
+        void Cancel(uint64_t id) {
+            auto it = _timers.find(id);
+            if (it == _timers.end()) return;
+            PtrTask pt = it->second.lock();
+            if (pt) pt->Cancel();
+        }
+        void Advance(uint64_t now_ms) {
+            //秒针每1000ms走一格
+            while (_now_ms + 1000 <= now_ms) {
+                _now_ms += 1000;
+                _tick = (_tick + 1) % _capacity;
+                std::vector<PtrTask> slot;
+                slot.swap(_wheel[_tick]);//先换出来再释放，任务回调中重新添加定时器不会操作正在清空的数组
+            }
+        }
+};
+
+/*2. 与TimerManager.hpp一致的multimap实现*/
+class MultimapTimer {
+    private:
+        struct Timer {
+            uint64_t id;
+            uint64_t delay;
+            TimerCallback cb;
+        };
+        uint64_t _now_ms;
+        std::multimap<uint64_t, Timer> _timermap;
+        std::unordered_map<uint64_t, std::multimap<uint64_t, Timer>::iterator> _timer_inmap;
+    public:
+        static const char *Name() { return "multimap"; }
+        MultimapTimer():_now_ms(0) {}
+        void Add(uint64_t id, uint64_t delay_ms, const TimerCallback &cb) {
+            auto it = _timermap.emplace(_now_ms + delay_ms, Timer{id, delay_ms, cb});
+            _timer_inmap[id] = it;
+        }
+        void Refresh(uint64_t id) {
+            auto it = _timer_inmap.find(id);
+            if (it == _timer_inmap.end()) return;
+            Timer timer = std::move(it->second->second);
+            _timermap.erase(it->second);
+            it->second = _timermap.emplace(_now_ms + timer.delay, std::move(timer));
+        }
+        void Cancel(uint64_t id) {
+            auto it = _timer_inmap.find(id);
+            if (it == _timer_inmap.end()) return;
+            _timermap.erase(it->second);
+            _timer_inmap.erase(it);
+        }
+        void Advance(uint64_t now_ms) {
+            _now_ms = now_ms;
+            while (!_timermap.empty() && _timermap.begin()->first <= now_ms) {
+                Timer timer = std::move(_timermap.begin()->second);
+                _timermap.erase(_timermap.begin());
+                _timer_inmap.erase(timer.id);
+                timer.cb();
+            }
+        }
+};
+
+/*3. 双堆懒删除：取消只是往删除堆里压一个记录，任务堆顶与删除堆顶相同时两边同时弹出*/
+class HeapTimer {
+    private:
+        struct Key {
+            uint64_t expire;
+            uint64_t seq; //区分同一时刻的不同定时器
+            bool operator>(const Key &o) const {
+                return expire != o.expire ? expire > o.expire : seq > o.seq;
+            }
+            bool operator==(const Key &o) const { return expire == o.expire && seq == o.seq; }
+        };
+        struct Entry {
+            Key key;
+            uint64_t id;
+            bool operator>(const Entry &o) const { return key > o.key; }
+        };
+        struct Timer {
+            Key key;
+            uint64_t delay;
+            TimerCallback cb;
+        };
+        uint64_t _now_ms;
+        uint64_t _seq;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> _tasks;
+        std::priority_queue<Key, std::vector<Key>, std::greater<Key>> _deleted;
+        std::unordered_map<uint64_t, Timer> _timers;
+    public:
+        static const char *Name() { return "two-heap"; }
+        HeapTimer():_now_ms(0), _seq(0) {}
+        void Add(uint64_t id, uint64_t delay_ms, const TimerCallback &cb) {
+            Key key{_now_ms + delay_ms, _seq++};
+            _tasks.push(Entry{key, id});
+            _timers[id] = Timer{key, delay_ms, cb};
+        }
+        void Refresh(uint64_t id) {
+            auto it = _timers.find(id);
+            if (it == _timers.end()) return;
+            _deleted.push(it->second.key);
+            it->second.key = Key{_now_ms + it->second.delay, _seq++};
+            _tasks.push(Entry{it->second.key, id});
+        }
+        void Cancel(uint64_t id) {
+            auto it = _timers.find(id);
+            if (it == _timers.end()) return;
+            _deleted.push(it->second.key);
+            _timers.erase(it);
+        }
+        void Advance(uint64_t now_ms) {
+            _now_ms = now_ms;
+            while (!_tasks.empty() && _tasks.top().key.expire <= now_ms) {
+                Entry top = _tasks.top();
+                _tasks.pop();
+                if (!_deleted.empty() && _deleted.top() == top.key) {
+                    _deleted.pop();
+                    continue;
+                }
+                auto it = _timers.find(top.id);
+                TimerCallback cb = std::move(it->second.cb);
+                _timers.erase(it);
+                cb();
+            }
+        }
+};
+
+/*4. 分层时间轮：第0层256格(1ms一格)，往上每层64格，到期时上层的桶逐级下放*/
+class HierWheel {
+    private:
+        struct Node {
+            uint64_t id;
+            uint64_t expire;
+            uint64_t delay;
+            TimerCallback cb;
+            Node *prev;
+            Node *next;
+        };
+        static const int LEVELS = 4;
+        static const int ROOT_BITS = 8;
+        static const int LEVEL_BITS = 6;
+        uint64_t _now_ms;
+        std::vector<Node> _heads; //每个桶一个哨兵节点
+        std::unordered_map<uint64_t, Node *> _timers;
+    private:
+        static int SlotCount(int level) { return level == 0 ? (1 << ROOT_BITS) : (1 << LEVEL_BITS); }
+        static int Shift(int level) { return level == 0 ? 0 : ROOT_BITS + (level - 1) * LEVEL_BITS; }
+        Node *Head(int level, int slot) {
+            int base = 0;
+            for (int i = 0; i < level; i++) base += SlotCount(i);
+            return &_heads[base + slot];
+        }
+        static void Unlink(Node *node) {
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+        }
+        void Link(Node *node) {
+            uint64_t expire = node->expire > _now_ms ? node->expire : _now_ms + 1;
+            uint64_t delta = expire - _now_ms;
+            int level = 0;
+            while (level < LEVELS - 1 && delta >= (1ULL << Shift(level + 1))) level++;
+            int slot = (expire >> Shift(level)) & (SlotCount(level) - 1);
+            Node *head = Head(level, slot);
+            node->next = head;
+            node->prev = head->prev;
+            head->prev->next = node;
+            head->prev = node;
+        }
+        //把上层桶中的定时器重新按照剩余时间放到下层
+        void Cascade(int level) {
+            int slot = (_now_ms >> Shift(level)) & (SlotCount(level) - 1);
+            Node *head = Head(level, slot);
+            Node *node = head->next;
+            head->next = head->prev = head;
+            while (node != head) {
+                Node *next = node->next;
+                Link(node);
+                node = next;
+            }
+            if (slot == 0 && level + 1 < LEVELS) Cascade(level + 1);
+        }
+        void Tick() {
+            _now_ms++;
+            if ((_now_ms & ((1 << ROOT_BITS) - 1)) == 0) Cascade(1);
+            Node *head = Head(0, _now_ms & ((1 << ROOT_BITS) - 1));
+            while (head->next != head) {
+                Node *node = head->next;
+                Unlink(node);
+                _timers.erase(node->id);
+                TimerCallback cb = std::move(node->cb);
+                delete node;
+                cb();
+            }
+        }
+    public:
+        static const char *Name() { return "hier-wheel"; }
+        HierWheel():_now_ms(0) {
+            int total = 0;
+            for (int i = 0; i < LEVELS; i++) total += SlotCount(i);
+            _heads.resize(total);
+            for (auto &head : _heads) head.prev = head.next = &head;
+        }
+        ~HierWheel() {
+            for (auto &it : _timers) delete it.second;
+        }
+        void Add(uint64_t id, uint64_t delay_ms, const TimerCallback &cb) {
+            Node *node = new Node{id, _now_ms + delay_ms, delay_ms, cb, NULL, NULL};
+            _timers[id] = node;
+            Link(node);
+        }
+        void Refresh(uint64_t id) {
+            auto it = _timers.find(id);
+            if (it == _timers.end()) return;
+            Unlink(it->second);
+            it->second->expire = _now_ms + it->second->delay;
+            Link(it->second);
+        }
+        void Cancel(uint64_t id) {
+            auto it = _timers.find(id);
+            if (it == _timers.end()) return;
+            Unlink(it->second);
+            delete it->second;
+            _timers.erase(it);
+        }
+        void Advance(uint64_t now_ms) {
+            while (_now_ms < now_ms) Tick();
+        }
+};
+
+/*统计结果*/
+struct OpStat {
+    uint64_t ns = 0;
+    uint64_t count = 0;
+    void Add(uint64_t n, uint64_t c) { ns += n; count += c; }
+    double PerOp() const { return count ? (double)ns / count : 0; }
+};
+struct Report {
+    OpStat add, refresh, cancel, expire;
+    double bytes_per_timer = 0;
+    std::vector<int64_t> lateness; //触发延迟, ms, 时间轮按格触发，可能为负(提前触发)
+};
+
+/*所有负载都以1ms为模拟时钟的步长*/
+template<class TimerImpl>
+class Workload {
+    private:
+        TimerImpl _timers;
+        uint64_t _now;
+        int64_t _timer_bytes; //只统计定时器操作本身引起的堆内存变化
+        std::vector<uint64_t> _due; //每个定时器期望的触发时间
+        std::mt19937_64 _rng;
+        Report _report;
+    private:
+        TimerCallback OnFire(uint64_t id) {
+            return [this, id]() {
+                _report.lateness.push_back((int64_t)(_now - _due[id]));
+                _report.expire.count++;
+            };
+        }
+        void Advance() {
+            _now++;
+            int64_t bytes = g_live_bytes;
+            uint64_t start = NowNs();
+            _timers.Advance(_now);
+            _report.expire.ns += NowNs() - start;
+            _timer_bytes += g_live_bytes - bytes;
+        }
+        void AddTimers(uint64_t first, uint64_t n, uint64_t delay) {
+            int64_t bytes = g_live_bytes;
+            uint64_t start = NowNs();
+            for (uint64_t id = first; id < first + n; id++) {
+                _due[id] = _now + delay;
+                _timers.Add(id, delay, OnFire(id));
+            }
+            _report.add.Add(NowNs() - start, n);
+            _timer_bytes += g_live_bytes - bytes;
+        }
+    public:
+        Workload(uint64_t max_timers):_now(0), _timer_bytes(0), _due(max_timers), _rng(12345) {
+            _report.lateness.reserve(max_timers);
+        }
+        /*连接空闲超时：N个连接，超时时间30s，每毫秒随机刷新一批连接的活跃度*/
+        Report Idle(uint64_t conns, uint64_t refresh_per_ms, uint64_t run_ms) {
+            const uint64_t delay = 30000;
+            AddTimers(0, conns, delay);
+            _report.bytes_per_timer = (double)_timer_bytes / conns;
+            std::vector<uint64_t> ids(refresh_per_ms);
+            for (uint64_t t = 0; t < run_ms; t++) {
+                for (auto &id : ids) id = _rng() % conns;
+                int64_t bytes = g_live_bytes;
+                uint64_t start = NowNs();
+                for (auto id : ids) {
+                    _due[id] = _now + delay;
+                    _timers.Refresh(id);
+                }
+                _report.refresh.Add(NowNs() - start, ids.size());
+                _timer_bytes += g_live_bytes - bytes;
+                Advance();
+            }
+            return _report;
+        }
+        /*请求超时：每毫秒新增一批5s超时的定时器，其中95%在3s内被取消*/
+        /*内存按高峰时刻真正存活(未超时也未取消)的定时器数量计算，被取消但还没回收的任务也算在里边*/
+        Report Deadline(uint64_t adds_per_ms, uint64_t run_ms) {
+            const uint64_t delay = 5000;
+            uint64_t next_id = 0;
+            std::vector<std::vector<uint64_t>> cancel_at(run_ms + 3001); //按取消时间分桶
+            for (uint64_t t = 0; t < run_ms + delay * 2; t++) {
+                if (t < run_ms) {
+                    AddTimers(next_id, adds_per_ms, delay);
+                    for (uint64_t i = 0; i < adds_per_ms; i++) {
+                        if (_rng() % 100 < 95) cancel_at[_now + 1 + _rng() % 3000].push_back(next_id + i);
+                    }
+                    next_id += adds_per_ms;
+                }
+                if (_now < cancel_at.size()) {
+                    int64_t bytes = g_live_bytes;
+                    uint64_t start = NowNs();
+                    for (auto id : cancel_at[_now]) _timers.Cancel(id);
+                    _report.cancel.Add(NowNs() - start, cancel_at[_now].size());
+                    _timer_bytes += g_live_bytes - bytes;
+                }
+                if (t + 1 == run_ms) {
+                    uint64_t live = next_id - _report.expire.count - _report.cancel.count;
+                    _report.bytes_per_timer = (double)_timer_bytes / live;
+                }
+                Advance();
+            }
+            return _report;
+        }
+        /*周期定时器：M个周期100ms~1s的定时器在同一时刻启动，触发后用新的id重新添加*/
+        Report Periodic(uint64_t timers, uint64_t run_ms) {
+            std::vector<uint64_t> periods(timers);
+            uint64_t next_id = 0;
+            std::function<void(uint64_t, uint64_t)> arm = [&](uint64_t slot, uint64_t id) {
+                _due[id] = _now + periods[slot];
+                _timers.Add(id, periods[slot], [this, id, slot, &arm, &next_id, run_ms]() {
+                    _report.lateness.push_back((int64_t)(_now - _due[id]));
+                    _report.expire.count++;
+                    if (_now < run_ms) arm(slot, next_id++);
+                });
+            };
+            int64_t bytes = g_live_bytes;
+            uint64_t start = NowNs();
+            for (uint64_t i = 0; i < timers; i++) {
+                periods[i] = 100 * (1 + _rng() % 10);
+                arm(i, next_id++);
+            }
+            _report.add.Add(NowNs() - start, timers);
+            _report.bytes_per_timer = (double)(g_live_bytes - bytes) / timers;
+            for (uint64_t t = 0; t < run_ms + 2000; t++) Advance();
+            return _report;
+        }
+};
+
+static int64_t Percentile(std::vector<int64_t> &v, double p) {
+    if (v.empty()) return 0;
+    size_t idx = std::min(v.size() - 1, (size_t)(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+static void Print(const char *workload, const char *name, Report r) {
+    printf("%-9s %-11s add %7.1f  refresh %7.1f  cancel %7.1f  expire %7.1f  B/timer %6.0f  "
+           "late(ms) p1 %5ld p50 %5ld p99 %5ld p999 %5ld\n",
+           workload, name, r.add.PerOp(), r.refresh.PerOp(), r.cancel.PerOp(), r.expire.PerOp(),
+           r.bytes_per_timer, Percentile(r.lateness, 0.01), Percentile(r.lateness, 0.5), Percentile(r.lateness, 0.99),
+           Percentile(r.lateness, 0.999));
+}
+
+template<class TimerImpl>
+static void Run(uint64_t scale) {
+    {
+        Workload<TimerImpl> w(50000 * scale);
+        Print("idle", TimerImpl::Name(), w.Idle(50000 * scale, 50, 60000));
+    }
+    {
+        Workload<TimerImpl> w(20 * scale * 20000);
+        Print("deadline", TimerImpl::Name(), w.Deadline(20 * scale, 20000));
+    }
+    {
+        //周期定时器最短100ms，10s内最多重新添加100次
+        Workload<TimerImpl> w(10000 * scale * 101);
+        Print("periodic", TimerImpl::Name(), w.Periodic(10000 * scale, 10000));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t scale = argc > 1 ? std::stoul(argv[1]) : 1;
+    printf("ns/op for add/refresh/cancel/expire, heap bytes per live timer, firing lateness percentiles\n");
+    Run<WheelTimer>(scale);
+    Run<MultimapTimer>(scale);
+    Run<HeapTimer>(scale);
+    Run<HierWheel>(scale);
+    return 0;
+}
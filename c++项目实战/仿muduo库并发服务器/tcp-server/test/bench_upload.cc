@@ -0,0 +1,100 @@
+/*大文件上传测试：对比三种保存上传正文的方式的吞吐和服务器线程的CPU占用
+    ./bench_upload [buffered/sink/splice] [每次上传MB数] [上传次数] [保存目录]
+    buffered: 正文放到_body中，处理函数用Util::WriteFile写入文件（原来的PutFile）
+    sink:     FileSink边接收边write到文件，数据仍然要从内核拷贝到用户态再拷贝回内核
+    splice:   FileSink零拷贝模式，输入缓冲区之外的正文从socket经过管道splice到文件
+    服务器只有一个线程，CPU时间通过该线程的CPU时钟统计
+*/
+#include <chrono>
+#include "../source/http/http.hpp"
+
+static std::string g_dir;
+
+int OpenSink(HttpRequest &req) {
+    return FileSink::Open(req, g_dir + "/upload.bin");
+}
+int OpenSplice(HttpRequest &req) {
+    return FileSink::Open(req, g_dir + "/upload.bin", 0, true);
+}
+void Saved(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent(std::to_string(static_cast<FileSink *>(req._sink.get())->Size()), "text/plain");
+}
+void Buffered(const HttpRequest &req, HttpResponse *rsp) {
+    Util::WriteFile(g_dir + "/upload.bin", req._body);
+    rsp->SetContent(std::to_string(req._body.size()), "text/plain");
+}
+
+double ThreadCpu(std::thread &thread) {
+    clockid_t cid;
+    struct timespec ts;
+    if (pthread_getcpuclockid(thread.native_handle(), &cid) != 0 || clock_gettime(cid, &ts) != 0) return 0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//上传一次，返回服务器回复的保存字节数
+size_t Upload(int fd, const std::vector<char> &block, size_t bytes) {
+    std::string req = "PUT /upload HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: " + std::to_string(bytes) + "\r\n\r\n";
+    send(fd, req.c_str(), req.size(), 0);
+    for (size_t sent = 0; sent < bytes;) {
+        size_t len = std::min(block.size(), bytes - sent);
+        ssize_t ret = send(fd, &block[0], len, 0);
+        if (ret <= 0) return 0;
+        sent += ret;
+    }
+    std::string data;
+    char buf[4096];
+    size_t end;
+    while ((end = data.find("\r\n\r\n")) == std::string::npos || data.size() < end + 5) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) return 0;
+        data.append(buf, ret);
+    }
+    size_t pos = data.find("Content-Length: ");
+    size_t len = strtoul(data.c_str() + pos + 16, NULL, 10);
+    while (data.size() < end + 4 + len) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) return 0;
+        data.append(buf, ret);
+    }
+    return strtoul(data.c_str() + end + 4, NULL, 10);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "splice";
+    size_t mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+    int rounds = argc > 3 ? atoi(argv[3]) : 4;
+    g_dir = argc > 4 ? argv[4] : "/tmp";
+    uint16_t port = 8614;
+    std::thread server_thread([=]() {
+        HttpServer server(port);
+        if (mode == "buffered") {
+            server.Put("/upload", Buffered);
+        }else {
+            server.Put("/upload", Saved, mode == "splice" ? OpenSplice : OpenSink);
+        }
+        server.Listen();
+    });
+    usleep(200000);
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    std::vector<char> block(1024 * 1024, 'u');
+    size_t bytes = mb * 1024 * 1024;
+    double cpu_begin = ThreadCpu(server_thread);
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        if (Upload(cli_sock.Fd(), block, bytes) != bytes) {
+            printf("upload %d failed\n", i);
+            fflush(stdout);
+            _exit(1);
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double cpu = ThreadCpu(server_thread) - cpu_begin;
+    double gb = (double)bytes * rounds / 1024 / 1024 / 1024;
+    printf("%-8s %d x %zu MB: %.2f GB/s, server thread cpu %.2f s (%.2f s per GB)\n",
+           mode.c_str(), rounds, mb, gb / elapsed, cpu, cpu / gb);
+    unlink((g_dir + "/upload.bin").c_str());
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
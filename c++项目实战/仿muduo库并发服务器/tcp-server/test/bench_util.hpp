@@ -0,0 +1,16 @@
+#ifndef __M_BENCH_UTIL_H__
+#define __M_BENCH_UTIL_H__
+/*性能测试程序共用的辅助函数*/
+#include <cstdio>
+#include <unistd.h>
+
+//进程常驻内存，单位KB
+inline long RssKB() {
+    long pages = 0, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2) rss = 0;
+    fclose(fp);
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+#endif
@@ -0,0 +1,246 @@
+/*请求正文接收器测试：大文件上传时正文边接收边写入文件，内存占用与正文大小无关
+    ./http_body_sink_test [上传MB数]
+    1. 同样大小的上传分别交给FileSink和放到_body中，对比服务器进程峰值内存的增长，比较保存下来的文件
+    2. chunked编码的上传、超过大小限制（Content-Length提前拒绝和接收过程中超出）
+    3. 处理不过来的接收器：每收到一段数据就暂停，在其他线程中延迟后恢复，后边流水线的请求照常处理
+    4. 零拷贝模式：剩余的正文通过splice写入文件，后边流水线的请求留在socket中照常处理
+*/
+#include "../source/http/http.hpp"
+
+static int g_failed = 0;
+static std::string g_root;
+
+//进程的峰值内存，单位KB
+size_t PeakKB() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return strtoul(line.c_str() + 6, NULL, 10);
+    }
+    return 0;
+}
+void ResetPeak() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return;
+    if (write(fd, "5", 1) < 0) printf("reset peak memory failed\n");
+    close(fd);
+}
+
+void Check(const char *name, bool ok) {
+    if (ok) return;
+    printf("%s: failed\n", name);
+    g_failed++;
+}
+
+//接收一个Content-Length的响应，返回状态码，正文放到body中
+int Recv(int fd, std::string *data, std::string *body) {
+    char buf[4096];
+    size_t end;
+    while ((end = data->find("\r\n\r\n")) == std::string::npos) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) return 0;
+        data->append(buf, ret);
+    }
+    int statu = atoi(data->c_str() + 9);
+    size_t pos = data->find("Content-Length: ");
+    size_t len = (pos == std::string::npos || pos > end) ? 0 : strtoul(data->c_str() + pos + 16, NULL, 10);
+    while (data->size() < end + 4 + len) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) return 0;
+        data->append(buf, ret);
+    }
+    body->assign(*data, end + 4, len);
+    data->erase(0, end + 4 + len);
+    return statu;
+}
+
+//上传总共bytes字节的正文，内容按位置生成，chunked为true时每64KB一个块
+int Upload(uint16_t port, const std::string &path, size_t bytes, bool chunked, std::string *body) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    std::string req = "PUT " + path + " HTTP/1.1\r\nConnection: keep-alive\r\n";
+    req += chunked ? "Transfer-Encoding: chunked\r\n\r\n" : "Content-Length: " + std::to_string(bytes) + "\r\n\r\n";
+    send(fd, req.c_str(), req.size(), MSG_NOSIGNAL);
+    std::vector<char> block(64 * 1024);
+    for (size_t sent = 0; sent < bytes;) {
+        size_t len = std::min(block.size(), bytes - sent);
+        for (size_t i = 0; i < len; i++) block[i] = (char)((sent + i) * 131 >> 8);
+        if (chunked) {
+            char line[32];
+            int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+            send(fd, line, n, MSG_NOSIGNAL);
+        }
+        if (send(fd, &block[0], len, MSG_NOSIGNAL) <= 0) break;//服务器提前拒绝并关闭了连接
+        if (chunked) send(fd, "\r\n", 2, MSG_NOSIGNAL);
+        sent += len;
+    }
+    if (chunked) send(fd, "0\r\n\r\n", 5, MSG_NOSIGNAL);
+    std::string data;
+    return Recv(fd, &data, body);
+}
+
+bool Verify(const std::string &file, size_t bytes) {
+    std::string content;
+    if (Util::ReadFile(file, &content) == false || content.size() != bytes) return false;
+    for (size_t i = 0; i < bytes; i++) {
+        if (content[i] != (char)(i * 131 >> 8)) return false;
+    }
+    return true;
+}
+
+int OpenFile(HttpRequest &req) {
+    return FileSink::Open(req, g_root + req._path);
+}
+int OpenSplice(HttpRequest &req) {
+    return FileSink::Open(req, g_root + "/sink" + req._path.substr(req._path.rfind('/')), 0, true);
+}
+int OpenNoDir(HttpRequest &req) {
+    return FileSink::Open(req, g_root + "/nodir" + req._path);
+}
+int OpenLimited(HttpRequest &req) {
+    return FileSink::Open(req, g_root + "/limited", 1024 * 1024);
+}
+void Saved(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent(std::to_string(static_cast<FileSink *>(req._sink.get())->Size()), "text/plain");
+}
+void Buffered(const HttpRequest &req, HttpResponse *rsp) {
+    Util::WriteFile(g_root + req._path, req._body);
+    rsp->SetContent(std::to_string(req._body.size()), "text/plain");
+}
+
+//每收到一段数据就暂停，1ms后在其他线程中恢复
+class SlowSink : public HttpBodySink {
+    public:
+        size_t _size = 0;
+        int _pauses = 0;
+        bool Write(const char *data, size_t len) override {
+            _size += len;
+            _pauses++;
+            Pause();
+            std::thread([this]() { usleep(1000); Resume(); }).detach();
+            return true;
+        }
+};
+static std::shared_ptr<SlowSink> g_slow;
+int OpenSlow(HttpRequest &req) {
+    g_slow = std::make_shared<SlowSink>();
+    req.SetBodySink(g_slow);
+    return 0;
+}
+void SlowDone(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent(std::to_string(g_slow->_size), "text/plain");
+}
+void Echo(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent("[" + req._body + "]", "text/plain");
+}
+
+void TestSlow(uint16_t port) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    size_t bytes = 4 * 1024 * 1024;
+    std::string req = "POST /slow HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: " + std::to_string(bytes) + "\r\n\r\n";
+    req += std::string(bytes, 's');
+    req += "POST /echo HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: 4\r\n\r\nnext";
+    std::thread sender([&]() { send(fd, req.c_str(), req.size(), MSG_NOSIGNAL); });
+    std::string data, body;
+    int statu = Recv(fd, &data, &body);
+    Check("slow sink", statu == 200 && body == std::to_string(bytes));
+    statu = Recv(fd, &data, &body);
+    Check("after slow sink", statu == 200 && body == "[next]");
+    sender.join();
+    printf("slow sink: %zu bytes, paused %d times\n", g_slow->_size, g_slow->_pauses);
+}
+
+//头部和一部分正文一起到达（通过Write写入），剩余的正文splice，后边紧跟着下一个请求
+void TestSplicePipeline(uint16_t port) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    size_t bytes = 8 * 1024 * 1024 + 3;
+    std::string content(bytes, 0);
+    for (size_t i = 0; i < bytes; i++) content[i] = (char)(i * 131 >> 8);
+    std::string req = "PUT /splice/d HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: " + std::to_string(bytes) + "\r\n\r\n";
+    req += content.substr(0, 1000);
+    send(fd, req.c_str(), req.size(), 0);
+    usleep(50000);
+    req = content.substr(1000) + "POST /echo HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: 4\r\n\r\nnext";
+    std::thread sender([&]() { send(fd, req.c_str(), req.size(), MSG_NOSIGNAL); });
+    std::string data, body;
+    int statu = Recv(fd, &data, &body);
+    Check("splice pipeline", statu == 200 && body == std::to_string(bytes) && Verify(g_root + "/sink/d", bytes));
+    statu = Recv(fd, &data, &body);
+    Check("after splice", statu == 200 && body == "[next]");
+    sender.join();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+    size_t bytes = mb * 1024 * 1024;
+    char tmpl[] = "/tmp/http_body_sink_XXXXXX";
+    g_root = mkdtemp(tmpl);
+    uint16_t port = 8613;
+    std::thread([=]() {
+        HttpServer server(port);
+        server.Put("/sink/{name}", Saved, OpenFile);
+        server.Put("/buffered/{name}", Buffered);
+        server.Put("/limited", Saved, OpenLimited);
+        server.Put("/missing/{name}", Saved, OpenNoDir);
+        server.Put("/splice/{name}", Saved, OpenSplice);
+        server.Post("/slow", SlowDone, OpenSlow);
+        server.Post("/echo", Echo);
+        server.Listen();
+    }).detach();
+    usleep(200000);
+    mkdir((g_root + "/sink").c_str(), 0755);
+    mkdir((g_root + "/buffered").c_str(), 0755);
+
+    std::string body;
+    //1. 峰值内存对比，先测接收器，避免_body释放后的内存留在进程中影响结果
+    ResetPeak();
+    size_t base = PeakKB();
+    auto begin = std::chrono::steady_clock::now();
+    int statu = Upload(port, "/sink/a", bytes, false, &body);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    size_t sink_kb = PeakKB() - base;
+    Check("sink upload", statu == 200 && body == std::to_string(bytes) && Verify(g_root + "/sink/a", bytes));
+    printf("sink:     %4zu MB upload, peak memory +%6zu KB, %.0f MB/s\n", mb, sink_kb, mb / elapsed);
+    ResetPeak();
+    base = PeakKB();
+    begin = std::chrono::steady_clock::now();
+    statu = Upload(port, "/buffered/a", bytes, false, &body);
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    size_t buffered_kb = PeakKB() - base;
+    Check("buffered upload", statu == 200 && Verify(g_root + "/buffered/a", bytes));
+    printf("buffered: %4zu MB upload, peak memory +%6zu KB, %.0f MB/s\n", mb, buffered_kb, mb / elapsed);
+    Check("sink memory bounded", sink_kb < 16 * 1024 && sink_kb * 4 < buffered_kb);
+    //2. chunked上传和大小限制
+    statu = Upload(port, "/sink/b", 3 * 1024 * 1024 + 5, true, &body);
+    Check("chunked sink", statu == 200 && Verify(g_root + "/sink/b", 3 * 1024 * 1024 + 5));
+    Check("limit by length", Upload(port, "/limited", 2 * 1024 * 1024, false, &body) == 413);
+    Check("limit while receiving", Upload(port, "/limited", 2 * 1024 * 1024, true, &body) == 413);
+    Check("limit keeps no file", access((g_root + "/limited").c_str(), F_OK) != 0);
+    Check("missing directory", Upload(port, "/missing/c", 1024, false, &body) == 500);
+    //3. 暂停和恢复
+    TestSlow(port);
+    //4. 零拷贝模式
+    begin = std::chrono::steady_clock::now();
+    statu = Upload(port, "/splice/c", bytes, false, &body);
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    Check("splice upload", statu == 200 && body == std::to_string(bytes) && Verify(g_root + "/sink/c", bytes));
+    printf("splice:   %4zu MB upload, %.0f MB/s\n", mb, mb / elapsed);
+    TestSplicePipeline(port);
+
+    std::string cmd = "rm -rf " + g_root;
+    if (system(cmd.c_str()) != 0) printf("remove %s failed\n", g_root.c_str());
+    if (g_failed) {
+        printf("FAILED: %d checks\n", g_failed);
+        fflush(stdout);
+        _exit(1);
+    }
+    printf("OK\n");
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
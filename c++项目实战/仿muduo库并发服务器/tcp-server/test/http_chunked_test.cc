@@ -0,0 +1,276 @@
+/*chunked传输编码测试：请求正文的chunked解码，以及处理函数在其他线程中分块写入的流式响应
+    ./http_chunked_test
+    1. 请求：带扩展和尾部字段的chunked正文，逐字节分多次发送，和后续请求流水线发送，以及各种非法的编码和Content-Length
+    2. 响应：工作线程写入总共64MB的正文，发送缓冲区的高水位线只有1MB，客户端慢慢接收，
+       生产者超过高水位线后暂停，等发送缓冲区降下来再继续；HEAD和HTTP/1.0请求，以及流结束之后同一连接上的后续请求
+    3. 多个线程写入的同时另一个线程结束流，结束块之后不能再有数据块，后续请求的响应完整
+*/
+#include <map>
+#include "../source/http/http.hpp"
+
+#define STREAM_CHUNK (16 * 1024)
+#define STREAM_CHUNKS 4096
+#define HIGH_WATER (1024 * 1024)
+
+static int g_failed = 0;
+static std::atomic<int> g_paused(0);//生产者因为背压暂停的次数
+
+struct Reply {
+    int _statu;
+    std::map<std::string, std::string> _headers;
+    std::string _body;
+    size_t _chunks;
+};
+
+//缓冲区中的数据不足时继续从连接中接收
+bool Need(int fd, std::string *data, size_t len) {
+    char buf[65536];
+    while (data->size() < len) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) return false;
+        data->append(buf, ret);
+    }
+    return true;
+}
+bool Line(int fd, std::string *data, std::string *line) {
+    size_t pos;
+    while ((pos = data->find("\r\n")) == std::string::npos) {
+        if (Need(fd, data, data->size() + 1) == false) return false;
+    }
+    *line = data->substr(0, pos);
+    data->erase(0, pos + 2);
+    return true;
+}
+//接收一个完整的响应，正文按Content-Length、chunked或者连接关闭确定边界，data中保存多收的数据
+Reply Recv(int fd, std::string *data, bool head = false, int delay_us = 0) {
+    Reply reply = {0};
+    reply._chunks = 0;
+    std::string line;
+    if (Line(fd, data, &line) == false) return reply;
+    reply._statu = atoi(line.c_str() + 9);
+    while (Line(fd, data, &line) && line.empty() == false) {
+        size_t pos = line.find(": ");
+        reply._headers[line.substr(0, pos)] = line.substr(pos + 2);
+    }
+    if (head) return reply;
+    if (reply._headers["Transfer-Encoding"] == "chunked") {
+        while (Line(fd, data, &line)) {
+            size_t len = strtoul(line.c_str(), NULL, 16);
+            if (len == 0) {
+                Line(fd, data, &line);
+                break;
+            }
+            if (Need(fd, data, len + 2) == false) break;
+            reply._body.append(*data, 0, len);
+            data->erase(0, len + 2);
+            reply._chunks++;
+            if (delay_us && reply._chunks % 64 == 0) usleep(delay_us);//慢速的客户端
+        }
+    }else if (reply._headers.count("Content-Length")) {
+        size_t len = std::stoul(reply._headers["Content-Length"]);
+        Need(fd, data, len);
+        reply._body = data->substr(0, len);
+        data->erase(0, len);
+    }else {
+        while (Need(fd, data, data->size() + 1));
+        reply._body.swap(*data);
+    }
+    return reply;
+}
+
+void Check(const char *name, bool ok) {
+    if (ok) return;
+    printf("%s: failed\n", name);
+    g_failed++;
+}
+
+//请求正文加上括号返回，空的正文也有响应正文
+void Echo(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent("[" + req._body + "]", "text/plain");
+}
+//在工作线程中分块写入，超过高水位线后等待发送缓冲区降下来再继续
+void Produce(std::shared_ptr<HttpStream> stream, size_t next) {
+    std::string chunk(STREAM_CHUNK, 0);
+    while (next < STREAM_CHUNKS) {
+        memset(&chunk[0], 'a' + next % 26, chunk.size());
+        bool more = stream->Write(chunk);
+        next++;
+        if (more == false) {
+            if (stream->Aborted()) return;
+            g_paused++;
+            //降到低水位线以下后换一个线程继续，生产者不需要阻塞等待
+            stream->OnWritable([stream, next]() { std::thread(Produce, stream, next).detach(); });
+            return;
+        }
+    }
+    stream->Close();
+}
+void Stream(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetHeader("Content-Type", "text/plain");
+    std::shared_ptr<HttpStream> stream = rsp->OpenStream();
+    stream->Write("first ");//头部发送之前写入的数据
+    std::thread(Produce, stream, 0).detach();
+}
+//在处理函数中直接写完
+void Small(const HttpRequest &req, HttpResponse *rsp) {
+    std::shared_ptr<HttpStream> stream = rsp->OpenStream();
+    for (int i = 0; i < 10; i++) stream->Write(std::to_string(i));
+    stream->Close();
+}
+
+//多个线程同时写入，另一个线程在写入的过程中结束流
+void Race(const HttpRequest &req, HttpResponse *rsp) {
+    std::shared_ptr<HttpStream> stream = rsp->OpenStream();
+    for (int i = 0; i < 4; i++) {
+        std::thread([stream]() {
+            //结束之后的写入返回false并被丢弃
+            for (int i = 0; i < 2000; i++) {
+                stream->Write("0123456789abcdef");
+                if (i % 50 == 0) usleep(100);
+            }
+        }).detach();
+    }
+    std::thread([stream]() {
+        usleep(2000);
+        stream->Close();
+    }).detach();
+}
+
+std::string Expected() {
+    std::string body = "first ";
+    for (size_t i = 0; i < STREAM_CHUNKS; i++) body.append(STREAM_CHUNK, 'a' + i % 26);
+    return body;
+}
+
+void TestRequest(uint16_t port) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    std::string data;
+    //逐字节发送，解码器要能在任意位置停下并继续
+    std::string req = "POST /echo HTTP/1.1\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n"
+                      "5;name=value\r\nhello\r\n1\r\n \r\n000A\r\n0123456789\r\n0\r\nX-Trailer: yes\r\n\r\n";
+    for (char c : req) {
+        send(fd, &c, 1, 0);
+        usleep(100);
+    }
+    Reply reply = Recv(fd, &data);
+    Check("chunked body", reply._statu == 200 && reply._body == "[hello 0123456789]");
+    //流水线：chunked请求后边紧跟普通请求
+    req = "POST /echo HTTP/1.1\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n"
+          "POST /echo HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: 3\r\n\r\nxyz"
+          "POST /echo HTTP/1.1\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n";
+    send(fd, req.c_str(), req.size(), 0);
+    Check("pipelined chunked", Recv(fd, &data)._body == "[abc]");
+    Check("pipelined length", Recv(fd, &data)._body == "[xyz]");
+    reply = Recv(fd, &data);
+    Check("empty chunked", reply._statu == 200 && reply._body == "[]");
+    //大的块
+    std::string big(3 * 1024 * 1024 + 7, 'z');
+    char line[32];
+    snprintf(line, sizeof(line), "%zx\r\n", big.size());
+    req = std::string("POST /echo HTTP/1.1\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n") + line + big + "\r\n0\r\n\r\n";
+    std::thread sender([&]() { send(fd, req.c_str(), req.size(), 0); });
+    reply = Recv(fd, &data);
+    sender.join();
+    Check("big chunk", reply._body == "[" + big + "]");
+    //非法的编码，每个都会关闭连接
+    const char *bad[][2] = {
+        {"bad size", "Transfer-Encoding: chunked\r\n\r\nzz\r\n"},
+        {"missing crlf", "Transfer-Encoding: chunked\r\n\r\n3\r\nabcX\r\n0\r\n\r\n"},
+        {"size overflow", "Transfer-Encoding: chunked\r\n\r\n10000000000000000\r\n"},
+        {"not final", "Transfer-Encoding: chunked, gzip\r\n\r\n"},
+        {"with length", "Transfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n"},
+        {"unsupported", "Transfer-Encoding: gzip, chunked\r\n\r\n"},
+        {"length not digits", "Content-Length: abc\r\n\r\n"},
+        {"negative length", "Content-Length: -1\r\n\r\n"},
+        {"length overflow", "Content-Length: 99999999999999999999\r\n\r\n"},
+    };
+    int statu[] = {400, 400, 400, 400, 400, 501, 400, 400, 400};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        Socket sock;
+        if (sock.CreateClient(port, "127.0.0.1") == false) abort();
+        req = std::string("POST /echo HTTP/1.1\r\n") + bad[i][1];
+        send(sock.Fd(), req.c_str(), req.size(), 0);
+        std::string rest;
+        Check(bad[i][0], Recv(sock.Fd(), &rest)._statu == statu[i]);
+    }
+}
+
+void TestStream(uint16_t port) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    std::string data;
+    //流式响应后边流水线的请求，要等流结束后才处理
+    std::string req = "GET /stream HTTP/1.1\r\nConnection: keep-alive\r\n\r\nGET /small HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    send(fd, req.c_str(), req.size(), 0);
+    auto begin = std::chrono::steady_clock::now();
+    Reply reply = Recv(fd, &data, false, 200);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    Check("stream body", reply._statu == 200 && reply._body == Expected());
+    Check("stream framing", reply._headers.count("Content-Length") == 0 && reply._headers["Connection"] == "keep-alive");
+    Check("stream backpressure", g_paused > 0);
+    printf("stream: %zu bytes in %zu chunks, %.0f MB/s, producer paused %d times\n", reply._body.size(), reply._chunks,
+           reply._body.size() / elapsed / 1024 / 1024, g_paused.load());
+    reply = Recv(fd, &data);
+    Check("small after stream", reply._statu == 200 && reply._body == "0123456789");
+    //HEAD只有头部
+    req = "HEAD /small HTTP/1.1\r\nConnection: keep-alive\r\n\r\nGET /small HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    send(fd, req.c_str(), req.size(), 0);
+    reply = Recv(fd, &data, true);
+    Check("head", reply._statu == 200 && reply._headers["Transfer-Encoding"] == "chunked");
+    Check("after head", Recv(fd, &data)._body == "0123456789");
+    //HTTP/1.0不支持chunked，原样发送后关闭连接
+    Socket old_sock;
+    if (old_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    req = "GET /small HTTP/1.0\r\nConnection: keep-alive\r\n\r\n";
+    send(old_sock.Fd(), req.c_str(), req.size(), 0);
+    std::string rest;
+    reply = Recv(old_sock.Fd(), &rest);
+    Check("http/1.0", reply._body == "0123456789" && reply._headers["Connection"] == "close");
+}
+
+void TestRace(uint16_t port) {
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    std::string data;
+    std::string req = "GET /race HTTP/1.1\r\nConnection: keep-alive\r\n\r\nGET /small HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    for (int i = 0; i < 50; i++) {
+        send(fd, req.c_str(), req.size(), 0);
+        Reply reply = Recv(fd, &data);
+        Check("race stream", reply._statu == 200 && reply._body.size() == reply._chunks * 16);
+        reply = Recv(fd, &data);
+        if (reply._statu != 200 || reply._body != "0123456789") {
+            Check("after race", false);
+            return;
+        }
+    }
+}
+
+int main()
+{
+    uint16_t port = 8612;
+    std::thread([=]() {
+        HttpServer server(port);
+        server.SetWaterMarks(HIGH_WATER, HIGH_WATER / 4);
+        server.Post("/echo", Echo);
+        server.Get("/stream", Stream);
+        server.Get("/small", Small);
+        server.Get("/race", Race);
+        server.Listen();
+    }).detach();
+    usleep(200000);
+    TestRequest(port);
+    TestStream(port);
+    TestRace(port);
+    if (g_failed) {
+        printf("FAILED: %d checks\n", g_failed);
+        fflush(stdout);
+        _exit(1);
+    }
+    printf("OK\n");
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
@@ -0,0 +1,142 @@
+/*条件请求测试：静态文件（启用和不启用文件缓存）和设置了验证器的功能性请求，客户端缓存有效时都要回复304
+    ./http_conditional_test
+    所有请求都在同一个长连接上发送，304响应没有正文，后边的请求必须还能正确解析
+*/
+#include <map>
+#include "../source/http/http.hpp"
+
+static int g_failed = 0;
+static int g_generated = 0;//处理函数生成正文的次数
+
+struct Reply {
+    int _statu;
+    std::map<std::string, std::string> _headers;
+    std::string _body;
+};
+
+//按Content-Length收取一个完整的响应，304没有正文
+Reply Request(int fd, const std::string &path, const std::string &headers) {
+    std::string req = "GET " + path + " HTTP/1.1\r\nConnection: keep-alive\r\n" + headers + "\r\n";
+    send(fd, req.c_str(), req.size(), 0);
+    Reply reply = {0};
+    std::string data;
+    char buf[4096];
+    size_t need = std::string::npos;
+    while (data.size() < need) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) return reply;
+        data.append(buf, ret);
+        size_t end = data.find("\r\n\r\n");
+        if (need != std::string::npos || end == std::string::npos) continue;
+        reply._statu = atoi(data.c_str() + 9);
+        std::vector<std::string> lines;
+        Util::Split(data.substr(0, end), "\r\n", &lines);
+        for (size_t i = 1; i < lines.size(); i++) {
+            size_t pos = lines[i].find(": ");
+            reply._headers[lines[i].substr(0, pos)] = lines[i].substr(pos + 2);
+        }
+        auto it = reply._headers.find("Content-Length");
+        need = end + 4 + (it == reply._headers.end() ? 0 : std::stoul(it->second));
+    }
+    reply._body = data.substr(data.find("\r\n\r\n") + 4);
+    return reply;
+}
+
+void Expect(const char *name, const Reply &reply, int statu) {
+    if (reply._statu != statu) {
+        printf("%s: expect %d, got %d\n", name, statu, reply._statu);
+        g_failed++;
+    }
+    if (statu == 304 && (reply._body.empty() == false || reply._headers.count("Content-Length") || reply._headers.count("ETag") == 0)) {
+        printf("%s: 304 must carry ETag and no body\n", name);
+        g_failed++;
+    }
+}
+
+void Item(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetETag("item-v1");
+    if (rsp->NotModified(req)) return;
+    g_generated++;
+    rsp->SetContent("item body", "text/plain");
+}
+void Auto(const HttpRequest &req, HttpResponse *rsp) {
+    rsp->SetContent("auto body", "text/plain");
+    rsp->SetETag("auto-v1", true);
+    rsp->SetLastModified(1700000000);
+}
+
+void Run(bool cache, uint16_t port, const std::string &root) {
+    std::thread([=]() {
+        HttpServer server(port);
+        server.SetBaseDir(root);
+        server.EnableFileCache(cache);
+        server.Get("/api/item", Item);
+        server.Get("/api/auto", Auto);
+        server.Listen();
+    }).detach();
+    usleep(200000);
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    printf("file cache %s\n", cache ? "on" : "off");
+
+    Reply first = Request(fd, "/a.txt", "");
+    Expect("plain", first, 200);
+    std::string etag = first._headers["ETag"], last = first._headers["Last-Modified"];
+    if (etag.empty() || last.empty() || first._body != "version 1") {
+        printf("plain: missing validators or wrong body\n");
+        g_failed++;
+    }
+    printf("  ETag: %s  Last-Modified: %s\n", etag.c_str(), last.c_str());
+    std::string opaque = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+    Expect("if-none-match", Request(fd, "/a.txt", "If-None-Match: " + etag + "\r\n"), 304);
+    Expect("if-none-match list", Request(fd, "/a.txt", "If-None-Match: \"x\", " + etag + "\r\n"), 304);
+    Expect("if-none-match weak", Request(fd, "/a.txt", "If-None-Match: W/" + opaque + "\r\n"), 304);
+    Expect("if-none-match *", Request(fd, "/a.txt", "If-None-Match: *\r\n"), 304);
+    Expect("if-none-match other", Request(fd, "/a.txt", "If-None-Match: \"x\"\r\n"), 200);
+    Expect("if-modified-since", Request(fd, "/a.txt", "If-Modified-Since: " + last + "\r\n"), 304);
+    Expect("if-modified-since old", Request(fd, "/a.txt", "If-Modified-Since: Mon, 01 Jan 2001 00:00:00 GMT\r\n"), 200);
+    Expect("if-modified-since bad", Request(fd, "/a.txt", "If-Modified-Since: yesterday\r\n"), 200);
+    Expect("none-match wins", Request(fd, "/a.txt", "If-None-Match: \"x\"\r\nIf-Modified-Since: " + last + "\r\n"), 200);
+    //文件变化之后旧的验证器失效
+    Util::WriteFile(root + "/a.txt", "version 2");
+    usleep(100000);
+    Reply changed = Request(fd, "/a.txt", "If-None-Match: " + etag + "\r\n");
+    Expect("changed", changed, 200);
+    if (changed._body != "version 2" || changed._headers["ETag"] == etag) {
+        printf("changed: stale body or ETag\n");
+        g_failed++;
+    }
+    Util::WriteFile(root + "/a.txt", "version 1");
+    usleep(100000);
+    //功能性请求
+    int generated = g_generated;
+    Expect("handler", Request(fd, "/api/item", ""), 200);
+    Expect("handler 304", Request(fd, "/api/item", "If-None-Match: \"item-v1\"\r\n"), 304);
+    if (g_generated != generated + 1) {
+        printf("handler: body generated for a 304\n");
+        g_failed++;
+    }
+    Expect("auto 304", Request(fd, "/api/auto", "If-None-Match: \"auto-v1\"\r\n"), 304);
+    Expect("auto since", Request(fd, "/api/auto", "If-Modified-Since: " + Util::HttpDate(1700000000) + "\r\n"), 304);
+    Expect("auto 200", Request(fd, "/api/auto", "If-None-Match: \"auto-v2\"\r\n"), 200);
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/http_conditional_XXXXXX";
+    std::string root = mkdtemp(tmpl);
+    Util::WriteFile(root + "/a.txt", "version 1");
+    Run(false, 8609, root);
+    Run(true, 8610, root);
+    std::string cmd = "rm -rf " + root;
+    if (system(cmd.c_str()) != 0) printf("remove %s failed\n", root.c_str());
+    if (g_failed) {
+        printf("FAILED: %d checks\n", g_failed);
+        fflush(stdout);
+        _exit(1);
+    }
+    printf("OK\n");
+    fflush(stdout);
+    _exit(0);//服务器没有退出接口，直接结束进程
+}
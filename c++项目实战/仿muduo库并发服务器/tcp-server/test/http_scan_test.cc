@@ -0,0 +1,101 @@
+/*头部扫描的一致性测试：当前CPU支持的每一种向量化实现，结果都必须和逐字节实现完全一致
+    ./http_scan_test
+    1. 每个字节值放在向量中的每个位置上，分别作为唯一的特殊字节
+    2. 随机长度、随机起始地址（不对齐）的随机数据，特殊字节出现的概率不同
+    3. 每种实现分别解析同一组请求，解析结果一致
+*/
+#include <random>
+#include <map>
+#include "../source/http/http.hpp"
+
+static int g_failed = 0;
+
+void Check(const HttpScanner::Impl &impl, const char *data, size_t len) {
+    size_t token = HttpScanner::TokenScalar(data, len);
+    size_t value = HttpScanner::ValueScalar(data, len);
+    if (impl._token(data, len) != token) {
+        printf("%s token mismatch: len %zu, expect %zu, got %zu\n", impl._name, len, token, impl._token(data, len));
+        g_failed++;
+    }
+    if (impl._value(data, len) != value) {
+        printf("%s value mismatch: len %zu, expect %zu, got %zu\n", impl._name, len, value, impl._value(data, len));
+        g_failed++;
+    }
+}
+
+std::string ParseAll(const std::string &req) {
+    Buffer buf;
+    HttpContext context;
+    buf.WriteStringAndPush(req);
+    context.RecvHttpRequest(&buf);
+    std::string res = std::to_string(context.RecvStatu()) + " " + std::to_string(context.RespStatu());
+    if (context.RecvStatu() == RECV_HTTP_OVER) {
+        HttpRequest &r = context.Request();
+        res += " " + r._method + " " + r._path + " " + r._version;
+        std::map<std::string, std::string> sorted(r._headers.begin(), r._headers.end());
+        for (auto &it : sorted) res += "|" + it.first + "=" + it.second;
+    }
+    return res;
+}
+
+int main()
+{
+    std::vector<HttpScanner::Impl> impls = HttpScanner::Impls();
+    printf("implementations:");
+    for (auto &impl : impls) printf(" %s", impl._name);
+    printf(" (using %s)\n", HttpScanner::Name());
+    //1. 每个字节值出现在每个位置
+    char block[96];
+    for (auto &impl : impls) {
+        for (int c = 0; c < 256; c++) {
+            for (int pos = 0; pos < 80; pos++) {
+                memset(block, 'a', sizeof(block));
+                block[pos] = (char)c;
+                for (size_t len : {16, 31, 32, 33, 64, 80, 96}) Check(impl, block, len);
+            }
+        }
+    }
+    //2. 随机数据
+    std::mt19937 rng(2024);
+    const char special[] = "\r\n\t :;,\"()/\x01\x7f\x80\xff";
+    std::vector<char> data(4096 + 64);
+    for (int round = 0; round < 200000; round++) {
+        size_t len = rng() % 300;
+        size_t off = rng() % 64;
+        int rate = 1 + rng() % 200;
+        for (size_t i = 0; i < len; i++) {
+            if ((int)(rng() % rate) == 0) data[off + i] = special[rng() % (sizeof(special) - 1)];
+            else data[off + i] = "abcXYZ019-_.~!#"[rng() % 15];
+        }
+        for (auto &impl : impls) Check(impl, &data[off], len);
+    }
+    //3. 完整的请求解析
+    std::vector<std::string> reqs = {
+        "GET / HTTP/1.1\r\nHost: h\r\n\r\n",
+        "GET /index.html HTTP/1.1\r\nCookie: " + std::string(5000, 'c') + "\r\nAuthorization: Bearer " + std::string(1200, 'j') + "\r\n\r\n",
+        "POST /x HTTP/1.0\r\nX-Long-Name-" + std::string(100, 'n') + ": v\r\nA:\tb\t\r\n\r\n",
+        "GET / HTTP/1.1\r\nBad\x01Name: v\r\n\r\n",
+        "GET / HTTP/1.1\r\nName: bad\x01value" + std::string(40, 'v') + "\r\n\r\n",
+        "GET / HTTP/1.1\r\nName: bare\rcr" + std::string(40, 'v') + "\r\n\r\n",
+        "GET / HTTP/1.1\r\nUtf8: \xe4\xbd\xa0\xe5\xa5\xbd" + std::string(40, 'v') + "\r\n\r\n",
+    };
+    for (auto &req : reqs) {
+        HttpScanner::Select(impls[0]);
+        std::string expect = ParseAll(req);
+        for (auto &impl : impls) {
+            HttpScanner::Select(impl);
+            std::string got = ParseAll(req);
+            if (got != expect) {
+                printf("%s parse mismatch:\n  expect %.120s\n  got    %.120s\n", impl._name, expect.c_str(), got.c_str());
+                g_failed++;
+            }
+        }
+    }
+    HttpScanner::Select(impls.back());
+    if (g_failed) {
+        printf("FAILED: %d mismatches\n", g_failed);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*读取暂停原因测试：回显服务器开启超过高水位线自动暂停读取，客户端只发送不接收
+    ./tcp_backpressure_test
+    1. 回显的数据积压到高水位线以上后，服务器停止读取
+    2. 业务在这时调用PauseRead/ResumeRead，不能解除高水位线造成的暂停
+    3. 客户端开始接收后，发送缓冲区降下来自动恢复读取，所有数据完整回显
+*/
+#include <atomic>
+#include "../source/server.hpp"
+
+#define TOTAL_BYTES (16 * 1024 * 1024)
+
+static std::atomic<size_t> g_received(0);
+static PtrConnection g_conn;
+static std::mutex g_mutex;
+
+void OnConnected(const PtrConnection &conn) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    g_conn = conn;
+}
+void OnMessage(const PtrConnection &conn, Buffer *buf) {
+    g_received += buf->ReadAbleSize();
+    conn->Send(buf->ReadPosition(), buf->ReadAbleSize());
+    buf->MoveReadOffset(buf->ReadAbleSize());
+}
+//等到服务器接收的数据量不再变化
+size_t WaitStable() {
+    size_t last = g_received;
+    while (true) {
+        usleep(200000);
+        size_t now = g_received;
+        if (now == last) return now;
+        last = now;
+    }
+}
+
+int main()
+{
+    uint16_t port = 8615;
+    std::thread([=]() {
+        TcpServer server(port);
+        server.SetWaterMarks(64 * 1024, 16 * 1024);
+        server.EnableAutoPauseRead(true);
+        server.SetConnectedCallback(OnConnected);
+        server.SetMessageCallback(OnMessage);
+        server.Start();
+    }).detach();
+    usleep(200000);
+    Socket cli_sock;
+    if (cli_sock.CreateClient(port, "127.0.0.1") == false) abort();
+    int fd = cli_sock.Fd();
+    std::thread sender([fd]() {
+        std::vector<char> block(64 * 1024, 'p');
+        for (size_t sent = 0; sent < TOTAL_BYTES;) {
+            ssize_t ret = send(fd, &block[0], std::min(block.size(), TOTAL_BYTES - sent), 0);
+            if (ret <= 0) return;
+            sent += ret;
+        }
+    });
+    int failed = 0;
+    //1. 客户端不接收，服务器积压到高水位线以上后停止读取
+    size_t paused = WaitStable();
+    if (paused >= TOTAL_BYTES) {
+        printf("server never paused\n");
+        failed++;
+    }
+    //2. 业务自己的暂停和恢复不影响高水位线造成的暂停
+    PtrConnection conn;
+    {
+        std::unique_lock<std::mutex> lock(g_mutex);
+        conn = g_conn;
+    }
+    conn->PauseRead();
+    conn->ResumeRead();
+    size_t after = WaitStable();
+    if (after != paused) {
+        printf("user resume re-enabled reading: %zu -> %zu bytes\n", paused, after);
+        failed++;
+    }
+    //3. 客户端接收之后自动恢复，全部数据回显
+    std::vector<char> buf(65536);
+    size_t echoed = 0;
+    while (echoed < TOTAL_BYTES) {
+        ssize_t ret = recv(fd, &buf[0], buf.size(), 0);
+        if (ret <= 0) break;
+        echoed += ret;
+    }
+    sender.join();
+    if (echoed != TOTAL_BYTES || g_received != TOTAL_BYTES) {
+        printf("echoed %zu of %d bytes\n", echoed, TOTAL_BYTES);
+        failed++;
+    }
+    printf("paused at %zu bytes\n", paused);
+    printf(failed ? "FAILED\n" : "OK\n");
+    fflush(stdout);
+    _exit(failed ? 1 : 0);//服务器没有退出接口，直接结束进程
+}